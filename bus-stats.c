@@ -0,0 +1,104 @@
+#include "bus-stats.h"
+#include <drivers/sched.h>
+#include <signal.h>
+
+void bus_stats_reset( bus_stats_t *s )
+{
+	dint();
+	s->bytes = 0;
+	eint();
+
+	s->frames = s->bad_frames = 0;
+	s->tok_wait = 0;
+	s->n_srcs = 0;
+	s->other_src = 0;
+
+	s->start = sched_time;
+	/* Count a wait that's in progress from now */
+	if( s->waiting )
+		s->wait_start = s->start;
+}
+
+static void inc( uint16_t *v )
+{
+	if( *v != 0xffff )
+		(*v)++;
+}
+
+void bus_stats_frame( bus_stats_t *s, uint8_t src, bool crc_ok )
+{
+	uint8_t i;
+
+	inc( &s->frames );
+	if( !crc_ok ) {
+		/* Can't trust its source */
+		inc( &s->bad_frames );
+		return;
+	}
+
+	for( i=0; i<s->n_srcs; i++ )
+		if( s->src[i].addr == src ) {
+			inc( &s->src[i].frames );
+			return;
+		}
+
+	if( s->n_srcs == BUS_STATS_SRCS ) {
+		inc( &s->other_src );
+		return;
+	}
+
+	s->src[i].addr = src;
+	s->src[i].frames = 1;
+	s->n_srcs++;
+}
+
+void bus_stats_waiting( bus_stats_t *s, bool waiting )
+{
+	if( waiting == s->waiting )
+		return;
+
+	if( waiting )
+		s->wait_start = sched_time;
+	else
+		s->tok_wait += sched_time_since( s->wait_start );
+
+	s->waiting = waiting;
+}
+
+static uint8_t *pack16( uint8_t *buf, uint16_t v )
+{
+	*(buf++) = v & 0xff;
+	*(buf++) = (v >> 8) & 0xff;
+	return buf;
+}
+
+uint8_t bus_stats_pack( const bus_stats_t *s, uint8_t *buf )
+{
+	uint8_t *p = buf, i;
+	uint16_t tok_wait = s->tok_wait;
+	uint32_t bytes;
+
+	dint();
+	bytes = s->bytes;
+	eint();
+
+	/* Include the current wait */
+	if( s->waiting )
+		tok_wait += sched_time_since( s->wait_start );
+
+	p = pack16( p, sched_time_since( s->start ) );
+	p = pack16( p, bytes & 0xffff );
+	p = pack16( p, bytes >> 16 );
+	p = pack16( p, s->frames );
+	p = pack16( p, s->bad_frames );
+	p = pack16( p, tok_wait );
+	p = pack16( p, s->other_src );
+
+	*(p++) = s->n_srcs;
+	for( i=0; i<s->n_srcs; i++ ) {
+		*(p++) = s->src[i].addr;
+		p = pack16( p, s->src[i].frames );
+	}
+
+	return p - buf;
+}
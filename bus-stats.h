@@ -0,0 +1,68 @@
+#ifndef __BUS_STATS_H
+#define __BUS_STATS_H
+/* Bus utilisation statistics, kept by a node that hears everything on
+   the bus (the gateway, in promiscuous mode).
+   Counts are since the statistics were last reset; times are in
+   scheduler ticks. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of source addresses that frames are counted for individually */
+#define BUS_STATS_SRCS 8
+
+typedef struct {
+	/* Bytes on the bus, whether heard or sent by us */
+	uint32_t bytes;
+	/* Frames seen, and how many of them had bad CRCs */
+	uint16_t frames, bad_frames;
+	/* Time spent waiting for the token to transmit */
+	uint16_t tok_wait;
+
+	/* Frames from the first BUS_STATS_SRCS sources seen.  Frames from
+	   the rest are counted in other_src. */
+	struct {
+		uint8_t addr;
+		uint16_t frames;
+	} src[BUS_STATS_SRCS];
+	uint8_t n_srcs;
+	uint16_t other_src;
+
+	/* Private: */
+	/* sched_time at the last reset */
+	uint16_t start;
+	/* sched_time when we started waiting for the token */
+	uint16_t wait_start;
+	bool waiting;
+} bus_stats_t;
+
+/* Most bytes bus_stats_pack() writes */
+#define BUS_STATS_PACKED_MAX (15 + 3 * BUS_STATS_SRCS)
+
+/* Clear all statistics, starting a new window */
+void bus_stats_reset( bus_stats_t *s );
+
+/* Record a byte going over the bus.
+   Called in intr context. */
+static inline void bus_stats_byte( bus_stats_t *s )
+{
+	s->bytes++;
+}
+
+/* Record a frame from the given address (with the priority bit clear) */
+void bus_stats_frame( bus_stats_t *s, uint8_t src, bool crc_ok );
+
+/* Record whether we're waiting for the token to transmit */
+void bus_stats_waiting( bus_stats_t *s, bool waiting );
+
+/* Pack the statistics into buf as little-endian words, returning the
+   number of bytes written:
+     window (16 bits, ticks since the last reset: reset at least
+       every 65535 ticks)
+     bytes (32 bits)
+     frames, bad frames, token wait, other sources (16 bits each)
+     number of sources (8 bits), then for each: address (8 bits),
+     frames (16 bits)
+   Disables interrupts briefly to read the byte count. */
+uint8_t bus_stats_pack( const bus_stats_t *s, uint8_t *buf );
+
+#endif	/* __BUS_STATS_H */
@@ -0,0 +1,99 @@
+/*   Copyright (C) 2010 Robert Spanton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+#include "cobs.h"
+
+/* Encoder states */
+enum {
+	/* Opening delimiter next */
+	TX_START,
+	/* Frame contents (and their codes) next */
+	TX_DATA,
+	/* Closing delimiter next */
+	TX_END,
+};
+
+void cobs_tx_start( cobs_tx_t *c )
+{
+	c->state = TX_START;
+	c->pos = 0;
+	c->run = 0;
+}
+
+bool cobs_tx_byte( cobs_tx_t *c, const uint8_t *buf, uint8_t len, uint8_t *b )
+{
+	uint8_t d;
+
+	switch( c->state ) {
+	case TX_START:
+		*b = COBS_DELIM;
+		c->state = TX_DATA;
+		return false;
+
+	case TX_DATA:
+		if( c->run == COBS_MAX_RUN ) {
+			/* Run's as long as a code can cover: close it, without
+			   a zero */
+			*b = COBS_MAX_RUN + 1;
+			c->run = 0;
+		} else if( c->pos == len ) {
+			/* Last code.  Its zero is implied. */
+			*b = c->run + 1;
+			c->state = TX_END;
+		} else if( (d = buf[c->pos++]) == 0 ) {
+			*b = c->run + 1;
+			c->run = 0;
+		} else {
+			*b = d;
+			c->run++;
+		}
+		return false;
+
+	default:
+		*b = COBS_DELIM;
+		return true;
+	}
+}
+
+uint8_t cobs_decode( uint8_t *buf, uint8_t len )
+{
+	/* Decoded bytes are written backwards from the end of buf.  The
+	   output's always at least one byte shorter than what's been read,
+	   so this never overwrites anything that hasn't been read yet. */
+	uint8_t r = len, w = len, i;
+	bool last = true;
+
+	while( r > 0 ) {
+		uint8_t code = buf[--r];
+
+		if( code == COBS_DELIM || code - 1 > r )
+			return 0;
+
+		if( !last && code != COBS_MAX_RUN + 1 )
+			buf[--w] = 0;
+		last = false;
+
+		for( i=1; i<code; i++ )
+			buf[--w] = buf[--r];
+	}
+
+	if( w == len )
+		return 0;
+
+	for( i=0; w<len; i++ )
+		buf[i] = buf[w++];
+
+	return i;
+}
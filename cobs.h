@@ -0,0 +1,48 @@
+#ifndef __COBS_H
+#define __COBS_H
+/* Consistent-overhead byte stuffing, for the SRIC_FRAMING_COBS framing
+   (see sric-frame.h).  Nothing in here depends on the MSP430, so that host
+   software can be built against it too.
+
+   This is the "reverse" variant: each run of non-zero bytes is followed,
+   rather than preceded, by its code byte.  The encoder can then work out
+   each byte as it's sent, at a fixed cost per byte and with no lookahead,
+   and the receiver needn't do anything but store bytes up to the closing
+   0x00.  The frame is decoded backwards from its end once it's all in.
+
+   A code byte c means that the c-1 bytes before it were non-zero, and
+   that they were followed by a 0x00 -- unless c is 0xFF, or it's the last
+   code in the frame.  An encoded frame is at most one byte longer than the
+   original for every 254 bytes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Marks the start and end of an encoded frame */
+#define COBS_DELIM 0x00
+
+/* Longest run of non-zero bytes that one code byte covers */
+#define COBS_MAX_RUN 254
+
+/* Transmit state: the encoder for one frame being sent */
+typedef struct {
+	uint8_t state;
+	/* Next byte of the frame to be encoded */
+	uint8_t pos;
+	/* Number of non-zero bytes since the last code */
+	uint8_t run;
+} cobs_tx_t;
+
+/* Start encoding a frame */
+void cobs_tx_start( cobs_tx_t *c );
+
+/* Put the next byte of the encoding of the len-byte frame at buf into *b.
+   The encoding starts and ends with COBS_DELIM.  len must be at most
+   253, so that the encoding (delimiters aside) fits in 255 bytes.
+   Returns true if that was the last byte.  Quick enough for intr context. */
+bool cobs_tx_byte( cobs_tx_t *c, const uint8_t *buf, uint8_t len, uint8_t *b );
+
+/* Decode the len encoded bytes at buf (without the delimiters) in place.
+   Returns the length of the decoded frame, or 0 if buf isn't valid. */
+uint8_t cobs_decode( uint8_t *buf, uint8_t len );
+
+#endif	/* __COBS_H */
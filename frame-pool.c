@@ -0,0 +1,51 @@
+#include "frame-pool.h"
+
+/* The byte in front of each frame is its reference count */
+static uint8_t pool[FRAME_POOL_LEN][FRAME_SIZE + 1];
+
+#define refcount(f) ( (f)[-1] )
+
+uint8_t *frame_alloc( void )
+{
+	uint8_t i;
+
+	for( i=0; i<FRAME_POOL_LEN; i++ )
+		if( pool[i][0] == 0 ) {
+			pool[i][0] = 1;
+			return &pool[i][1];
+		}
+
+	return NULL;
+}
+
+void frame_ref( uint8_t *f )
+{
+	refcount(f)++;
+}
+
+void frame_unref( uint8_t *f )
+{
+	if( f != NULL && refcount(f) > 0 )
+		refcount(f)--;
+}
+
+bool frame_shared( const uint8_t *f )
+{
+	return refcount(f) > 1;
+}
+
+bool frame_recycle( uint8_t **slot )
+{
+	uint8_t *f;
+
+	if( !frame_shared(*slot) )
+		return true;
+
+	f = frame_alloc();
+	if( f == NULL )
+		return false;
+
+	frame_unref(*slot);
+	*slot = f;
+	return true;
+}
@@ -0,0 +1,66 @@
+#ifndef __FRAME_POOL_H
+#define __FRAME_POOL_H
+/* Pool of frame buffers shared between sric, hostser and the gateway.
+   Frames are handed between these by reference rather than being copied.
+   Each frame has a reference count, and returns to the pool when the last
+   reference to it is dropped.
+
+   These must only be called from the main loop -- never in intr context.
+   Interrupt handlers only ever write into frames that have already been
+   handed to them. */
+#include <stdbool.h>
+#include <stdint.h>
+#include "sric.h"
+#include "hostser.h"
+#ifdef SRIC_PROMISC
+#include "sric-gw.h"
+#endif
+
+/* Every frame is big enough to hold a SRIC transmit buffer */
+#define FRAME_SIZE (SRIC_TXBUF_SIZE + 1)
+
+/* Most frames that can be held at once.
+   sric.c uses one frame per receive ring slot, plus its transmit buffer.
+   hostser.c uses one per receive ring slot, plus its transmit buffer,
+   and holds each frame queued for transmission.  Those include bus
+   frames forwarded to the host, whose sric.c slots are given fresh
+   frames.  The gateway holds each frame in its queue for the bus, and
+   the local device's last command to the host, for retransmission. */
+#define FRAME_POOL_SRIC (1 + SRIC_RX_DEPTH)
+#ifdef SRIC_PROMISC
+#define FRAME_POOL_HOSTSER (1 + HOSTSER_RX_DEPTH + HOSTSER_TX_DEPTH)
+#define FRAME_POOL_GW (GW_TXQ_LEN + 1)
+#define FRAME_POOL_NEEDED \
+	(FRAME_POOL_SRIC + FRAME_POOL_HOSTSER + FRAME_POOL_GW)
+#else
+#define FRAME_POOL_NEEDED FRAME_POOL_SRIC
+#endif
+
+/* Number of frames in the pool */
+#ifndef FRAME_POOL_LEN
+#define FRAME_POOL_LEN FRAME_POOL_NEEDED
+#endif
+
+#if FRAME_POOL_LEN < FRAME_POOL_NEEDED
+#error "FRAME_POOL_LEN is too small for everything that can hold a frame"
+#endif
+
+/* Get a frame from the pool, with one reference held.
+   Returns NULL if the pool is empty. */
+uint8_t *frame_alloc( void );
+
+/* Take another reference to the frame */
+void frame_ref( uint8_t *f );
+
+/* Drop a reference to the frame (safe to call with NULL) */
+void frame_unref( uint8_t *f );
+
+/* Returns true if there's more than one reference to the frame */
+bool frame_shared( const uint8_t *f );
+
+/* Make sure that *slot is a frame that nobody else has a reference to,
+   replacing it with a new frame from the pool if necessary.
+   Returns false if a replacement was needed but the pool was empty. */
+bool frame_recycle( uint8_t **slot );
+
+#endif	/* __FRAME_POOL_H */
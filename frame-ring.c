@@ -0,0 +1,53 @@
+#include "frame-ring.h"
+#include <stddef.h>
+
+/* Stop the compiler moving memory accesses across this point */
+#define barrier() __asm__ __volatile__( "" ::: "memory" )
+
+bool frame_ring_full( const frame_ring_t *r )
+{
+	return (uint8_t)(r->head - r->tail) > r->mask;
+}
+
+uint8_t *frame_ring_wr( const frame_ring_t *r )
+{
+	if( frame_ring_full(r) )
+		return NULL;
+
+	return *frame_ring_slot( r, r->head );
+}
+
+void frame_ring_push( frame_ring_t *r )
+{
+	/* The frame's filled in before the consumer can see it */
+	barrier();
+	r->head++;
+}
+
+bool frame_ring_put( frame_ring_t *r, uint8_t *frame )
+{
+	if( frame_ring_full(r) )
+		return false;
+
+	*frame_ring_slot( r, r->head ) = frame;
+	/* The slot's written before the consumer can see it */
+	barrier();
+	r->head++;
+	return true;
+}
+
+uint8_t **frame_ring_rd( const frame_ring_t *r )
+{
+	if( r->head == r->tail )
+		return NULL;
+
+	return frame_ring_slot( r, r->tail );
+}
+
+void frame_ring_pop( frame_ring_t *r )
+{
+	/* The slot and its frame are finished with before the producer can
+	   reuse them */
+	barrier();
+	r->tail++;
+}
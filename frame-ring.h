@@ -0,0 +1,60 @@
+#ifndef __FRAME_RING_H
+#define __FRAME_RING_H
+/* Single-producer, single-consumer ring of frame-pool frames.
+   Used to hand frames between interrupt handlers and the main loop.
+
+   Neither side needs to disable interrupts: the producer is the only one
+   to write head, and the consumer the only one to write tail.  A compiler
+   barrier before each update of head or tail keeps accesses to the slots
+   and the frames' contents on the right side of it, however the ring
+   functions end up inlined. */
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	/* One frame pointer per slot */
+	uint8_t **slots;
+	/* Number of slots - 1.  The number of slots must be a power of 2. */
+	uint8_t mask;
+
+	/* Number of frames that have been pushed/popped.
+	   These wrap, so the number in the ring is head - tail. */
+	volatile uint8_t head;
+	volatile uint8_t tail;
+} frame_ring_t;
+
+/* Define a ring with the given number of slots */
+#define FRAME_RING(name, depth)				\
+	static uint8_t *name ## _slots[depth];		\
+	static frame_ring_t name = {			\
+		.slots = name ## _slots,		\
+		.mask = (depth) - 1,			\
+	}
+
+/* The slot for the given head/tail count */
+#define frame_ring_slot(r, n) ( &(r)->slots[ (n) & (r)->mask ] )
+
+/* Returns true if every slot is occupied */
+bool frame_ring_full( const frame_ring_t *r );
+
+/*** Producer ***/
+/* Returns the frame already in the next free slot, or NULL if the ring's
+   full.  For rings whose slots each keep a frame to be filled in. */
+uint8_t *frame_ring_wr( const frame_ring_t *r );
+
+/* Make the frame in the next free slot available to the consumer */
+void frame_ring_push( frame_ring_t *r );
+
+/* Put the given frame in the next free slot, and make it available to the
+   consumer.  Returns false if the ring's full. */
+bool frame_ring_put( frame_ring_t *r, uint8_t *frame );
+
+/*** Consumer ***/
+/* Returns the slot holding the oldest frame, or NULL if the ring's empty.
+   The consumer may replace the frame in the slot before popping it. */
+uint8_t **frame_ring_rd( const frame_ring_t *r );
+
+/* Hand the oldest slot back to the producer */
+void frame_ring_pop( frame_ring_t *r );
+
+#endif	/* __FRAME_RING_H */
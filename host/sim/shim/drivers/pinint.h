@@ -0,0 +1,14 @@
+#ifndef __SIM_PININT_H
+#define __SIM_PININT_H
+/* The simulator's implementation of the pin interrupt interface */
+#include <stdint.h>
+
+typedef struct {
+	/* Pins to interrupt on: P1 in the low byte, P2 in the high */
+	uint16_t mask;
+	void (*int_cb) (uint16_t flags);
+} pinint_conf_t;
+
+void pinint_add( pinint_conf_t *conf );
+
+#endif	/* __SIM_PININT_H */
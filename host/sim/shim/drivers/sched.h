@@ -0,0 +1,25 @@
+#ifndef __SIM_SCHED_H
+#define __SIM_SCHED_H
+/* The simulator's implementation of the scheduler interface */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+	/* Number of ticks until the callback */
+	uint16_t t;
+
+	/* Called in intr context.  Return true to be called again after
+	   another t ticks. */
+	bool (*cb) (void *udata);
+	void *udata;
+} sched_task_t;
+
+void sched_add( const sched_task_t *task );
+void sched_rem( const sched_task_t *task );
+
+/* Ticks since startup */
+extern volatile uint16_t sched_time;
+uint16_t sched_time_since( uint16_t t );
+
+#endif	/* __SIM_SCHED_H */
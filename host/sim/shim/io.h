@@ -0,0 +1,20 @@
+#ifndef __SIM_IO_H
+#define __SIM_IO_H
+/* Stand-in for the MSP430 register definitions, for building the firmware
+   into the simulator.  Each simulated node has its own copy of these. */
+#include <stdint.h>
+#include <stddef.h>
+
+extern volatile uint8_t P1DIR, P1OUT, P1IN, P1IES, P1IE;
+extern volatile uint8_t P2DIR, P2OUT, P2IN, P2IES, P2IE;
+extern volatile uint8_t P3DIR, P3OUT;
+
+/* Accessing the watchdog is a chance for the simulator to deliver
+   interrupts to code that's spinning, waiting for them */
+volatile uint16_t *sim_wdtctl( void );
+#define WDTCTL (*sim_wdtctl())
+#define WDTHOLD 0x0080
+#define WDTPW 0x5A00
+#define WDTCNTCL 0x0008
+
+#endif	/* __SIM_IO_H */
@@ -0,0 +1,14 @@
+#ifndef __SIM_SIGNAL_H
+#define __SIM_SIGNAL_H
+/* Interrupt control for firmware running in the simulator */
+#include_next <signal.h>
+
+void sim_dint( void );
+void sim_eint( void );
+void sim_nop( void );
+
+#define dint() sim_dint()
+#define eint() sim_eint()
+#define nop() sim_nop()
+
+#endif	/* __SIM_SIGNAL_H */
@@ -0,0 +1,239 @@
+#include "sim-fault.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_SILENT 16
+
+static struct {
+	double flip, drop, toklose, tokdup;
+	/* fastflip */
+	double fastflip;
+	unsigned fastflip_baud;
+
+	struct {
+		unsigned node;
+		uint64_t start, end;
+	} silent[MAX_SILENT];
+	unsigned n_silent;
+} conf;
+
+static struct {
+	uint64_t bytes, flipped, fastflipped, dropped;
+	uint64_t tokens, tok_lost, tok_dup;
+	uint64_t silenced_bytes;
+
+	/* Time from a token being lost to one being passed on again */
+	uint64_t gaps, gap_sum_us, gap_max_us;
+} stats;
+
+static bool enabled = false;
+static uint64_t start_us;
+static uint64_t rng = 1;
+/* When the token was lost, or 0 if one's been seen since */
+static uint64_t lost_at = 0;
+
+static uint64_t now_us( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* xorshift64* */
+static uint64_t rand64( void )
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* True with probability p */
+static bool chance( double p )
+{
+	return p > 0 && (rand64() >> 11) * (1.0 / (1ULL << 53)) < p;
+}
+
+static bool parse_prob( const char *s, double *p )
+{
+	char *end;
+
+	*p = strtod( s, &end );
+	return end != s && *end == '\0' && *p >= 0 && *p <= 1;
+}
+
+static bool parse_fastflip( const char *s )
+{
+	const char *p = strchr( s, ':' );
+	char *end;
+
+	if( p == NULL )
+		return false;
+
+	conf.fastflip_baud = strtoul( s, &end, 10 );
+	return end == p && parse_prob( p + 1, &conf.fastflip );
+}
+
+static bool parse_silent( const char *s )
+{
+	unsigned node, t, len;
+	char c;
+
+	if( conf.n_silent == MAX_SILENT
+	    || sscanf( s, "%u:%u:%u%c", &node, &t, &len, &c ) != 3 )
+		return false;
+
+	conf.silent[conf.n_silent].node = node;
+	conf.silent[conf.n_silent].start = t * 1000ULL;
+	conf.silent[conf.n_silent].end = (t + (uint64_t)len) * 1000;
+	conf.n_silent++;
+	return true;
+}
+
+bool sim_fault_parse( const char *spec )
+{
+	char *s = strdup( spec ), *tok, *save;
+	bool ok = true;
+
+	start_us = now_us();
+
+	for( tok = strtok_r( s, ",", &save ); tok != NULL && ok;
+	     tok = strtok_r( NULL, ",", &save ) ) {
+		char *val = strchr( tok, '=' );
+
+		if( val == NULL ) {
+			ok = false;
+			break;
+		}
+		*val++ = '\0';
+
+		if( strcmp( tok, "flip" ) == 0 )
+			ok = parse_prob( val, &conf.flip );
+		else if( strcmp( tok, "fastflip" ) == 0 )
+			ok = parse_fastflip( val );
+		else if( strcmp( tok, "drop" ) == 0 )
+			ok = parse_prob( val, &conf.drop );
+		else if( strcmp( tok, "toklose" ) == 0 )
+			ok = parse_prob( val, &conf.toklose );
+		else if( strcmp( tok, "tokdup" ) == 0 )
+			ok = parse_prob( val, &conf.tokdup );
+		else if( strcmp( tok, "silent" ) == 0 )
+			ok = parse_silent( val );
+		else
+			ok = false;
+	}
+
+	free( s );
+	enabled = ok;
+	return ok;
+}
+
+void sim_fault_seed( unsigned seed )
+{
+	/* xorshift gets stuck at 0 */
+	rng = seed ? seed : 1;
+}
+
+bool sim_fault_enabled( void )
+{
+	return enabled;
+}
+
+bool sim_fault_silent( unsigned n )
+{
+	uint64_t t;
+	unsigned i;
+
+	if( conf.n_silent == 0 )
+		return false;
+
+	t = now_us() - start_us;
+	for( i=0; i<conf.n_silent; i++ )
+		if( conf.silent[i].node == n
+		    && t >= conf.silent[i].start && t < conf.silent[i].end )
+			return true;
+
+	return false;
+}
+
+bool sim_fault_bus( unsigned src, unsigned baud, uint8_t *b )
+{
+	stats.bytes++;
+
+	if( sim_fault_silent( src ) ) {
+		stats.silenced_bytes++;
+		return false;
+	}
+
+	if( chance( conf.drop ) ) {
+		stats.dropped++;
+		return false;
+	}
+
+	if( chance( conf.flip ) ) {
+		*b ^= 1 << (rand64() % 8);
+		stats.flipped++;
+	}
+
+	if( baud > conf.fastflip_baud && chance( conf.fastflip ) ) {
+		*b ^= 1 << (rand64() % 8);
+		stats.fastflipped++;
+	}
+
+	return true;
+}
+
+unsigned sim_fault_token( unsigned src, unsigned dest )
+{
+	unsigned n = 1;
+
+	stats.tokens++;
+
+	if( sim_fault_silent( src ) || sim_fault_silent( dest )
+	    || chance( conf.toklose ) )
+		n = 0;
+	else if( chance( conf.tokdup ) ) {
+		n = 2;
+		stats.tok_dup++;
+	}
+
+	if( n == 0 ) {
+		stats.tok_lost++;
+		if( lost_at == 0 )
+			lost_at = now_us();
+	} else if( lost_at != 0 ) {
+		/* There's a token going round again (though maybe not the
+		   one that was lost, if there were several) */
+		uint64_t gap = now_us() - lost_at;
+
+		stats.gaps++;
+		stats.gap_sum_us += gap;
+		if( gap > stats.gap_max_us )
+			stats.gap_max_us = gap;
+		lost_at = 0;
+	}
+
+	return n;
+}
+
+void sim_fault_report( FILE *f )
+{
+	fprintf( f, "{ \"bytes\": %llu, \"flipped\": %llu, \"fastflipped\": %llu, "
+		 "\"dropped\": %llu, "
+		 "\"silenced\": %llu, \"tokens\": %llu, \"tok_lost\": %llu, "
+		 "\"tok_dup\": %llu, \"tok_recoveries\": %llu, "
+		 "\"tok_recovery_avg_us\": %llu, \"tok_recovery_max_us\": %llu }\n",
+		 (unsigned long long)stats.bytes,
+		 (unsigned long long)stats.flipped,
+		 (unsigned long long)stats.fastflipped,
+		 (unsigned long long)stats.dropped,
+		 (unsigned long long)stats.silenced_bytes,
+		 (unsigned long long)stats.tokens,
+		 (unsigned long long)stats.tok_lost,
+		 (unsigned long long)stats.tok_dup,
+		 (unsigned long long)stats.gaps,
+		 (unsigned long long)(stats.gaps ? stats.gap_sum_us / stats.gaps : 0),
+		 (unsigned long long)stats.gap_max_us );
+}
@@ -0,0 +1,45 @@
+#ifndef __SIM_FAULT_H
+#define __SIM_FAULT_H
+/* Fault injection for the simulated bus.
+
+   Faults are given as a comma-separated list:
+     flip=P           Flip a random bit in a byte on the bus, with probability P
+     fastflip=BAUD:P  As flip, but only for bytes sent faster than BAUD, as
+                      if the bus's cabling couldn't take higher rates
+     drop=P           Lose a byte on the bus, with probability P
+     toklose=P        Lose a token as it's passed on, with probability P
+     tokdup=P         Pass a token on twice, with probability P
+     silent=N:T:LEN   Node N (0 is the gateway) hears and says nothing,
+                      token included, for LEN ms from T ms after the
+                      faults were set up.  May be given several times.
+
+   Not thread-safe: the caller serialises calls. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Parse a fault list.  Returns false if it's malformed. */
+bool sim_fault_parse( const char *spec );
+
+/* Seed the random number generator */
+void sim_fault_seed( unsigned seed );
+
+/* Whether any faults have been configured */
+bool sim_fault_enabled( void );
+
+/* A byte's been put on the bus by node src, at the given baud rate.
+   May corrupt it.  Returns false if it should be lost. */
+bool sim_fault_bus( unsigned src, unsigned baud, uint8_t *b );
+
+/* Whether node n is currently silent */
+bool sim_fault_silent( unsigned n );
+
+/* Node src has passed the token on to node dest.
+   Returns the number of tokens to deliver to the next node. */
+unsigned sim_fault_token( unsigned src, unsigned dest );
+
+/* Write the counts of injected faults, and how long the token took to
+   reappear after each loss, as a JSON object on one line */
+void sim_fault_report( FILE *f );
+
+#endif	/* __SIM_FAULT_H */
@@ -0,0 +1,766 @@
+/* Runtime for one simulated node: the MSP430 bits that the firmware
+   expects (registers, scheduler, pin interrupts, USARTs), the board
+   configuration, and the main loop.
+
+   Built with SIM_GW defined for the gateway, which gets the host link,
+   sric-gw.c and the director's token driver.  Clients use token-msp. */
+#define _GNU_SOURCE
+#include "sim-node.h"
+#include "sric.h"
+#include "sric-client.h"
+#include "version-buf.h"
+#ifdef SIM_GW
+#include "hostser.h"
+#include "sric-gw.h"
+#include "token-dir.h"
+#else
+#include "token-msp.h"
+#endif
+#include <drivers/pinint.h>
+#include <drivers/sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Pins: the token lines are on P1, LVDS transmit enable on P3 */
+#define TOK_TO_MASK 1
+#define TOK_TI_MASK 2
+#define TXEN_MASK 1
+
+/*** Registers ***/
+volatile uint8_t P1DIR, P1OUT = TOK_TO_MASK, P1IN, P1IES, P1IE;
+volatile uint8_t P2DIR, P2OUT, P2IN, P2IES, P2IE;
+volatile uint8_t P3DIR, P3OUT;
+static volatile uint16_t wdtctl;
+
+static const sim_node_conf_t *conf;
+static uint64_t start_us;
+
+/*** Things that arrive from other threads ***/
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Bytes from the bus, and the rate each was sent at */
+#define BUS_Q_LEN 1024
+static uint8_t bus_q[BUS_Q_LEN];
+static unsigned bus_q_baud[BUS_Q_LEN];
+static unsigned bus_q_head, bus_q_tail;
+/* Tokens */
+static unsigned tok_q;
+/* Set while the main loop is sleeping: write to wake_fd to wake it */
+static bool sleeping;
+static int wake_fd[2];
+static volatile bool stopping;
+
+/*** Interrupt state (only touched by the node's thread) ***/
+static bool intr_en = true;
+static bool in_intr = false;
+/* Whether anything's been delivered since the main loop last looked */
+static bool activity;
+
+/* Bus USART */
+static unsigned bus_baud;
+/* Bytes per second, with start and stop bits (0 for no limit) */
+static unsigned bus_bps;
+static bool bus_txing = false;
+static bool bus_rx_en = true;
+/* Bytes the bus USART may send right now (when rate limited) */
+static unsigned bus_credit;
+static uint64_t bus_credit_time;
+/* The byte being shifted out (when rate limited).  The USART asks for the
+   next byte as this one starts, and it reaches the other nodes once it's
+   finished. */
+static bool bus_shifting = false;
+static uint8_t bus_shift;
+
+/* Last seen state of the token out line */
+static bool to_was_high = true;
+static pinint_conf_t *pinint = NULL;
+
+#ifdef SIM_GW
+/* Host USART */
+static bool host_txing = false;
+static uint8_t host_out[256];
+static unsigned host_out_len = 0;
+/* Bytes from the host that may be received right now (when rate
+   limited) */
+static unsigned host_rx_credit;
+static uint64_t host_rx_credit_time;
+#endif
+
+static uint64_t now_us( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void wake( void )
+{
+	uint8_t b = 0;
+
+	if( sleeping )
+		(void) !write( wake_fd[1], &b, 1 );
+}
+
+/*** Scheduler ***/
+#define SCHED_LEN 16
+static struct {
+	const sched_task_t *task;
+	uint16_t due;
+} sched[SCHED_LEN];
+
+volatile uint16_t sched_time;
+
+void sched_add( const sched_task_t *task )
+{
+	uint8_t i, slot = SCHED_LEN;
+
+	for( i=0; i<SCHED_LEN; i++ ) {
+		if( sched[i].task == task ) {
+			/* Re-adding a task restarts its timeout */
+			slot = i;
+			break;
+		}
+		if( sched[i].task == NULL && slot == SCHED_LEN )
+			slot = i;
+	}
+
+	if( slot == SCHED_LEN )
+		/* Out of timers.  The firmware's sched has the same limit. */
+		return;
+
+	sched[slot].task = task;
+	sched[slot].due = sched_time + task->t;
+}
+
+void sched_rem( const sched_task_t *task )
+{
+	uint8_t i;
+
+	for( i=0; i<SCHED_LEN; i++ )
+		if( sched[i].task == task )
+			sched[i].task = NULL;
+}
+
+uint16_t sched_time_since( uint16_t t )
+{
+	return sched_time - t;
+}
+
+static void sched_run( void )
+{
+	uint8_t i;
+
+	sched_time = (now_us() - start_us) / conf->tick_us;
+
+	for( i=0; i<SCHED_LEN; i++ ) {
+		const sched_task_t *task = sched[i].task;
+
+		if( task == NULL || (int16_t)(sched_time - sched[i].due) < 0 )
+			continue;
+
+		sched[i].task = NULL;
+		activity = true;
+		if( task->cb( task->udata ) )
+			sched_add( task );
+	}
+}
+
+/* Microseconds until the next timer's due */
+static uint64_t sched_next_us( void )
+{
+	uint64_t next = conf->tick_us;
+	uint8_t i;
+
+	for( i=0; i<SCHED_LEN; i++ ) {
+		int16_t left;
+
+		if( sched[i].task == NULL )
+			continue;
+
+		left = sched[i].due - sched_time;
+		if( left <= 0 )
+			return 0;
+		if( (uint64_t)left * conf->tick_us < next )
+			next = (uint64_t)left * conf->tick_us;
+	}
+
+	return next;
+}
+
+/*** Token lines ***/
+void pinint_add( pinint_conf_t *c )
+{
+	pinint = c;
+}
+
+/* The token's passed on by a pulse on the TO line */
+static void to_check( void )
+{
+	bool high = P1OUT & TOK_TO_MASK;
+
+	if( to_was_high && !high )
+		conf->harness->token_out( conf->harness->ctx );
+
+	to_was_high = high;
+}
+
+/*** Bus USART ***/
+static void bus_tx_start( uint8_t n )
+{
+	if( !bus_txing && !bus_shifting ) {
+		bus_credit = 1;
+		bus_credit_time = now_us();
+	}
+
+	bus_txing = true;
+}
+
+static void bus_rx_gate( uint8_t n, bool en )
+{
+	bus_rx_en = en;
+}
+
+static void bus_set_baud( uint8_t n, uint32_t baud )
+{
+	bus_baud = baud;
+	bus_bps = baud / 10;
+}
+
+static void bus_tx_pump( void )
+{
+	if( !bus_txing && !bus_shifting )
+		return;
+
+	if( bus_bps ) {
+		uint64_t now = now_us();
+		uint64_t n = (now - bus_credit_time) * bus_bps / 1000000;
+
+		if( n ) {
+			bus_credit += n;
+			bus_credit_time = now;
+		}
+	}
+
+	while( bus_bps == 0 || bus_credit > 0 ) {
+		/* Bytes only get onto the bus while the driver's enabled */
+		bool txen = P3OUT & TXEN_MASK;
+		uint8_t b;
+
+		if( bus_shifting ) {
+			if( txen )
+				conf->harness->bus_tx( conf->harness->ctx, bus_shift,
+						       bus_baud );
+			bus_shifting = false;
+			activity = true;
+		}
+
+		if( !bus_txing )
+			break;
+
+		if( !sric_tx_cb( &b ) ) {
+			bus_txing = false;
+			break;
+		}
+
+		bus_credit--;
+		activity = true;
+
+		if( bus_bps == 0 ) {
+			if( txen )
+				conf->harness->bus_tx( conf->harness->ctx, b, bus_baud );
+		} else {
+			bus_shift = b;
+			bus_shifting = true;
+		}
+	}
+}
+
+#ifdef SIM_GW
+/*** Host USART ***/
+static void host_tx_start( uint8_t n )
+{
+	host_txing = true;
+}
+
+static void host_pump( void )
+{
+	uint8_t buf[64];
+	ssize_t r, i;
+
+	/* Receive, no faster than the link would deliver it */
+	while( true ) {
+		size_t n = sizeof(buf);
+
+		if( conf->host_baud ) {
+			uint64_t now = now_us();
+			uint64_t c = (now - host_rx_credit_time)
+				* (conf->host_baud / 10) / 1000000;
+
+			if( c ) {
+				host_rx_credit += c;
+				host_rx_credit_time = now;
+			}
+			if( host_rx_credit == 0 )
+				break;
+			if( n > host_rx_credit )
+				n = host_rx_credit;
+		}
+
+		r = read( conf->host_fd, buf, n );
+		if( r <= 0 ) {
+			/* The link's idle, so no credit builds up */
+			host_rx_credit = 1;
+			host_rx_credit_time = now_us();
+			break;
+		}
+
+		if( conf->host_baud )
+			host_rx_credit -= r;
+		activity = true;
+		for( i=0; i<r; i++ )
+			hostser_rx_cb( buf[i] );
+	}
+
+	/* Transmit, as fast as the host will take it */
+	while( host_txing || host_out_len ) {
+		if( host_out_len ) {
+			r = write( conf->host_fd, host_out, host_out_len );
+			if( r <= 0 )
+				return;
+
+			memmove( host_out, host_out + r, host_out_len - r );
+			host_out_len -= r;
+			activity = true;
+			continue;
+		}
+
+		while( host_out_len < sizeof(host_out) ) {
+			if( !hostser_tx_cb( host_out + host_out_len ) ) {
+				host_txing = false;
+				break;
+			}
+			host_out_len++;
+		}
+	}
+}
+#endif
+
+/*** Interrupts ***/
+/* Deliver everything that's pending */
+static void sim_intr( void )
+{
+	uint8_t rx[BUS_Q_LEN];
+	unsigned rx_baud[BUS_Q_LEN];
+	unsigned n = 0, i, tokens;
+
+	if( !intr_en || in_intr )
+		return;
+	in_intr = true;
+
+	to_check();
+	sched_run();
+
+	pthread_mutex_lock( &lock );
+	while( bus_q_tail != bus_q_head ) {
+		rx_baud[n] = bus_q_baud[bus_q_tail];
+		rx[n++] = bus_q[bus_q_tail];
+		bus_q_tail = (bus_q_tail + 1) % BUS_Q_LEN;
+	}
+	tokens = tok_q;
+	tok_q = 0;
+	pthread_mutex_unlock( &lock );
+
+	if( n || tokens )
+		activity = true;
+
+	/* Transmit first, so that if we've just finished transmitting the
+	   receiver's back on for anything that arrived meanwhile */
+	bus_tx_pump();
+
+	/* The receiver's off while we're transmitting */
+	for( i=0; i<n; i++ ) {
+		if( !bus_rx_en )
+			continue;
+
+		/* Bytes at the wrong rate come out as framing errors */
+		if( rx_baud[i] == bus_baud )
+			sric_rx_cb( rx[i] );
+		else
+			sric_rx_err();
+	}
+
+	for( ; tokens; tokens-- ) {
+		if( pinint == NULL )
+			continue;
+
+		to_check();
+		pinint->int_cb( pinint->mask );
+		to_check();
+	}
+
+#ifdef SIM_GW
+	host_pump();
+#endif
+
+	to_check();
+	in_intr = false;
+}
+
+volatile uint16_t *sim_wdtctl( void )
+{
+
+	sim_intr();
+	return &wdtctl;
+}
+
+void sim_dint( void )
+{
+	intr_en = false;
+}
+
+void sim_eint( void )
+{
+	intr_en = true;
+	sim_intr();
+}
+
+void sim_nop( void )
+{
+	to_check();
+}
+
+/*** Board configuration ***/
+#ifdef SIM_GW
+const token_dir_conf_t token_dir_conf = {
+#else
+const token_msp_conf_t token_msp_conf = {
+#endif
+	.haz_token = sric_haz_token,
+
+	.to_port = &P1OUT,
+	.to_dir = &P1DIR,
+	.to_mask = TOK_TO_MASK,
+
+	.ti_port = &P1IN,
+	.ti_dir = &P1DIR,
+	.ti_mask = TOK_TI_MASK,
+};
+
+#ifdef SIM_GW
+/* Microseconds, for capture timestamps */
+static uint32_t rx_time( void )
+{
+	return now_us() - start_us;
+}
+#endif
+
+/* The bus rates come from the simulator at run time, so this is
+   writable, though the firmware sees it as the usual const sric_conf */
+sric_conf_t sim_sric_conf __asm__("sric_conf") = {
+	.usart_tx_start = bus_tx_start,
+	.usart_rx_gate = bus_rx_gate,
+	.usart_n = 0,
+
+#ifdef SIM_GW
+	.token_drv = &token_dir_drv,
+#else
+	.token_drv = &token_msp_drv,
+#endif
+
+	.txen_dir = &P3DIR,
+	.txen_port = &P3OUT,
+	.txen_mask = TXEN_MASK,
+
+	.rx_cmd = sric_client_rx,
+#ifdef SIM_GW
+	.rx_resp = sric_gw_sric_rx_resp,
+	.promisc_rx = sric_gw_sric_promisc_rx,
+	.rx_time = rx_time,
+	.rx_time_hz = 1000000,
+#endif
+};
+
+#ifdef SIM_GW
+const hostser_conf_t hostser_conf = {
+	.usart_tx_start = host_tx_start,
+	.usart_tx_start_n = 0,
+
+	.rx_cb = sric_gw_hostser_rx,
+	.tx_done_cb = sric_gw_hostser_tx_done,
+};
+
+const sric_client_conf_t sric_client_conf = {
+	.devclass = SRIC_CLASS_PCSRIC,
+};
+#else
+/* Byte count and sum of the transfer in progress, for cmd_xfer_sum */
+static uint32_t xfer_bytes, xfer_sum;
+
+static void xfer_start( void )
+{
+	xfer_bytes = xfer_sum = 0;
+}
+
+static void xfer_rx( const uint8_t *data, uint8_t len )
+{
+	uint8_t i;
+
+	/* Weight each byte by its position, so that data in the wrong order
+	   shows up */
+	for( i=0; i<len; i++ )
+		xfer_sum += data[i] * (++xfer_bytes);
+}
+
+/* Registers to read and write, which do nothing but count changes */
+static uint16_t reg_setpoint;
+static uint8_t reg_mode;
+static uint16_t reg_changes;
+
+static void reg_changed( uint8_t reg __attribute__((unused)) )
+{
+	reg_changes++;
+}
+
+static const sric_reg_t regs[] = {
+	{ &xfer_bytes, 4, false, NULL },
+	{ &xfer_sum, 4, false, NULL },
+	{ &reg_setpoint, 2, true, reg_changed },
+	{ &reg_mode, 1, true, reg_changed },
+	{ &reg_changes, 2, false, NULL },
+};
+
+const sric_client_conf_t sric_client_conf = {
+	.devclass = SRIC_CLASS_JOINTIO,
+
+	.xfer_window = 16,
+	.xfer_start = xfer_start,
+	.xfer_rx = xfer_rx,
+
+	.regs = regs,
+	.reg_num = sizeof(regs) / sizeof(*regs),
+};
+#endif
+
+/*** Commands that every simulated board has ***/
+/* Respond with the command's data */
+static uint8_t cmd_echo( const sric_if_t *iface )
+{
+	uint8_t len = iface->rxbuf[SRIC_LEN] - 1;
+
+	memcpy( iface->txbuf + SRIC_DATA, iface->rxbuf + SRIC_DATA + 1, len );
+	return len;
+}
+
+/* Respond with the number of commands received so far */
+static uint8_t cmd_count( const sric_if_t *iface )
+{
+	static uint32_t count = 0;
+	uint8_t *d = iface->txbuf + SRIC_DATA;
+
+	count++;
+	d[0] = count & 0xff;
+	d[1] = (count >> 8) & 0xff;
+	d[2] = (count >> 16) & 0xff;
+	d[3] = (count >> 24) & 0xff;
+	return 4;
+}
+
+#ifndef SIM_GW
+/* Respond with the byte count and sum of the last transfer */
+static uint8_t cmd_xfer_sum( const sric_if_t *iface )
+{
+	uint8_t *d = iface->txbuf + SRIC_DATA;
+	uint8_t i;
+
+	for( i=0; i<4; i++ ) {
+		d[i] = (xfer_bytes >> (i * 8)) & 0xff;
+		d[4 + i] = (xfer_sum >> (i * 8)) & 0xff;
+	}
+	return 8;
+}
+#endif
+
+const sric_cmd_t sric_commands[] = {
+	SRIC_CMD( cmd_echo, 1, MAX_PAYLOAD, MAX_PAYLOAD - 1, SRIC_CMD_F_IDEMPOTENT ),
+	SRIC_CMD( cmd_count, 1, 1, 4, 0 ),
+#ifndef SIM_GW
+	SRIC_CMD( cmd_xfer_sum, 1, 1, 8, SRIC_CMD_F_IDEMPOTENT ),
+#endif
+};
+
+const uint8_t sric_cmd_num = sizeof(sric_commands) / sizeof(*sric_commands);
+
+/* There's no git version information in the simulator, so serve up a
+   made-up buffer of about the usual size */
+#define SIM_VERSIONBUF_LEN 200
+
+uint8_t version_buf_read( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	uint16_t off;
+	uint8_t send, i;
+
+	off = data[1] | ((uint16_t)data[2] << 8);
+	if( off >= SIM_VERSIONBUF_LEN )
+		return 0;
+
+	send = SIM_VERSIONBUF_LEN - off;
+	if( send > MAX_PAYLOAD )
+		send = MAX_PAYLOAD;
+
+	for( i=0; i<send; i++ )
+		iface->txbuf[SRIC_DATA + i] = off + i;
+	return send;
+}
+
+/*** Main loop ***/
+/* Sleep until there's something to do */
+static void idle( void )
+{
+	struct pollfd fds[2];
+	uint64_t wait = sched_next_us();
+	uint8_t buf[16];
+	int nfds = 1;
+
+	if( (bus_txing || bus_shifting) && bus_bps )
+		/* Wait for the next byte time */
+		wait = 1000000 / bus_bps + 1;
+
+	pthread_mutex_lock( &lock );
+	if( bus_q_tail != bus_q_head || tok_q || stopping ) {
+		pthread_mutex_unlock( &lock );
+		return;
+	}
+	sleeping = true;
+	pthread_mutex_unlock( &lock );
+
+	fds[0].fd = wake_fd[0];
+	fds[0].events = POLLIN;
+#ifdef SIM_GW
+	fds[1].fd = conf->host_fd;
+	fds[1].events = POLLIN;
+	if( conf->host_baud && host_rx_credit == 0 ) {
+		/* There's more from the host, but not until the next byte
+		   time */
+		fds[1].events = 0;
+		if( wait > 10000000 / conf->host_baud + 1 )
+			wait = 10000000 / conf->host_baud + 1;
+	}
+	if( host_out_len )
+		fds[1].events |= POLLOUT;
+	nfds = 2;
+#endif
+
+	if( wait < 1000 ) {
+		/* poll() only does milliseconds */
+		pthread_mutex_lock( &lock );
+		sleeping = false;
+		pthread_mutex_unlock( &lock );
+		usleep( wait );
+		return;
+	}
+
+	poll( fds, nfds, wait / 1000 );
+
+	pthread_mutex_lock( &lock );
+	sleeping = false;
+	pthread_mutex_unlock( &lock );
+	while( read( wake_fd[0], buf, sizeof(buf) ) > 0 )
+		;
+}
+
+static void run( const sim_node_conf_t *c )
+{
+	uint8_t quiet = 0;
+
+	conf = c;
+	start_us = now_us();
+	if( pipe2( wake_fd, O_NONBLOCK ) != 0 )
+		return;
+
+	bus_set_baud( 0, conf->baud );
+	sim_sric_conf.baud_base = conf->baud;
+	sim_sric_conf.baud_max = conf->baud_max > conf->baud ? conf->baud_max : conf->baud;
+	/* With no limit, there's nothing to change */
+	if( conf->baud )
+		sim_sric_conf.usart_set_baud = bus_set_baud;
+
+	sric_init();
+	sric_client_init();
+#ifdef SIM_GW
+	token_dir_init();
+	hostser_init();
+	sric_gw_init();
+#else
+	token_msp_init();
+#endif
+
+	if( conf->addr )
+		sric_addr = conf->addr;
+
+	while( !stopping ) {
+		activity = false;
+		sim_intr();
+
+		sric_poll();
+#ifdef SIM_GW
+		hostser_poll();
+		sric_gw_poll();
+#endif
+
+		/* Go round at least twice after something happens, as
+		   the polls only deal with one thing at a time */
+		if( activity )
+			quiet = 0;
+		else if( ++quiet >= 2 )
+			idle();
+	}
+
+	close( wake_fd[0] );
+	close( wake_fd[1] );
+}
+
+static void stop( void )
+{
+	pthread_mutex_lock( &lock );
+	stopping = true;
+	wake();
+	pthread_mutex_unlock( &lock );
+}
+
+static void bus_rx( uint8_t b, unsigned baud )
+{
+	unsigned next;
+
+	pthread_mutex_lock( &lock );
+	next = (bus_q_head + 1) % BUS_Q_LEN;
+	/* Overrun if there's no space */
+	if( next != bus_q_tail ) {
+		bus_q[bus_q_head] = b;
+		bus_q_baud[bus_q_head] = baud;
+		bus_q_head = next;
+	}
+	wake();
+	pthread_mutex_unlock( &lock );
+}
+
+static void token_in( void )
+{
+	pthread_mutex_lock( &lock );
+	tok_q++;
+	wake();
+	pthread_mutex_unlock( &lock );
+}
+
+const sim_node_t sim_node = {
+	.run = run,
+	.stop = stop,
+	.bus_rx = bus_rx,
+	.token_in = token_in,
+};
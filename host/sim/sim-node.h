@@ -0,0 +1,65 @@
+#ifndef __SIM_NODE_H
+#define __SIM_NODE_H
+/* Interface between the simulator and the simulated nodes.
+
+   Each node is the real firmware, built into a shared object along with
+   sim-node.c.  The simulator loads a separate copy of the object for each
+   node, so that every node gets its own copy of the firmware's state, and
+   runs each node's main loop in its own thread.
+
+   Interrupts from the outside world (bus bytes, the token, timers, the
+   host link) are queued, and delivered in the node's own thread whenever
+   the firmware polls, touches the watchdog or enables interrupts.  So as
+   on the real thing, interrupt handlers never run concurrently with each
+   other, and not at all while interrupts are disabled. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Services the simulator provides to each node */
+typedef struct {
+	/* Passed to each of the functions below */
+	void *ctx;
+
+	/* The node has put a byte on the bus, at the given baud rate */
+	void (*bus_tx) ( void *ctx, uint8_t b, unsigned baud );
+
+	/* The node has passed the token on */
+	void (*token_out) ( void *ctx );
+} sim_harness_t;
+
+typedef struct {
+	const sim_harness_t *harness;
+
+	/* Bus baud rate that nodes start at (0 for no limit), and the
+	   fastest this node can switch to */
+	unsigned baud;
+	unsigned baud_max;
+
+	/* Length of a scheduler tick in microseconds */
+	unsigned tick_us;
+
+	/* File descriptor of the host serial link (gateways only), and the
+	   link's baud rate (0 for no limit) */
+	int host_fd;
+	unsigned host_baud;
+
+	/* Address to start with (0 to wait for enumeration) */
+	uint8_t addr;
+} sim_node_conf_t;
+
+/* Exported by each node object as "sim_node" */
+typedef struct {
+	/* Run the node's main loop until stop is called */
+	void (*run) ( const sim_node_conf_t *conf );
+	void (*stop) ( void );
+
+	/* A byte has arrived from the bus, sent at the given baud rate.  If
+	   that's not the rate the node's at, the node sees a framing error.
+	   May be called from any thread. */
+	void (*bus_rx) ( uint8_t b, unsigned baud );
+
+	/* The token has arrived.  May be called from any thread. */
+	void (*token_in) ( void );
+} sim_node_t;
+
+#endif	/* __SIM_NODE_H */
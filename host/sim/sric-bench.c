@@ -0,0 +1,1104 @@
+/* Bus benchmark: runs a workload against a gateway and reports
+   throughput, token loop time and command latency as JSON.
+
+   By default it starts a gateway emulator (sric-gwsim) to run against,
+   so that the real sric.c, sric-client.c and token drivers are measured.
+   Point it at a real gateway with -D. */
+#define _GNU_SOURCE
+#include "sric-host.h"
+#include "sric-xfer.h"
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Commands that the emulator's boards have */
+#define CMD_ECHO 0
+#define CMD_COUNT 1
+#define CMD_XFER_SUM 2
+/* The emulated boards' 16-bit setpoint register */
+#define REG_SETPOINT 2
+
+#define TIMEOUT_MS 500
+
+/* Size of each transfer in the xfer workload */
+#define XFER_LEN 4096
+
+/* For setup commands */
+#define SYNC_TRIES 3
+#define SYNC_TIMEOUT_MS 100
+
+typedef enum {
+	W_POLL,
+	W_BULK,
+	W_MIXED,
+	W_ENUM,
+	W_XFER,
+	W_GATHER,
+	W_REGS,
+} workload_t;
+
+static const char *const workload_names[] = {
+	[W_POLL] = "poll",
+	[W_BULK] = "bulk",
+	[W_MIXED] = "mixed",
+	[W_ENUM] = "enum",
+	[W_XFER] = "xfer",
+	[W_GATHER] = "gather",
+	[W_REGS] = "regs",
+};
+
+#define NUM_WORKLOADS (sizeof(workload_names) / sizeof(*workload_names))
+
+static struct {
+	workload_t workload;
+	unsigned boards;
+	unsigned rate;
+	unsigned duration_ms;
+	unsigned baud;
+	unsigned tick_us;
+	unsigned window;
+	/* Deadline for each measured command, from when it's issued, or 0
+	   for TIMEOUT_MS from when it's sent */
+	unsigned deadline_ms;
+	/* Whether a board's measured commands replace its unsent ones */
+	bool coalesce;
+	unsigned seed;
+	const char *faults;
+	const char *dev;
+	uint8_t framing;
+	/* Whether to switch the bus to the fastest rate everything supports */
+	bool upgrade;
+	/* Whether to have the boards add sequence bytes to their commands */
+	bool seq;
+	/* Each emulated node's fastest rate, for the emulator's -m */
+	const char *maxes;
+	/* Emulated host link rate, or 0 for no limit */
+	unsigned host_baud;
+	/* What to fill echo data with, or -1 for random bytes */
+	int fill;
+	/* Length of mixed's echo commands, or 0 for random lengths */
+	unsigned echo_len;
+	/* Group for gather to read from, or -1 for everyone */
+	int group;
+	/* Counters that poll reads from each board each round, and whether
+	   it batches them into one command (SRIC_SYSCMD_BATCH) */
+	unsigned reads;
+	bool batch;
+} opt = {
+	.workload = W_POLL,
+	.boards = 4,
+	.rate = 50,
+	.duration_ms = 5000,
+	.baud = 115200,
+	.tick_us = 1000,
+	.window = 1,
+	.seed = 1,
+	.faults = NULL,
+	.dev = NULL,
+	.framing = SRIC_FRAMING_ESCAPE,
+	.fill = -1,
+	.group = -1,
+	.reads = 1,
+};
+
+static sric_host_t *host;
+
+/*** Results ***/
+typedef struct {
+	uint32_t *v;
+	unsigned n, cap;
+} samples_t;
+
+/* Command latencies */
+static samples_t lat;
+/* Time from a command failing to the next one succeeding */
+static samples_t recovery;
+/* Submission time of the first command to fail since the last success,
+   or 0 */
+static uint64_t failing_since = 0;
+
+static uint64_t frames, bytes;
+static unsigned timeouts;
+/* Transfers whose data didn't arrive intact, batches whose replies
+   weren't what was asked for, or filled echoes that didn't come back as
+   sent */
+static unsigned corrupt;
+/* Commands replaced by later ones before they were sent */
+static unsigned replaced;
+
+/* Board addresses, as enumerated (those from SRIC_GROUP_BASE up are
+   groups) */
+static uint8_t addrs[SRIC_GROUP_BASE - 2];
+static unsigned n_addrs;
+
+typedef struct {
+	uint64_t t0;
+	uint8_t cmd_len;
+	/* What regs expects to read back */
+	uint16_t expect;
+} req_t;
+
+static uint64_t now_us( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sample_add( samples_t *s, uint32_t v )
+{
+	if( s->n == s->cap ) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->v = realloc( s->v, s->cap * sizeof(*s->v) );
+	}
+	s->v[s->n++] = v;
+}
+
+/* Whether data is an echo of n fill bytes */
+static bool echoed( const uint8_t *data, uint8_t len, uint8_t n )
+{
+	uint8_t i;
+
+	if( len != n )
+		return false;
+	for( i=0; i<len; i++ )
+		if( data[i] != opt.fill )
+			return false;
+	return true;
+}
+
+static void req_done( void *ud, sric_host_status_t status,
+		      const uint8_t *data, uint8_t len )
+{
+	req_t *r = ud;
+	uint64_t now = now_us();
+
+	if( status == SRIC_HOST_OK ) {
+		sample_add( &lat, now - r->t0 );
+
+		/* Command and response (gather_done counts its own) */
+		if( opt.workload != W_GATHER ) {
+			frames += 2;
+			bytes += r->cmd_len + len;
+		}
+
+		if( opt.workload == W_MIXED && opt.fill >= 0
+		    && !echoed( data, len, r->cmd_len - 1 ) )
+			corrupt++;
+
+		if( failing_since ) {
+			sample_add( &recovery, now - failing_since );
+			failing_since = 0;
+		}
+	} else if( status == SRIC_HOST_REPLACED ) {
+		replaced++;
+	} else {
+		timeouts++;
+		if( !failing_since )
+			failing_since = r->t0;
+	}
+
+	free(r);
+}
+
+/* Issue a measured command */
+static void cmd( uint8_t addr, const uint8_t *data, uint8_t len )
+{
+	req_t *r = malloc( sizeof(*r) );
+	uint8_t flags = opt.coalesce ? SRIC_HOST_F_COALESCE : 0;
+
+	r->t0 = now_us();
+	r->cmd_len = len;
+	if( opt.deadline_ms )
+		sric_host_cmd( host, addr, data, len, flags | SRIC_HOST_F_DEADLINE,
+			       opt.deadline_ms, req_done, r );
+	else
+		sric_host_cmd( host, addr, data, len, flags, TIMEOUT_MS,
+			       req_done, r );
+}
+
+/* Completion of a batch of reads of the counter */
+static void batch_done( void *ud, sric_host_status_t status,
+			const uint8_t *data, uint8_t len )
+{
+	unsigned i;
+
+	/* Each record's a count of 4 bytes */
+	if( status == SRIC_HOST_OK ) {
+		if( len != opt.reads * 5 )
+			corrupt++;
+		else
+			for( i=0; i<len; i+=5 )
+				if( data[i] != 4 ) {
+					corrupt++;
+					break;
+				}
+	}
+
+	req_done( ud, status, data, len );
+}
+
+/* Poll the host until the given time */
+static void run_until( uint64_t end )
+{
+	uint64_t now;
+
+	while( (now = now_us()) < end )
+		if( !sric_host_poll( host, (end - now + 999) / 1000 ) ) {
+			fprintf( stderr, "Connection to the gateway failed\n" );
+			exit(1);
+		}
+}
+
+static void run_for( uint64_t us )
+{
+	run_until( now_us() + us );
+}
+
+/*** Blocking helpers for setup ***/
+static bool sync_ok;
+static uint8_t sync_resp[MAX_PAYLOAD];
+static uint8_t sync_len;
+
+static void sync_done( void *ud, sric_host_status_t status,
+		       const uint8_t *data, uint8_t len )
+{
+	sync_ok = (status == SRIC_HOST_OK);
+	if( sync_ok ) {
+		memcpy( sync_resp, data, len );
+		sync_len = len;
+	}
+}
+
+/* The gateway doesn't retransmit for us, and without the token our
+   commands can collide with the tail of the last response, so try a few
+   times */
+static bool sync_cmd( uint8_t addr, const uint8_t *data, uint8_t len )
+{
+	unsigned i;
+
+	sync_ok = false;
+	for( i=0; i<SYNC_TRIES && !sync_ok; i++ ) {
+		sric_host_cmd( host, addr, data, len, 0, SYNC_TIMEOUT_MS,
+			       sync_done, NULL );
+		sric_host_flush( host );
+	}
+	return sync_ok;
+}
+
+static bool sync_gw_cmd( gw_cmd_t c, const uint8_t *args, uint8_t len )
+{
+	sync_ok = false;
+	sric_host_gw_cmd( host, c, args, len, SYNC_TIMEOUT_MS, sync_done, NULL );
+	sric_host_flush( host );
+	return sync_ok;
+}
+
+static void framing_done( void *ud, sric_host_status_t status,
+			  const uint8_t *data, uint8_t len )
+{
+	sync_done( ud, status, data, len );
+
+	/* Everything from the gateway after the reply is in the new framing */
+	if( sync_ok )
+		sric_host_set_framing( host, data[0] );
+}
+
+/* Switch the host link, then the bus, to the given framing */
+static bool set_framing( uint8_t framing )
+{
+	uint8_t d[2] = { SRIC_SYSCMD_FLAG | SRIC_SYSCMD_FRAMING, framing };
+
+	sync_ok = false;
+	sric_host_gw_cmd( host, GW_CMD_FRAMING, &framing, 1, SYNC_TIMEOUT_MS,
+			  framing_done, NULL );
+	sric_host_flush( host );
+	if( !sync_ok || sync_resp[0] != framing )
+		return false;
+
+	sric_host_send( host, 0, d, 2 );
+	sric_host_flush( host );
+
+	/* Give the boards a moment to switch */
+	run_for( 10000 );
+	return true;
+}
+
+static uint32_t get_u32( const uint8_t *d )
+{
+	return d[0] | d[1] << 8 | d[2] << 16 | (uint32_t)d[3] << 24;
+}
+
+/* The bus's current baud rate, according to the gateway, or 0 if it
+   couldn't be asked */
+static uint32_t bus_baud( void )
+{
+	if( !sync_gw_cmd( GW_CMD_BUS_BAUD, NULL, 0 ) )
+		return 0;
+	return get_u32( sync_resp );
+}
+
+/* Have every board join group n.  Returns false if one didn't. */
+static bool join_group( unsigned n )
+{
+	uint8_t d[3] = { SRIC_SYSCMD_FLAG | SRIC_SYSCMD_GROUP,
+			 (1 << n) & 0xff, (1 << n) >> 8 };
+	unsigned i;
+
+	for( i=0; i<n_addrs; i++ )
+		if( !sync_cmd( addrs[i], d, 3 )
+		    || !((sync_resp[0] | sync_resp[1] << 8) & (1 << n)) )
+			return false;
+	return true;
+}
+
+/* Find the fastest rate that the gateway and all the boards support, and
+   switch the bus to it.  Returns the rate the bus is left at. */
+static uint32_t upgrade_baud( void )
+{
+	uint8_t q = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_BAUD;
+	uint8_t d[5] = { q };
+	uint32_t base, best;
+	unsigned i;
+
+	if( !sync_gw_cmd( GW_CMD_BUS_BAUD, NULL, 0 ) )
+		return 0;
+	base = get_u32( sync_resp );
+	best = get_u32( sync_resp + 4 );
+
+	for( i=0; i<n_addrs && best > base; i++ ) {
+		uint32_t max;
+
+		/* Anything that won't say keeps the bus where it is */
+		if( !sync_cmd( addrs[i], &q, 1 ) )
+			return base;
+
+		max = get_u32( sync_resp );
+		if( max < best )
+			best = max;
+	}
+
+	if( best <= base )
+		return base;
+
+	d[1] = best & 0xff;
+	d[2] = (best >> 8) & 0xff;
+	d[3] = (best >> 16) & 0xff;
+	d[4] = (best >> 24) & 0xff;
+	sric_host_send( host, 0, d, 5 );
+	sric_host_flush( host );
+
+	/* Give the boards a moment to switch */
+	run_for( 10000 );
+	return bus_baud();
+}
+
+/* Have the boards add sequence bytes to their commands, if they all take
+   them.  Returns false if one doesn't. */
+static bool use_seq( void )
+{
+	uint8_t d[2] = { SRIC_SYSCMD_FLAG | SRIC_SYSCMD_SEQ, 1 };
+	unsigned i;
+
+	for( i=0; i<n_addrs; i++ )
+		if( !sync_cmd( addrs[i], d, 1 ) || sync_resp[0] != 1 )
+			return false;
+
+	sric_host_send( host, 0, d, 2 );
+	sric_host_flush( host );
+
+	/* Give the boards a moment to switch */
+	run_for( 10000 );
+	return true;
+}
+
+/* Enumerate the bus, putting everything into token mode.
+   Returns the number of boards found. */
+static unsigned enumerate( void )
+{
+	uint8_t d[2], off = 0, on = 1;
+
+	n_addrs = 0;
+	sync_gw_cmd( GW_CMD_USE_TOKEN, &off, 1 );
+
+	/* The gateway soaks up any tokens that are going round */
+	sync_gw_cmd( GW_CMD_REQ_TOKEN, NULL, 0 );
+
+	/* Everyone drops their address, and asks for the token once it's
+	   had time to reach the gateway */
+	d[0] = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_RESET;
+	sric_host_send( host, 0, d, 1 );
+	sric_host_flush( host );
+	run_for( 50000 );
+
+	/* Pass it on to the first board */
+	sync_gw_cmd( GW_CMD_GEN_TOKEN, NULL, 0 );
+	run_for( 10000 );
+
+	while( n_addrs < sizeof(addrs) ) {
+		uint8_t addr = n_addrs + 2;
+
+		/* Whoever has the token takes the address */
+		d[0] = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_ADDR_ASSIGN;
+		d[1] = addr;
+		if( !sync_cmd( 0, d, 2 ) )
+			break;
+
+		/* And passes the token on */
+		d[0] = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_TOK_ADVANCE;
+		if( !sync_cmd( addr, d, 1 ) )
+			break;
+
+		addrs[n_addrs++] = addr;
+	}
+
+	sync_gw_cmd( GW_CMD_USE_TOKEN, &on, 1 );
+	return n_addrs;
+}
+
+/*** Workloads ***/
+/* Read each board's counter, rate times a second */
+static void workload_poll( void )
+{
+	uint64_t period = 1000000 / opt.rate, next = now_us();
+	uint64_t end = next + opt.duration_ms * 1000ull;
+	uint8_t d[MAX_PAYLOAD] = { SRIC_SYSCMD_FLAG | SRIC_SYSCMD_BATCH };
+	unsigned i, j;
+
+	for( j=0; j<opt.reads; j++ ) {
+		d[1 + j * 2] = 1;
+		d[2 + j * 2] = CMD_COUNT;
+	}
+
+	while( next < end ) {
+		for( i=0; i<n_addrs; i++ ) {
+			if( opt.batch ) {
+				req_t *r = malloc( sizeof(*r) );
+
+				r->t0 = now_us();
+				r->cmd_len = 1 + opt.reads * 2;
+				sric_host_cmd( host, addrs[i], d, r->cmd_len, 0,
+					       TIMEOUT_MS, batch_done, r );
+			} else
+				for( j=0; j<opt.reads; j++ )
+					cmd( addrs[i], d + 2, 1 );
+		}
+
+		next += period;
+		run_until( next );
+	}
+}
+
+/* Read version buffers as fast as they'll come */
+static void workload_bulk( void )
+{
+	uint64_t end = now_us() + opt.duration_ms * 1000ull;
+	uint16_t off = 0;
+	unsigned i = 0;
+
+	while( now_us() < end ) {
+		uint8_t d[3] = { SRIC_SYSCMD_FLAG | SRIC_SYSCMD_VERSION_BUF,
+				 off & 0xff, off >> 8 };
+
+		/* Keep the gateway's queue full, and no more */
+		if( sric_host_pending( host ) < opt.window ) {
+			cmd( addrs[i], d, 3 );
+			i = (i + 1) % n_addrs;
+			if( i == 0 )
+				off = (off + MAX_PAYLOAD) % 256;
+		} else
+			sric_host_poll( host, 10 );
+	}
+}
+
+/* A broadcast plus an echo of random length to each board, rate times a
+   second */
+static void workload_mixed( void )
+{
+	uint64_t period = 1000000 / opt.rate, next = now_us();
+	uint64_t end = next + opt.duration_ms * 1000ull;
+	uint8_t d[MAX_PAYLOAD];
+	unsigned i, j;
+
+	srandom( opt.seed );
+	while( next < end ) {
+		/* Nobody answers echo commands to address 0 */
+		d[0] = CMD_ECHO;
+		sric_host_send( host, 0, d, 1 );
+		frames++;
+
+		for( i=0; i<n_addrs; i++ ) {
+			uint8_t len = opt.echo_len ? opt.echo_len
+				: 1 + random() % 32;
+
+			for( j=1; j<len; j++ )
+				d[j] = opt.fill < 0 ? random() : opt.fill;
+			cmd( addrs[i], d, len );
+		}
+
+		next += period;
+		run_until( next );
+	}
+}
+
+/* Enumerate the bus repeatedly */
+static void workload_enum( void )
+{
+	uint64_t end = now_us() + opt.duration_ms * 1000ull;
+
+	while( now_us() < end ) {
+		uint64_t t0 = now_us();
+		unsigned n = enumerate();
+
+		sample_add( &lat, now_us() - t0 );
+		/* Four frames per board, plus the final assignment */
+		frames += n * 4 + 1;
+		if( n != opt.boards )
+			timeouts++;
+	}
+}
+
+static bool xfer_busy, xfer_ok;
+
+static void xfer_done( void *ud, bool ok, size_t acked )
+{
+	xfer_busy = false;
+	xfer_ok = ok;
+	bytes += acked;
+}
+
+/* Send transfers to the first board, one after another, with -w frames in
+   flight, checking that each arrived intact */
+static void workload_xfer( void )
+{
+	uint64_t end = now_us() + opt.duration_ms * 1000ull;
+	static uint8_t data[XFER_LEN];
+	uint8_t c = CMD_XFER_SUM;
+	unsigned i;
+
+	srandom( opt.seed );
+	while( now_us() < end ) {
+		uint64_t t0 = now_us();
+		uint32_t sum = 0;
+
+		for( i=0; i<XFER_LEN; i++ ) {
+			data[i] = opt.fill < 0 ? random() : opt.fill;
+			sum += data[i] * (i + 1);
+		}
+
+		xfer_busy = true;
+		if( !sric_xfer( host, addrs[0], data, XFER_LEN, opt.window,
+				TIMEOUT_MS, xfer_done, NULL ) ) {
+			fprintf( stderr, "Bad transfer window\n" );
+			exit(1);
+		}
+		while( xfer_busy )
+			sric_host_poll( host, 10 );
+
+		if( !xfer_ok ) {
+			timeouts++;
+			continue;
+		}
+		sample_add( &lat, now_us() - t0 );
+		/* Each data frame, and the start and its reply */
+		frames += (XFER_LEN + SRIC_XFER_PAYLOAD - 1) / SRIC_XFER_PAYLOAD + 2;
+
+		/* See what the board made of it */
+		if( !sync_cmd( addrs[0], &c, 1 )
+		    || get_u32( sync_resp ) != XFER_LEN
+		    || get_u32( sync_resp + 4 ) != sum )
+			corrupt++;
+	}
+}
+
+static void gather_done( void *ud, sric_host_status_t status,
+			 const sric_host_answer_t *answers, unsigned n )
+{
+	req_t *r = ud;
+	unsigned i;
+
+	/* The broadcast, and an answer from each board */
+	frames += 1 + n;
+	bytes += r->cmd_len;
+	for( i=0; i<n; i++ )
+		bytes += answers[i].len;
+
+	req_done( r, status, NULL, 0 );
+}
+
+/* Read every board's counter with one collective read, rate times a
+   second */
+static void workload_gather( void )
+{
+	uint64_t period = 1000000 / opt.rate, next = now_us();
+	uint64_t end = next + opt.duration_ms * 1000ull;
+	uint8_t c = CMD_COUNT;
+	uint8_t dest = opt.group < 0 ? 0 : SRIC_GROUP(opt.group);
+
+	while( next < end ) {
+		req_t *r = malloc( sizeof(*r) );
+
+		r->t0 = now_us();
+		r->cmd_len = 2;
+		sric_host_gather( host, dest, &c, 1, n_addrs, TIMEOUT_MS,
+				  gather_done, r );
+
+		next += period;
+		run_until( next );
+	}
+}
+
+/* Sizes of the boards' registers, as SRIC_SYSCMD_REG_INFO has them */
+static uint8_t reg_info[MAX_PAYLOAD];
+static unsigned n_regs;
+
+static void regs_done( void *ud, sric_host_status_t status,
+		       const uint8_t *data, uint8_t len )
+{
+	req_t *r = ud;
+	unsigned i, off = 0;
+
+	if( status == SRIC_HOST_OK ) {
+		for( i=0; i<REG_SETPOINT; i++ )
+			off += reg_info[i] & ~SRIC_REG_WRITABLE;
+
+		/* The snapshot should have the setpoint just written */
+		if( len < off + 2 || (data[off] | data[off + 1] << 8) != r->expect )
+			corrupt++;
+	}
+
+	req_done( ud, status, data, len );
+}
+
+/* Write each board's setpoint register, and read back all its registers
+   in one go, rate times a second */
+static void workload_regs( void )
+{
+	uint64_t period = 1000000 / opt.rate, next = now_us();
+	uint64_t end = next + opt.duration_ms * 1000ull;
+	uint8_t d[4] = { SRIC_SYSCMD_FLAG | SRIC_SYSCMD_REG_INFO, 0, MAX_PAYLOAD };
+	uint16_t v = 0;
+	unsigned i;
+
+	if( !sync_cmd( addrs[0], d, 3 ) || sync_len <= REG_SETPOINT ) {
+		fprintf( stderr, "Failed to read the register map\n" );
+		return;
+	}
+	memcpy( reg_info, sync_resp, sync_len );
+	n_regs = sync_len;
+
+	while( next < end ) {
+		v++;
+		for( i=0; i<n_addrs; i++ ) {
+			req_t *r = malloc( sizeof(*r) );
+
+			d[0] = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_REG_WRITE;
+			d[1] = REG_SETPOINT;
+			d[2] = v & 0xff;
+			d[3] = v >> 8;
+			cmd( addrs[i], d, 4 );
+
+			d[0] = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_REG_READ;
+			d[1] = 0;
+			d[2] = n_regs;
+			r->t0 = now_us();
+			r->cmd_len = 3;
+			r->expect = v;
+			sric_host_cmd( host, addrs[i], d, 3, 0, TIMEOUT_MS,
+				       regs_done, r );
+		}
+
+		next += period;
+		run_until( next );
+	}
+}
+
+/*** Reporting ***/
+static int cmp_u32( const void *a, const void *b )
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Takes sorted samples */
+static uint32_t percentile( const samples_t *s, double p )
+{
+	unsigned i;
+
+	if( s->n == 0 )
+		return 0;
+
+	i = p * s->n;
+	if( i >= s->n )
+		i = s->n - 1;
+	return s->v[i];
+}
+
+static void print_samples( const char *name, samples_t *s, bool last )
+{
+	qsort( s->v, s->n, sizeof(*s->v), cmp_u32 );
+
+	printf( "  \"%s\": { \"n\": %u, \"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u }%s\n",
+		name, s->n, percentile( s, 0.5 ), percentile( s, 0.99 ),
+		percentile( s, 0.999 ), percentile( s, 1 ), last ? "" : "," );
+}
+
+/* Read a board's token statistics: average loop time in ticks */
+static bool tok_loop( uint8_t addr, uint16_t *min, uint16_t *avg, uint16_t *max )
+{
+	uint8_t d = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_TOK_STATS;
+
+	if( !sync_cmd( addr, &d, 1 ) )
+		return false;
+
+	/* See token_stats_pack */
+	*min = sync_resp[4] | (sync_resp[5] << 8);
+	*avg = sync_resp[6] | (sync_resp[7] << 8);
+	*max = sync_resp[8] | (sync_resp[9] << 8);
+	return true;
+}
+
+/* Read and print the gateway's bus utilisation statistics (see
+   bus_stats_pack).  Times are in the gateway's ticks, taken to be
+   -k's, and the bus is taken to have been at the given rate
+   throughout. */
+static void print_bus_stats( uint32_t baud )
+{
+	uint8_t arg = 0, *d = sync_resp, i, n;
+	double window, busy;
+	uint32_t bytes;
+
+	if( !sync_gw_cmd( GW_CMD_BUS_STATS, &arg, 1 ) )
+		return;
+
+	window = (d[0] | d[1] << 8) * (opt.tick_us / 1e6);
+	bytes = d[2] | d[3] << 8 | d[4] << 16 | (uint32_t)d[5] << 24;
+	/* Ten bits per byte */
+	busy = bytes * 10.0 / baud;
+	if( window <= 0 )
+		return;
+
+	printf( "  \"bus\": { \"window_s\": %.3f, \"busy\": %.4f, \"token_wait\": %.4f, "
+		"\"frames\": %u, \"bad_frames\": %u,\n",
+		window, busy / window,
+		(d[10] | d[11] << 8) * (opt.tick_us / 1e6) / window,
+		d[6] | d[7] << 8, d[8] | d[9] << 8 );
+	printf( "           \"frames_per_s\": {" );
+	n = d[14];
+	for( i=0; i<n; i++ ) {
+		const uint8_t *src = d + 15 + i * 3;
+
+		printf( " \"%u\": %.1f,", src[0], (src[1] | src[2] << 8) / window );
+	}
+	printf( " \"other\": %.1f } },\n", (d[12] | d[13] << 8) / window );
+}
+
+static char *sim_finish( void );
+
+static void report( uint64_t elapsed_us )
+{
+	double secs = elapsed_us / 1e6;
+	uint16_t min, avg, max;
+	/* Where the bus ended up, which shows if it fell back */
+	uint32_t baud = bus_baud();
+
+	if( baud == 0 )
+		baud = opt.baud;
+
+	printf( "{\n" );
+	printf( "  \"workload\": \"%s\",\n", workload_names[opt.workload] );
+	printf( "  \"boards\": %u,\n", n_addrs );
+	printf( "  \"rate_hz\": %u,\n", opt.rate );
+	printf( "  \"window\": %u,\n", opt.window );
+	if( opt.deadline_ms )
+		printf( "  \"deadline_ms\": %u,\n", opt.deadline_ms );
+	if( opt.group >= 0 )
+		printf( "  \"group\": %d,\n", opt.group );
+	if( opt.workload == W_POLL ) {
+		printf( "  \"reads\": %u,\n", opt.reads );
+		printf( "  \"batch\": %s,\n", opt.batch ? "true" : "false" );
+	}
+	printf( "  \"seed\": %u,\n", opt.seed );
+	printf( "  \"framing\": \"%s\",\n",
+		opt.framing == SRIC_FRAMING_COBS ? "cobs" : "escape" );
+	printf( "  \"baud\": %u,\n", baud );
+	if( opt.seq )
+		printf( "  \"seq\": true,\n" );
+	printf( "  \"duration_s\": %.3f,\n", secs );
+	printf( "  \"completed\": %u,\n", lat.n );
+	printf( "  \"timeouts\": %u,\n", timeouts );
+	if( opt.workload == W_XFER || opt.workload == W_REGS || opt.batch
+	    || (opt.workload == W_MIXED && opt.fill >= 0) )
+		printf( "  \"corrupt\": %u,\n", corrupt );
+	if( opt.coalesce )
+		printf( "  \"replaced\": %u,\n", replaced );
+	printf( "  \"frames_per_s\": %.1f,\n", frames / secs );
+	printf( "  \"goodput_bytes_per_s\": %.1f,\n", bytes / secs );
+	print_samples( "latency_us", &lat, false );
+	if( opt.workload != W_ENUM )
+		print_samples( "recovery_us", &recovery, false );
+	print_bus_stats( baud );
+
+	if( n_addrs && tok_loop( addrs[0], &min, &avg, &max ) ) {
+		printf( "  \"token_loop_ticks\": { \"min\": %u, \"avg\": %u, \"max\": %u },\n",
+			min, avg, max );
+		if( opt.dev == NULL )
+			printf( "  \"tick_us\": %u,\n", opt.tick_us );
+	}
+
+	if( opt.faults != NULL ) {
+		char *f = sim_finish();
+
+		printf( "  \"fault_spec\": \"%s\",\n", opt.faults );
+		printf( "  \"faults\": %s,\n", f != NULL ? f : "null" );
+	}
+
+	printf( "  \"dev\": \"%s\"\n", opt.dev ? opt.dev : "sric-gwsim" );
+	printf( "}\n" );
+}
+
+/*** Emulator ***/
+static pid_t sim_pid = 0;
+/* Its stdout */
+static FILE *sim_out;
+
+static void sim_stop( void )
+{
+	if( sim_pid > 0 ) {
+		kill( sim_pid, SIGTERM );
+		waitpid( sim_pid, NULL, 0 );
+		sim_pid = 0;
+	}
+}
+
+/* Stop the emulator, returning the fault counts it prints on exit */
+static char *sim_finish( void )
+{
+	static char line[1024];
+	char *r;
+
+	if( sim_pid <= 0 )
+		return NULL;
+
+	kill( sim_pid, SIGTERM );
+	r = fgets( line, sizeof(line), sim_out );
+	sim_stop();
+
+	if( r == NULL )
+		return NULL;
+	line[strcspn( line, "\n" )] = '\0';
+	return line;
+}
+
+/* Start the emulator next to us, returning the path of its pty */
+static char *sim_start( void )
+{
+	char dir[PATH_MAX], prog[PATH_MAX + 16];
+	char n[16], b[16], t[16], s[16], hb[16];
+	static char pty[PATH_MAX];
+	int fds[2];
+	ssize_t r;
+
+	r = readlink( "/proc/self/exe", dir, sizeof(dir) - 1 );
+	if( r < 0 || pipe( fds ) != 0 )
+		return NULL;
+	dir[r] = '\0';
+	snprintf( prog, sizeof(prog), "%s/sric-gwsim", dirname( dir ) );
+
+	snprintf( n, sizeof(n), "%u", opt.boards );
+	snprintf( b, sizeof(b), "%u", opt.baud );
+	snprintf( t, sizeof(t), "%u", opt.tick_us );
+	snprintf( s, sizeof(s), "%u", opt.seed );
+	snprintf( hb, sizeof(hb), "%u", opt.host_baud );
+
+	sim_pid = fork();
+	if( sim_pid == 0 ) {
+		char *args[16] = { prog, "-n", n, "-b", b, "-t", t, "-s", s,
+				    "-H", hb };
+		unsigned i = 11;
+
+		dup2( fds[1], 1 );
+		close( fds[0] );
+		if( opt.faults != NULL ) {
+			args[i++] = "-e";
+			args[i++] = (char*)opt.faults;
+		}
+		if( opt.maxes != NULL ) {
+			args[i++] = "-m";
+			args[i++] = (char*)opt.maxes;
+		}
+		execv( prog, args );
+		perror( prog );
+		_exit(1);
+	}
+	close( fds[1] );
+	atexit( sim_stop );
+
+	/* It prints the pty's name once it's running */
+	sim_out = fdopen( fds[0], "r" );
+	if( sim_out == NULL || fgets( pty, sizeof(pty), sim_out ) == NULL )
+		return NULL;
+	pty[strcspn( pty, "\n" )] = '\0';
+	return pty;
+}
+
+static void usage( const char *argv0 )
+{
+	fprintf( stderr,
+		 "Usage: %s [options] [poll|bulk|mixed|enum|xfer|gather|regs]\n"
+		 "  -n BOARDS   Number of client boards to emulate (default 4)\n"
+		 "  -r RATE     Rounds per second for poll, mixed, gather and regs\n"
+		 "              (default 50)\n"
+		 "  -t MS       How long to run for (default 5000)\n"
+		 "  -w N        Requests to have outstanding at once, or for xfer,\n"
+		 "              frames in flight (default 1)\n"
+		 "  -d MS       Give each command a deadline MS after it's issued,\n"
+		 "              rather than a timeout once it's sent\n"
+		 "  -C          Have each command replace any unsent one to the same\n"
+		 "              board (SRIC_HOST_F_COALESCE)\n"
+		 "  -s SEED     Random seed for mixed and faults (default 1)\n"
+		 "  -b BAUD     Emulated bus baud rate (default 115200)\n"
+		 "  -k TICK_US  Emulated scheduler tick (default 1000)\n"
+		 "  -e FAULTS   Have the emulator inject faults (see sim-fault.h)\n"
+		 "  -c          Switch the link and bus to COBS framing after enumerating\n"
+		 "  -u          Switch the bus to the fastest baud rate that everything\n"
+		 "              on it supports after enumerating\n"
+		 "  -S          Have the boards add sequence bytes to their commands\n"
+		 "              after enumerating\n"
+		 "  -m MAX,...  Emulated nodes' fastest baud rates (see sric-gwsim)\n"
+		 "  -H BAUD     Emulated host link baud rate (default: no limit)\n"
+		 "  -f BYTE     Fill mixed's echo data and xfer's data with BYTE, rather\n"
+		 "              than random bytes\n"
+		 "  -l LEN      Make mixed's echo commands LEN bytes long, command\n"
+		 "              byte included, rather than 1 to 32 (at most %u)\n"
+		 "  -p N        Counters for poll to read from each board each round\n"
+		 "              (default 1)\n"
+		 "  -B          Batch poll's reads of each board into one command\n"
+		 "  -g N        Have every board join group N, and gather read from\n"
+		 "              the group rather than from everyone\n"
+		 "  -D DEV      Use the gateway on DEV instead of an emulator\n",
+		 argv0, MAX_PAYLOAD );
+}
+
+int main( int argc, char **argv )
+{
+	const char *dev;
+	uint64_t t0;
+	uint8_t one = 1;
+	int o;
+
+	while( (o = getopt( argc, argv, "n:r:t:w:d:Cs:b:k:e:cuSm:H:f:l:g:p:BD:h" )) != -1 ) {
+		switch( o ) {
+		case 'n': opt.boards = atoi( optarg ); break;
+		case 'r': opt.rate = atoi( optarg ); break;
+		case 't': opt.duration_ms = atoi( optarg ); break;
+		case 'w': opt.window = atoi( optarg ); break;
+		case 'd': opt.deadline_ms = atoi( optarg ); break;
+		case 'C': opt.coalesce = true; break;
+		case 's': opt.seed = atoi( optarg ); break;
+		case 'b': opt.baud = atoi( optarg ); break;
+		case 'k': opt.tick_us = atoi( optarg ); break;
+		case 'e': opt.faults = optarg; break;
+		case 'c': opt.framing = SRIC_FRAMING_COBS; break;
+		case 'u': opt.upgrade = true; break;
+		case 'S': opt.seq = true; break;
+		case 'm': opt.maxes = optarg; break;
+		case 'H': opt.host_baud = atoi( optarg ); break;
+		case 'f': opt.fill = strtol( optarg, NULL, 0 ) & 0xff; break;
+		case 'l': opt.echo_len = atoi( optarg ); break;
+		case 'g': opt.group = atoi( optarg ); break;
+		case 'p': opt.reads = atoi( optarg ); break;
+		case 'B': opt.batch = true; break;
+		case 'D': opt.dev = optarg; break;
+		default:
+			usage( argv[0] );
+			return o == 'h' ? 0 : 1;
+		}
+	}
+
+	if( optind < argc ) {
+		for( o=0; o<NUM_WORKLOADS; o++ )
+			if( strcmp( argv[optind], workload_names[o] ) == 0 )
+				break;
+		if( o == NUM_WORKLOADS ) {
+			usage( argv[0] );
+			return 1;
+		}
+		opt.workload = o;
+	}
+
+	if( opt.rate == 0 || opt.window == 0 || opt.boards == 0
+	    || opt.group >= SRIC_GROUP_NUM
+	    || opt.reads == 0 || 1 + opt.reads * 2 > MAX_PAYLOAD
+	    || opt.echo_len > MAX_PAYLOAD
+	    || ((opt.faults != NULL || opt.maxes != NULL || opt.host_baud)
+		&& opt.dev != NULL) ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	dev = opt.dev;
+	if( dev == NULL && (dev = sim_start()) == NULL ) {
+		fprintf( stderr, "Failed to start the emulator\n" );
+		return 1;
+	}
+
+	host = sric_host_open( dev, 115200 );
+	if( host == NULL ) {
+		perror( dev );
+		return 1;
+	}
+	sric_host_set_window( host, opt.window );
+
+	if( opt.workload != W_ENUM && enumerate() == 0 ) {
+		fprintf( stderr, "No boards found\n" );
+		return 1;
+	}
+
+	if( opt.framing != SRIC_FRAMING_ESCAPE && !set_framing( opt.framing ) ) {
+		fprintf( stderr, "Failed to switch framing\n" );
+		return 1;
+	}
+
+	if( opt.upgrade && opt.workload != W_ENUM )
+		upgrade_baud();
+
+	if( opt.seq && opt.workload != W_ENUM && !use_seq() ) {
+		fprintf( stderr, "Failed to switch on sequence bytes\n" );
+		return 1;
+	}
+
+	if( opt.group >= 0 && opt.workload != W_ENUM
+	    && !join_group( opt.group ) ) {
+		fprintf( stderr, "Failed to join group %d\n", opt.group );
+		return 1;
+	}
+
+	/* Start a new utilisation window */
+	sync_gw_cmd( GW_CMD_BUS_STATS, &one, 1 );
+
+	t0 = now_us();
+	switch( opt.workload ) {
+	case W_POLL: workload_poll(); break;
+	case W_BULK: workload_bulk(); break;
+	case W_MIXED: workload_mixed(); break;
+	case W_ENUM: workload_enum(); break;
+	case W_XFER: workload_xfer(); break;
+	case W_GATHER: workload_gather(); break;
+	case W_REGS: workload_regs(); break;
+	}
+	sric_host_flush( host );
+
+	report( now_us() - t0 );
+	sric_host_close( host );
+	return 0;
+}
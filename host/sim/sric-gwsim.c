@@ -0,0 +1,302 @@
+/* Gateway emulator: runs the gateway firmware and a number of client
+   boards on a simulated bus, with the gateway's host link on a pty.
+
+   Host software is pointed at the pty in place of a real gateway. */
+#define _GNU_SOURCE
+#include "sim-fault.h"
+#include "sim-node.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+typedef struct {
+	unsigned idx;
+	const sim_node_t *node;
+	sim_harness_t harness;
+	sim_node_conf_t conf;
+	pthread_t thread;
+} node_t;
+
+/* The gateway's nodes[0]; the clients follow it round the token ring */
+static node_t *nodes;
+static unsigned n_nodes;
+
+/* Held while a byte or token's delivered, so that everyone hears bytes
+   from different nodes in the same order.  Also protects the fault
+   injector. */
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile sig_atomic_t quit = 0;
+
+static void bus_tx( void *ctx, uint8_t b, unsigned baud )
+{
+	const node_t *src = ctx;
+	unsigned i;
+
+	pthread_mutex_lock( &bus_lock );
+	if( sim_fault_bus( src->idx, baud, &b ) ) {
+		/* Everyone else hears it */
+		for( i=0; i<n_nodes; i++ )
+			if( i != src->idx && !sim_fault_silent( i ) )
+				nodes[i].node->bus_rx( b, baud );
+	}
+	pthread_mutex_unlock( &bus_lock );
+}
+
+static void token_out( void *ctx )
+{
+	const node_t *src = ctx;
+	unsigned next = (src->idx + 1) % n_nodes, n;
+
+	pthread_mutex_lock( &bus_lock );
+	for( n = sim_fault_token( src->idx, next ); n; n-- )
+		nodes[next].node->token_in();
+	pthread_mutex_unlock( &bus_lock );
+}
+
+/* Load a private copy of the given shared object, so that it gets its own
+   copy of its globals */
+static void *load_copy( const char *path )
+{
+	char tmp[] = "/tmp/sric-gwsim-XXXXXX";
+	char buf[4096];
+	void *dl = NULL;
+	int in, out;
+	ssize_t r;
+
+	in = open( path, O_RDONLY );
+	if( in < 0 ) {
+		perror( path );
+		return NULL;
+	}
+
+	out = mkstemp( tmp );
+	if( out < 0 ) {
+		perror( "mkstemp" );
+		close( in );
+		return NULL;
+	}
+
+	while( (r = read( in, buf, sizeof(buf) )) > 0 )
+		if( write( out, buf, r ) != r ) {
+			r = -1;
+			break;
+		}
+	close( in );
+	close( out );
+
+	if( r == 0 ) {
+		dl = dlopen( tmp, RTLD_NOW | RTLD_LOCAL );
+		if( dl == NULL )
+			fprintf( stderr, "%s\n", dlerror() );
+	}
+
+	unlink( tmp );
+	return dl;
+}
+
+static bool node_load( node_t *n, const char *path )
+{
+	void *dl = load_copy( path );
+
+	if( dl == NULL )
+		return false;
+
+	n->node = dlsym( dl, "sim_node" );
+	if( n->node == NULL ) {
+		fprintf( stderr, "%s: no sim_node\n", path );
+		return false;
+	}
+
+	n->harness.ctx = n;
+	n->harness.bus_tx = bus_tx;
+	n->harness.token_out = token_out;
+	n->conf.harness = &n->harness;
+	n->conf.host_fd = -1;
+	return true;
+}
+
+static void *node_thread( void *ud )
+{
+	node_t *n = ud;
+
+	n->node->run( &n->conf );
+	return NULL;
+}
+
+/* Create the pty for the host link.
+   Returns the master, and puts the slave's name in name. */
+static int pty_open( char *name, size_t len, int *slave )
+{
+	struct termios t;
+	int m = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK );
+
+	if( m < 0 || grantpt( m ) != 0 || unlockpt( m ) != 0
+	    || ptsname_r( m, name, len ) != 0 )
+		return -1;
+
+	/* Keep the slave open, so that the master doesn't see a hangup
+	   whenever the host closes it.  Make it raw so that nothing gets
+	   echoed before the host opens it. */
+	*slave = open( name, O_RDWR | O_NOCTTY );
+	if( *slave < 0 )
+		return -1;
+
+	tcgetattr( *slave, &t );
+	cfmakeraw( &t );
+	tcsetattr( *slave, TCSANOW, &t );
+
+	return m;
+}
+
+static void on_signal( int sig )
+{
+	quit = 1;
+}
+
+static void usage( const char *argv0 )
+{
+	fprintf( stderr,
+		 "Usage: %s [-n CLIENTS] [-b BAUD] [-m MAX,...] [-H BAUD] [-t TICK_US]\n"
+		 "          [-l LINK] [-a] [-e FAULTS] [-s SEED]\n"
+		 "  -n CLIENTS  Number of client boards on the bus (default 4)\n"
+		 "  -b BAUD     Bus baud rate, 0 for no limit (default 115200)\n"
+		 "  -m MAX,...  Fastest baud rate each node can switch to: the\n"
+		 "              gateway's, then each client's.  The last one given\n"
+		 "              goes for the rest.  (default: no faster than -b)\n"
+		 "  -H BAUD     Host link baud rate, 0 for no limit (default 0)\n"
+		 "  -t TICK_US  Scheduler tick in microseconds (default 1000)\n"
+		 "  -l LINK     Make a symlink to the host pty\n"
+		 "  -a          Give the gateway address 2 and the clients 3\n"
+		 "              onwards, rather than waiting for enumeration\n"
+		 "  -e FAULTS   Inject faults (see sim-fault.h), e.g.\n"
+		 "              flip=1e-4,toklose=0.01,silent=2:5000:1000\n"
+		 "              Counts of what was injected are printed on exit\n"
+		 "  -s SEED     Seed for fault injection (default 1)\n",
+		 argv0 );
+}
+
+int main( int argc, char **argv )
+{
+	unsigned clients = 4, baud = 115200, host_baud = 0, tick_us = 1000;
+	const char *link = NULL, *maxes = NULL;
+	bool assign = false;
+	char dir[PATH_MAX], path[PATH_MAX + 32], pty[64];
+	int opt, host_fd, slave;
+	ssize_t r;
+	unsigned i;
+
+	while( (opt = getopt( argc, argv, "n:b:m:H:t:l:ae:s:h" )) != -1 ) {
+		switch( opt ) {
+		case 'n': clients = atoi( optarg ); break;
+		case 'b': baud = atoi( optarg ); break;
+		case 'm': maxes = optarg; break;
+		case 'H': host_baud = atoi( optarg ); break;
+		case 't': tick_us = atoi( optarg ); break;
+		case 'l': link = optarg; break;
+		case 'a': assign = true; break;
+		case 'e':
+			if( !sim_fault_parse( optarg ) ) {
+				fprintf( stderr, "Bad fault list: %s\n", optarg );
+				return 1;
+			}
+			break;
+		case 's': sim_fault_seed( atoi( optarg ) ); break;
+		default:
+			usage( argv[0] );
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if( clients > 125 || tick_us == 0 ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	/* The node objects live next to us */
+	r = readlink( "/proc/self/exe", dir, sizeof(dir) - 1 );
+	if( r < 0 ) {
+		perror( "readlink" );
+		return 1;
+	}
+	dir[r] = '\0';
+	dirname( dir );
+
+	host_fd = pty_open( pty, sizeof(pty), &slave );
+	if( host_fd < 0 ) {
+		perror( "pty" );
+		return 1;
+	}
+
+	n_nodes = clients + 1;
+	nodes = calloc( n_nodes, sizeof(*nodes) );
+
+	for( i=0; i<n_nodes; i++ ) {
+		node_t *n = nodes + i;
+
+		snprintf( path, sizeof(path), "%s/%s", dir,
+			  i == 0 ? "sim-gw.so" : "sim-client.so" );
+		if( !node_load( n, path ) )
+			return 1;
+
+		n->idx = i;
+		n->conf.baud = baud;
+		n->conf.baud_max = baud;
+		if( maxes != NULL ) {
+			char *end;
+
+			n->conf.baud_max = strtoul( maxes, &end, 10 );
+			/* Move on to the next, unless this is the last */
+			if( *end == ',' )
+				maxes = end + 1;
+		}
+		n->conf.tick_us = tick_us;
+		if( assign )
+			n->conf.addr = i + 2;
+	}
+	nodes[0].conf.host_fd = host_fd;
+	nodes[0].conf.host_baud = host_baud;
+
+	if( link != NULL ) {
+		unlink( link );
+		if( symlink( pty, link ) != 0 ) {
+			perror( link );
+			return 1;
+		}
+	}
+
+	signal( SIGINT, on_signal );
+	signal( SIGTERM, on_signal );
+
+	for( i=0; i<n_nodes; i++ )
+		pthread_create( &nodes[i].thread, NULL, node_thread, nodes + i );
+
+	printf( "%s\n", link != NULL ? link : pty );
+	fflush( stdout );
+
+	while( !quit )
+		pause();
+
+	for( i=0; i<n_nodes; i++ )
+		nodes[i].node->stop();
+	for( i=0; i<n_nodes; i++ )
+		pthread_join( nodes[i].thread, NULL );
+
+	if( sim_fault_enabled() )
+		sim_fault_report( stdout );
+
+	if( link != NULL )
+		unlink( link );
+	close( slave );
+	close( host_fd );
+	return 0;
+}
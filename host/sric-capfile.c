@@ -0,0 +1,85 @@
+#include "sric-capfile.h"
+#include "crc16.h"
+#include <string.h>
+
+static void put16( uint8_t *b, uint16_t v )
+{
+	b[0] = v & 0xff;
+	b[1] = v >> 8;
+}
+
+static uint16_t get16( const uint8_t *b )
+{
+	return b[0] | (b[1] << 8);
+}
+
+static void put32( uint8_t *b, uint32_t v )
+{
+	put16( b, v & 0xffff );
+	put16( b + 2, v >> 16 );
+}
+
+static uint32_t get32( const uint8_t *b )
+{
+	return get16( b ) | ((uint32_t)get16( b + 2 ) << 16);
+}
+
+void sric_capfile_header( uint8_t *buf, uint32_t time_hz )
+{
+	memset( buf, 0, SRIC_CAPFILE_HEADER );
+	memcpy( buf + SRIC_CAPFILE_MAGIC_OFF, SRIC_CAPFILE_MAGIC,
+		sizeof(SRIC_CAPFILE_MAGIC) );
+	put16( buf + SRIC_CAPFILE_VERSION_OFF, SRIC_CAPFILE_VERSION );
+	put32( buf + SRIC_CAPFILE_HZ_OFF, time_hz );
+}
+
+bool sric_capfile_check( const uint8_t *buf, size_t len, uint32_t *time_hz )
+{
+	if( len < SRIC_CAPFILE_HEADER
+	    || memcmp( buf + SRIC_CAPFILE_MAGIC_OFF, SRIC_CAPFILE_MAGIC,
+		       sizeof(SRIC_CAPFILE_MAGIC) ) != 0
+	    || get16( buf + SRIC_CAPFILE_VERSION_OFF ) != SRIC_CAPFILE_VERSION )
+		return false;
+
+	*time_hz = get32( buf + SRIC_CAPFILE_HZ_OFF );
+	return true;
+}
+
+size_t sric_caprec_build( uint8_t *buf, const sric_caprec_t *rec )
+{
+	size_t flen = SRIC_HEADER_SIZE + rec->data_len;
+	size_t len = SRIC_CAPREC_OVERHEAD + flen;
+
+	put16( buf + SRIC_CAPREC_LEN, len );
+	buf[SRIC_CAPREC_LINK] = rec->link;
+	buf[SRIC_CAPREC_FLAGS] = rec->flags;
+	put32( buf + SRIC_CAPREC_TIME, rec->time & 0xffffffff );
+	put32( buf + SRIC_CAPREC_TIME + 4, rec->time >> 32 );
+	memcpy( buf + SRIC_CAPREC_FRAME, rec->frame, flen );
+	put16( buf + len - 2, crc16( buf, len - 2 ) );
+
+	return len;
+}
+
+size_t sric_caprec_parse( const uint8_t *buf, size_t avail, sric_caprec_t *rec )
+{
+	size_t len;
+
+	if( avail < SRIC_CAPREC_OVERHEAD + SRIC_HEADER_SIZE )
+		return 0;
+
+	len = get16( buf + SRIC_CAPREC_LEN );
+	if( len < SRIC_CAPREC_OVERHEAD + SRIC_HEADER_SIZE
+	    || len > SRIC_CAPREC_MAX || len > avail
+	    || crc16( buf, len - 2 ) != get16( buf + len - 2 ) )
+		return 0;
+
+	rec->link = buf[SRIC_CAPREC_LINK];
+	rec->flags = buf[SRIC_CAPREC_FLAGS];
+	rec->time = get32( buf + SRIC_CAPREC_TIME )
+		| (uint64_t)get32( buf + SRIC_CAPREC_TIME + 4 ) << 32;
+	rec->frame = buf + SRIC_CAPREC_FRAME;
+	rec->data_len = len - SRIC_CAPREC_OVERHEAD - SRIC_HEADER_SIZE;
+
+	return len;
+}
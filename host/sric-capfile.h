@@ -0,0 +1,78 @@
+#ifndef __SRIC_CAPFILE_H
+#define __SRIC_CAPFILE_H
+/* Capture files: bus traffic recorded by gateways in capture mode (see
+   GW_CMD_CAPTURE), for analysis offline.
+
+   A file is a header followed by records, appended as frames arrive.
+   Records from several gateways ("links") may be interleaved.  Everything
+   is little-endian, and nothing's aligned.
+
+   Header:
+     [magic x 8] [version x 2] [reserved x 2] [time_hz x 4]
+   time_hz is the rate that record timestamps count at.
+
+   Record:
+     [len x 2] [link] [flags] [time x 8] [frame] [crc x 2]
+   len is the length of the whole record.  flags are the SRIC_CAP_*
+   flags from the gateway.  time is the gateway's capture timestamp,
+   extended to 64 bits.  frame is the frame as it was on the bus, from
+   its delimiter to the end of its data, without its CRC (which the
+   gateway doesn't pass on).  Its data's truncated if SRIC_CAP_TRUNC is
+   set.  crc is crc16() of everything before it in the record, so that a
+   record cut short by a crash can be spotted. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sric-frame.h"
+
+#define SRIC_CAPFILE_MAGIC "SRICCAP"
+#define SRIC_CAPFILE_VERSION 1
+
+/* Offsets in the file header */
+enum {
+	SRIC_CAPFILE_MAGIC_OFF = 0,
+	SRIC_CAPFILE_VERSION_OFF = 8,
+	SRIC_CAPFILE_HZ_OFF = 12,
+	SRIC_CAPFILE_HEADER = 16,
+};
+
+/* Offsets in a record */
+enum {
+	SRIC_CAPREC_LEN = 0,
+	SRIC_CAPREC_LINK = 2,
+	SRIC_CAPREC_FLAGS = 3,
+	SRIC_CAPREC_TIME = 4,
+	SRIC_CAPREC_FRAME = 12,
+};
+
+/* Record bytes other than the frame */
+#define SRIC_CAPREC_OVERHEAD (SRIC_CAPREC_FRAME + 2)
+#define SRIC_CAPREC_MAX (SRIC_CAPREC_OVERHEAD + SRIC_HEADER_SIZE + MAX_PAYLOAD)
+
+typedef struct {
+	uint64_t time;
+	uint8_t link;
+	/* SRIC_CAP_* flags */
+	uint8_t flags;
+	/* The frame, starting with its delimiter */
+	const uint8_t *frame;
+	/* How much of its data is present */
+	uint8_t data_len;
+} sric_caprec_t;
+
+/* Fill in a file header */
+void sric_capfile_header( uint8_t *buf, uint32_t time_hz );
+
+/* Check a file header.  Returns false if it's not one we understand. */
+bool sric_capfile_check( const uint8_t *buf, size_t len, uint32_t *time_hz );
+
+/* Build a record in buf, which must have space for SRIC_CAPREC_MAX bytes.
+   Returns its length. */
+size_t sric_caprec_build( uint8_t *buf, const sric_caprec_t *rec );
+
+/* Parse the record at buf, with avail bytes of file after it.
+   rec points into buf.  Returns the record's length, 0 if it's
+   incomplete or corrupt. */
+size_t sric_caprec_parse( const uint8_t *buf, size_t avail, sric_caprec_t *rec );
+
+#endif	/* __SRIC_CAPFILE_H */
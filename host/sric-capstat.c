@@ -0,0 +1,397 @@
+/* Capture file analyser: streams through capture files (see
+   sric-capfile.h) and reports, as JSON, for each link:
+    - bus utilisation and frame rate,
+    - the proportion of frames with bad CRCs,
+    - for each address: request/response latency, how many requests
+      were retransmitted, and how many were never answered.
+
+   Files are mapped rather than read, and pages are let go of once
+   they've been passed, so captures can be much larger than memory.
+
+   A request is a non-ack frame to a node, and its response the next ack
+   from that node back to the sender.  A request that's the same as one
+   still waiting for a response is a retransmission; latency is measured
+   from the last transmission. */
+#define _GNU_SOURCE
+#include "sric-capfile.h"
+#include "crc16.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define N_ADDRS 128
+
+/* Latencies are kept in a histogram with four buckets per power of two,
+   so percentiles are to within 25% */
+#define HIST_BUCKETS 128
+
+/* How much of a file to pass before dropping its pages */
+#define DROP_CHUNK (64 << 20)
+
+typedef struct {
+	uint64_t requests, responses, retransmits, unanswered;
+	uint64_t lat_sum_us;
+	uint32_t lat_min_us, lat_max_us;
+	uint32_t hist[HIST_BUCKETS];
+} addr_stats_t;
+
+typedef struct {
+	/* When the last transmission was, and a crc16 of it */
+	uint64_t time;
+	uint16_t crc;
+	bool valid;
+} pending_t;
+
+typedef struct {
+	uint64_t first, last;
+	uint64_t frames, bad_crc, truncated, broadcasts, orphans;
+	/* Bits on the wire, counting 10 per byte */
+	uint64_t bits;
+
+	addr_stats_t addr[N_ADDRS];
+	/* Requests awaiting responses, by [requester][responder] */
+	pending_t pending[N_ADDRS][N_ADDRS];
+} link_t;
+
+static struct {
+	unsigned baud;
+} opt = {
+	.baud = 115200,
+};
+
+static link_t *links[256];
+static uint32_t time_hz = 0;
+static uint64_t records, skipped;
+
+static unsigned hist_bucket( uint32_t v )
+{
+	unsigned e;
+
+	if( v < 4 )
+		return v;
+
+	e = 31 - __builtin_clz( v );
+	return (e - 1) * 4 + ((v >> (e - 2)) & 3);
+}
+
+/* The largest value in a bucket */
+static uint32_t hist_max( unsigned b )
+{
+	unsigned e = b / 4 + 1;
+
+	if( b < 4 )
+		return b;
+	return (((uint64_t)5 + b % 4) << (e - 2)) - 1;
+}
+
+static uint32_t hist_percentile( const addr_stats_t *a, double p )
+{
+	uint64_t n = 0, want = p * a->responses;
+	unsigned b;
+
+	for( b=0; b<HIST_BUCKETS; b++ ) {
+		n += a->hist[b];
+		if( n > want )
+			break;
+	}
+
+	if( b == HIST_BUCKETS )
+		return a->lat_max_us;
+	/* Don't report more than was seen */
+	return hist_max(b) < a->lat_max_us ? hist_max(b) : a->lat_max_us;
+}
+
+static uint32_t ticks_to_us( uint64_t t )
+{
+	uint64_t us = time_hz == 1000000 ? t : t * 1000000 / time_hz;
+
+	return us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+/* Bytes that a frame took on the wire */
+static unsigned wire_bytes( const sric_caprec_t *rec )
+{
+	/* Delimiter and CRC (whose escaping isn't known) */
+	unsigned n = 3, i;
+
+	for( i=SRIC_DEST; i<SRIC_HEADER_SIZE + rec->data_len; i++ ) {
+		uint8_t b = rec->frame[i];
+
+		n += (b == SRIC_FRAME_DELIM || b == SRIC_FRAME_GW_DELIM
+		      || b == SRIC_FRAME_ESC) ? 2 : 1;
+	}
+
+	/* Data that wasn't captured */
+	return n + rec->frame[SRIC_LEN] - rec->data_len;
+}
+
+static link_t *get_link( uint8_t n, uint64_t time )
+{
+	if( links[n] == NULL ) {
+		links[n] = calloc( 1, sizeof(link_t) );
+		if( links[n] == NULL ) {
+			perror( "calloc" );
+			exit(1);
+		}
+		links[n]->first = time;
+	}
+
+	return links[n];
+}
+
+static void request( link_t *l, const sric_caprec_t *rec )
+{
+	uint8_t dest = rec->frame[SRIC_DEST] & 0x7f;
+	pending_t *p = &l->pending[sric_frame_src(rec->frame)][dest];
+	uint16_t crc = crc16( rec->frame, SRIC_HEADER_SIZE + rec->data_len );
+
+	if( dest == 0 ) {
+		l->broadcasts++;
+		return;
+	}
+
+	l->addr[dest].requests++;
+	if( p->valid ) {
+		if( p->crc == crc )
+			l->addr[dest].retransmits++;
+		else
+			l->addr[dest].unanswered++;
+	}
+
+	p->time = rec->time;
+	p->crc = crc;
+	p->valid = true;
+}
+
+static void response( link_t *l, const sric_caprec_t *rec )
+{
+	uint8_t src = sric_frame_src(rec->frame);
+	pending_t *p = &l->pending[rec->frame[SRIC_DEST] & 0x7f][src];
+	addr_stats_t *a = &l->addr[src];
+	uint32_t us;
+
+	if( !p->valid ) {
+		l->orphans++;
+		return;
+	}
+	p->valid = false;
+
+	us = ticks_to_us( rec->time - p->time );
+	if( a->responses == 0 || us < a->lat_min_us )
+		a->lat_min_us = us;
+	if( us > a->lat_max_us )
+		a->lat_max_us = us;
+	a->lat_sum_us += us;
+	a->hist[hist_bucket(us)]++;
+	a->responses++;
+}
+
+static void record( const sric_caprec_t *rec )
+{
+	link_t *l = get_link( rec->link, rec->time );
+
+	records++;
+	l->frames++;
+	l->last = rec->time;
+	l->bits += wire_bytes( rec ) * 10;
+
+	if( rec->flags & SRIC_CAP_TRUNC )
+		l->truncated++;
+
+	if( !(rec->flags & SRIC_CAP_CRC_OK) ) {
+		/* Its addresses can't be trusted */
+		l->bad_crc++;
+		return;
+	}
+
+	if( sric_frame_is_ack(rec->frame) )
+		response( l, rec );
+	else
+		request( l, rec );
+}
+
+static bool process_file( const char *path )
+{
+	const uint8_t *map;
+	struct stat st;
+	size_t pos, dropped = 0;
+	uint32_t hz;
+	int fd;
+
+	fd = open( path, O_RDONLY );
+	if( fd < 0 || fstat( fd, &st ) < 0 ) {
+		perror( path );
+		return false;
+	}
+
+	if( st.st_size == 0 ) {
+		fprintf( stderr, "%s: empty\n", path );
+		close( fd );
+		return false;
+	}
+
+	map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( map == MAP_FAILED ) {
+		perror( path );
+		return false;
+	}
+	madvise( (void*)map, st.st_size, MADV_SEQUENTIAL );
+
+	if( !sric_capfile_check( map, st.st_size, &hz ) ) {
+		fprintf( stderr, "%s: not a capture file\n", path );
+		munmap( (void*)map, st.st_size );
+		return false;
+	}
+	if( time_hz != 0 && hz != time_hz ) {
+		fprintf( stderr, "%s: timestamps are at %u Hz, not %u Hz\n",
+			 path, hz, time_hz );
+		munmap( (void*)map, st.st_size );
+		return false;
+	}
+	time_hz = hz;
+
+	pos = SRIC_CAPFILE_HEADER;
+	while( pos < (size_t)st.st_size ) {
+		sric_caprec_t rec;
+		size_t len = sric_caprec_parse( map + pos, st.st_size - pos, &rec );
+
+		if( len == 0 ) {
+			/* Cut short by a crash: look for the next good record */
+			skipped++;
+			pos++;
+			continue;
+		}
+
+		record( &rec );
+		pos += len;
+
+		if( pos - dropped >= DROP_CHUNK ) {
+			size_t end = pos & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+
+			madvise( (void*)(map + dropped), end - dropped, MADV_DONTNEED );
+			dropped = end;
+		}
+	}
+
+	munmap( (void*)map, st.st_size );
+	return true;
+}
+
+static double ratio( uint64_t a, uint64_t b )
+{
+	return b ? (double)a / b : 0;
+}
+
+static void report_addr( const addr_stats_t *a, unsigned n, bool last )
+{
+	printf( "        { \"addr\": %u, \"requests\": %llu, \"responses\": %llu, "
+		"\"retransmits\": %llu, \"retransmit_rate\": %.6f, "
+		"\"unanswered\": %llu,\n",
+		n, (unsigned long long)a->requests,
+		(unsigned long long)a->responses,
+		(unsigned long long)a->retransmits,
+		ratio( a->retransmits, a->requests ),
+		(unsigned long long)a->unanswered );
+	printf( "          \"latency_us\": { \"min\": %u, \"avg\": %llu, "
+		"\"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u } }%s\n",
+		a->lat_min_us,
+		(unsigned long long)(a->responses ? a->lat_sum_us / a->responses : 0),
+		hist_percentile( a, 0.5 ), hist_percentile( a, 0.99 ),
+		hist_percentile( a, 0.999 ), a->lat_max_us, last ? "" : "," );
+}
+
+static void report_link( link_t *l, unsigned n, bool last )
+{
+	double secs = (double)(l->last - l->first) / time_hz;
+	unsigned a, shown = 0, active = 0;
+	uint8_t req, resp;
+
+	/* Requests still waiting at the end */
+	for( req=0; req<N_ADDRS; req++ )
+		for( resp=0; resp<N_ADDRS; resp++ )
+			if( l->pending[req][resp].valid )
+				l->addr[resp].unanswered++;
+
+	for( a=0; a<N_ADDRS; a++ )
+		if( l->addr[a].requests || l->addr[a].responses )
+			active++;
+
+	printf( "    { \"link\": %u,\n", n );
+	printf( "      \"duration_s\": %.3f,\n", secs );
+	printf( "      \"frames\": %llu,\n", (unsigned long long)l->frames );
+	printf( "      \"frames_per_s\": %.1f,\n", secs > 0 ? l->frames / secs : 0 );
+	printf( "      \"utilisation\": %.4f,\n",
+		secs > 0 ? l->bits / (secs * opt.baud) : 0 );
+	printf( "      \"bad_crc\": %llu,\n", (unsigned long long)l->bad_crc );
+	printf( "      \"error_rate\": %.6f,\n", ratio( l->bad_crc, l->frames ) );
+	printf( "      \"truncated\": %llu,\n", (unsigned long long)l->truncated );
+	printf( "      \"broadcasts\": %llu,\n", (unsigned long long)l->broadcasts );
+	printf( "      \"orphan_responses\": %llu,\n", (unsigned long long)l->orphans );
+	printf( "      \"addrs\": [\n" );
+	for( a=0; a<N_ADDRS; a++ )
+		if( l->addr[a].requests || l->addr[a].responses )
+			report_addr( &l->addr[a], a, ++shown == active );
+	printf( "      ]\n" );
+	printf( "    }%s\n", last ? "" : "," );
+}
+
+static void report( unsigned files )
+{
+	unsigned n, shown = 0, active = 0;
+
+	for( n=0; n<256; n++ )
+		if( links[n] != NULL )
+			active++;
+
+	printf( "{\n" );
+	printf( "  \"files\": %u,\n", files );
+	printf( "  \"time_hz\": %u,\n", time_hz );
+	printf( "  \"baud\": %u,\n", opt.baud );
+	printf( "  \"records\": %llu,\n", (unsigned long long)records );
+	printf( "  \"skipped_bytes\": %llu,\n", (unsigned long long)skipped );
+	printf( "  \"links\": [\n" );
+	for( n=0; n<256; n++ )
+		if( links[n] != NULL )
+			report_link( links[n], n, ++shown == active );
+	printf( "  ]\n" );
+	printf( "}\n" );
+}
+
+static void usage( const char *argv0 )
+{
+	fprintf( stderr,
+		 "Usage: %s [-b BAUD] FILE...\n"
+		 "  -b BAUD  Bus baud rate, for utilisation (default 115200)\n",
+		 argv0 );
+}
+
+int main( int argc, char **argv )
+{
+	int o, i;
+
+	while( (o = getopt( argc, argv, "b:h" )) != -1 ) {
+		switch( o ) {
+		case 'b': opt.baud = atoi( optarg ); break;
+		default:
+			usage( argv[0] );
+			return o == 'h' ? 0 : 1;
+		}
+	}
+
+	if( optind == argc || opt.baud == 0 ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	for( i=optind; i<argc; i++ )
+		if( !process_file( argv[i] ) )
+			return 1;
+
+	report( argc - optind );
+	return 0;
+}
@@ -0,0 +1,217 @@
+/* Record bus traffic from a gateway to a capture file (see
+   sric-capfile.h), until interrupted.
+
+   The file's appended to, so several of these (one per gateway, each
+   with its own link number) can write to one file, or a capture can be
+   resumed. */
+#define _GNU_SOURCE
+#include "sric-host.h"
+#include "sric-capfile.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TIMEOUT_MS 500
+#define TRIES 3
+
+static struct {
+	const char *dev;
+	const char *file;
+	unsigned baud;
+	unsigned link;
+} opt = {
+	.dev = NULL,
+	.file = NULL,
+	.baud = 115200,
+	.link = 0,
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static int out_fd = -1;
+static uint32_t time_hz;
+
+/* Extends the gateway's 32-bit timestamps */
+static uint64_t time_high = 0;
+static uint32_t last_time = 0;
+
+static uint64_t records = 0, dropped = 0;
+
+static bool sync_ok;
+static uint8_t sync_resp[MAX_PAYLOAD];
+
+static void on_signal( int sig )
+{
+	stop = 1;
+}
+
+static void sync_done( void *ud, sric_host_status_t status,
+		       const uint8_t *data, uint8_t len )
+{
+	sync_ok = status == SRIC_HOST_OK;
+	if( sync_ok )
+		memcpy( sync_resp, data, len );
+}
+
+static bool set_capture( sric_host_t *h, bool on )
+{
+	uint8_t arg = on;
+	unsigned i;
+
+	for( i=0; i<TRIES; i++ ) {
+		sync_ok = false;
+		sric_host_gw_cmd( h, GW_CMD_CAPTURE, &arg, 1, TIMEOUT_MS,
+				  sync_done, NULL );
+		if( !sric_host_flush( h ) )
+			return false;
+		if( sync_ok )
+			return true;
+	}
+
+	return false;
+}
+
+static void rx( void *ud, const uint8_t *frame )
+{
+	sric_host_capture_t cap;
+	uint8_t buf[SRIC_CAPREC_MAX], f[SRIC_HEADER_SIZE + MAX_PAYLOAD];
+	sric_caprec_t rec;
+	size_t len;
+
+	/* Frames that arrive before the file's open are lost */
+	if( out_fd < 0 || !sric_host_capture_parse( frame, &cap ) )
+		return;
+
+	if( cap.time < last_time )
+		time_high += 1ULL << 32;
+	last_time = cap.time;
+
+	f[0] = SRIC_FRAME_DELIM;
+	memcpy( f + SRIC_DEST, cap.frame + SRIC_DEST,
+		SRIC_HEADER_SIZE - SRIC_DEST + cap.data_len );
+
+	rec.time = time_high | cap.time;
+	rec.link = opt.link;
+	rec.flags = cap.flags;
+	rec.frame = f;
+	rec.data_len = cap.data_len;
+	len = sric_caprec_build( buf, &rec );
+
+	/* One write per record, so that records from several recorders
+	   appending to the same file don't get mixed up */
+	if( write( out_fd, buf, len ) != (ssize_t)len )
+		dropped++;
+	else
+		records++;
+}
+
+/* Open the output file, writing its header if it's new */
+static bool open_out( void )
+{
+	uint8_t hdr[SRIC_CAPFILE_HEADER];
+	uint32_t hz;
+	struct stat st;
+	bool ok = true;
+
+	out_fd = open( opt.file, O_RDWR | O_CREAT | O_APPEND, 0644 );
+	if( out_fd < 0 ) {
+		perror( opt.file );
+		return false;
+	}
+
+	/* Stop several recorders starting a new file at once */
+	flock( out_fd, LOCK_EX );
+	fstat( out_fd, &st );
+
+	if( st.st_size == 0 ) {
+		sric_capfile_header( hdr, time_hz );
+		ok = write( out_fd, hdr, sizeof(hdr) ) == sizeof(hdr);
+	} else if( pread( out_fd, hdr, sizeof(hdr), 0 ) != sizeof(hdr)
+		   || !sric_capfile_check( hdr, sizeof(hdr), &hz ) ) {
+		fprintf( stderr, "%s: not a capture file\n", opt.file );
+		ok = false;
+	} else if( hz != time_hz ) {
+		fprintf( stderr, "%s: timestamps are at %u Hz, the gateway's at %u Hz\n",
+			 opt.file, hz, time_hz );
+		ok = false;
+	}
+
+	flock( out_fd, LOCK_UN );
+	return ok;
+}
+
+static void usage( const char *argv0 )
+{
+	fprintf( stderr,
+		 "Usage: %s [-b BAUD] [-l LINK] DEV FILE\n"
+		 "  -b BAUD  Serial baud rate (default 115200)\n"
+		 "  -l LINK  Link number to record the gateway's frames as (default 0)\n",
+		 argv0 );
+}
+
+int main( int argc, char **argv )
+{
+	struct sigaction sa;
+	sric_host_t *h;
+	int o;
+
+	while( (o = getopt( argc, argv, "b:l:h" )) != -1 ) {
+		switch( o ) {
+		case 'b': opt.baud = atoi( optarg ); break;
+		case 'l': opt.link = atoi( optarg ); break;
+		default:
+			usage( argv[0] );
+			return o == 'h' ? 0 : 1;
+		}
+	}
+
+	if( argc - optind != 2 || opt.link > 255 ) {
+		usage( argv[0] );
+		return 1;
+	}
+	opt.dev = argv[optind];
+	opt.file = argv[optind + 1];
+
+	h = sric_host_open( opt.dev, opt.baud );
+	if( h == NULL ) {
+		perror( opt.dev );
+		return 1;
+	}
+	sric_host_set_rx_cb( h, rx, NULL );
+
+	if( !set_capture( h, true ) ) {
+		fprintf( stderr, "%s: gateway didn't enter capture mode\n", opt.dev );
+		return 1;
+	}
+	time_hz = sync_resp[0] | sync_resp[1] << 8 | sync_resp[2] << 16
+		| (uint32_t)sync_resp[3] << 24;
+
+	if( !open_out() ) {
+		set_capture( h, false );
+		return 1;
+	}
+
+	memset( &sa, 0, sizeof(sa) );
+	sa.sa_handler = on_signal;
+	sigaction( SIGINT, &sa, NULL );
+	sigaction( SIGTERM, &sa, NULL );
+
+	while( !stop )
+		if( !sric_host_poll( h, -1 ) ) {
+			fprintf( stderr, "%s: connection failed\n", opt.dev );
+			break;
+		}
+
+	set_capture( h, false );
+	sric_host_close( h );
+	close( out_fd );
+
+	fprintf( stderr, "%llu records, %llu lost\n",
+		 (unsigned long long)records, (unsigned long long)dropped );
+	return 0;
+}
@@ -0,0 +1,786 @@
+#define _DEFAULT_SOURCE
+#include "sric-host.h"
+#include "cobs.h"
+#include "crc16.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+	/* Command to a bus node */
+	REQ_BUS,
+	/* Command to the gateway */
+	REQ_GW,
+	/* Frame with no response */
+	REQ_SEND,
+	/* Collective read, with a response from each board */
+	REQ_GATHER,
+} req_kind_t;
+
+/* Answers to a collective read so far */
+typedef struct {
+	unsigned expect, n;
+	sric_host_gather_cb_t cb;
+	/* Which addresses have answered, a bit each */
+	uint8_t answered[16];
+	sric_host_answer_t answers[128];
+} gather_t;
+
+typedef struct req {
+	struct req *next;
+	req_kind_t kind;
+
+	/* The node the response comes from */
+	uint8_t dest;
+
+	/* The frame, CRC and all.  It's encoded as it's sent, so that it
+	   goes in whatever framing's in use by then. */
+	uint8_t frame[MAX_FRAME_LEN];
+	uint8_t frame_len;
+
+	unsigned timeout_ms;
+	/* When the request times out: set once it's been sent, unless it
+	   had a deadline from the start (SRIC_HOST_F_DEADLINE) */
+	uint64_t deadline;
+	bool has_deadline;
+	/* Whether later requests may take its place (SRIC_HOST_F_COALESCE) */
+	bool coalesce;
+
+	sric_host_cb_t cb;
+	void *ud;
+	/* For REQ_GATHER */
+	gather_t *gather;
+} req_t;
+
+/* A list of requests, oldest first */
+typedef struct {
+	req_t *head;
+	req_t **tail;
+	unsigned n;
+} req_list_t;
+
+struct sric_host {
+	int fd;
+	uint8_t addr;
+	uint8_t window;
+	bool failed;
+	/* SRIC_FRAMING_* of the link */
+	uint8_t framing;
+
+	/* Requests waiting to be sent */
+	req_list_t queue;
+	/* Requests that have been sent, waiting for responses */
+	req_list_t inflight;
+
+	/* Receive state.  With COBS, the encoded frame (which is a byte
+	   longer) is collected here. */
+	uint8_t rxbuf[MAX_FRAME_LEN + 1];
+	uint8_t rxbuf_pos;
+	bool escape_next;
+
+	sric_host_rx_cb_t rx_cb;
+	void *rx_ud;
+};
+
+#define is_delim(x) ( (x) == SRIC_FRAME_DELIM || (x) == SRIC_FRAME_GW_DELIM )
+
+static uint64_t now_ms( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_init( req_list_t *l )
+{
+	l->head = NULL;
+	l->tail = &l->head;
+	l->n = 0;
+}
+
+static void list_append( req_list_t *l, req_t *r )
+{
+	r->next = NULL;
+	*l->tail = r;
+	l->tail = &r->next;
+	l->n++;
+}
+
+/* Remove the request that prev points to */
+static req_t *list_remove( req_list_t *l, req_t **prev )
+{
+	req_t *r = *prev;
+
+	*prev = r->next;
+	if( l->tail == &r->next )
+		l->tail = prev;
+	l->n--;
+
+	return r;
+}
+
+/* Put r in place of the request that prev points to, which is returned */
+static req_t *list_replace( req_list_t *l, req_t **prev, req_t *r )
+{
+	req_t *old = *prev;
+
+	r->next = old->next;
+	*prev = r;
+	if( l->tail == &old->next )
+		l->tail = &r->next;
+
+	return old;
+}
+
+/* Complete a request that's no longer on any list */
+static void req_complete( req_t *r, sric_host_status_t status,
+			  const uint8_t *data, uint8_t len )
+{
+	gather_t *g = r->gather;
+
+	if( g != NULL ) {
+		/* Whatever answers there were are the result */
+		if( status == SRIC_HOST_TIMEOUT
+		    && (g->expect == 0 || g->n >= g->expect) )
+			status = SRIC_HOST_OK;
+		g->cb( r->ud, status, g->answers, g->n );
+		free(g);
+	} else if( r->cb != NULL )
+		r->cb( r->ud, status, data, len );
+	free(r);
+}
+
+static speed_t baud_to_speed( unsigned baud )
+{
+	switch( baud ) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	default: return B0;
+	}
+}
+
+sric_host_t *sric_host_open( const char *dev, unsigned baud )
+{
+	struct termios t;
+	speed_t speed = baud_to_speed( baud );
+	sric_host_t *h;
+	int fd;
+
+	if( speed == B0 ) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open( dev, O_RDWR | O_NOCTTY );
+	if( fd < 0 )
+		return NULL;
+
+	if( tcgetattr( fd, &t ) == 0 ) {
+		cfmakeraw( &t );
+		cfsetispeed( &t, speed );
+		cfsetospeed( &t, speed );
+		t.c_cflag |= CLOCAL | CREAD;
+		tcsetattr( fd, TCSANOW, &t );
+	}
+
+	h = sric_host_new( fd );
+	if( h == NULL )
+		close(fd);
+	return h;
+}
+
+sric_host_t *sric_host_new( int fd )
+{
+	sric_host_t *h = calloc( 1, sizeof(*h) );
+
+	if( h == NULL )
+		return NULL;
+
+	fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+
+	h->fd = fd;
+	h->addr = 1;
+	h->window = SRIC_HOST_DEFAULT_WINDOW;
+	list_init( &h->queue );
+	list_init( &h->inflight );
+
+	return h;
+}
+
+static void fail_all( req_list_t *l )
+{
+	while( l->head != NULL )
+		req_complete( list_remove( l, &l->head ),
+			      SRIC_HOST_CLOSED, NULL, 0 );
+}
+
+void sric_host_close( sric_host_t *h )
+{
+	close( h->fd );
+	fail_all( &h->inflight );
+	fail_all( &h->queue );
+	free(h);
+}
+
+int sric_host_fd( const sric_host_t *h )
+{
+	return h->fd;
+}
+
+void sric_host_set_addr( sric_host_t *h, uint8_t addr )
+{
+	h->addr = addr;
+}
+
+void sric_host_set_window( sric_host_t *h, uint8_t n )
+{
+	h->window = n ? n : 1;
+}
+
+void sric_host_set_rx_cb( sric_host_t *h, sric_host_rx_cb_t cb, void *ud )
+{
+	h->rx_cb = cb;
+	h->rx_ud = ud;
+}
+
+void sric_host_set_framing( sric_host_t *h, uint8_t framing )
+{
+	h->framing = framing;
+	h->rxbuf_pos = 0;
+	h->escape_next = false;
+}
+
+/* Encode the frame in r for the link into buf, which must have space for
+   2 * MAX_FRAME_LEN bytes.  Returns the encoded length. */
+static unsigned frame_encode( const sric_host_t *h, const req_t *r, uint8_t *buf )
+{
+	unsigned len = 0;
+	uint8_t i;
+
+	if( h->framing == SRIC_FRAMING_COBS ) {
+		cobs_tx_t c;
+
+		cobs_tx_start( &c );
+		while( !cobs_tx_byte( &c, r->frame, r->frame_len, buf + len++ ) );
+		return len;
+	}
+
+	/* Don't escape byte 0 */
+	buf[len++] = r->frame[0];
+	for( i=1; i<r->frame_len; i++ ) {
+		uint8_t b = r->frame[i];
+
+		if( is_delim(b) || b == SRIC_FRAME_ESC ) {
+			buf[len++] = SRIC_FRAME_ESC;
+			buf[len++] = b ^ SRIC_FRAME_ESC_XOR;
+		} else
+			buf[len++] = b;
+	}
+
+	return len;
+}
+
+/* Assemble a frame into r->frame */
+static void req_encode( req_t *r, uint8_t delim, uint8_t dest, uint8_t src,
+			const uint8_t *pre, uint8_t pre_len,
+			const uint8_t *data, uint8_t len )
+{
+	uint8_t *raw = r->frame;
+	uint16_t crc;
+
+	raw[0] = delim;
+	raw[SRIC_DEST] = dest;
+	raw[SRIC_SRC] = src;
+	raw[SRIC_LEN] = pre_len + len;
+	memcpy( raw + SRIC_DATA, pre, pre_len );
+	memcpy( raw + SRIC_DATA + pre_len, data, len );
+
+	r->frame_len = SRIC_HEADER_SIZE + pre_len + len;
+	crc = crc16( raw, r->frame_len );
+	raw[r->frame_len++] = crc & 0xff;
+	raw[r->frame_len++] = (crc >> 8) & 0xff;
+}
+
+static req_t *req_new( req_kind_t kind, unsigned timeout_ms,
+		       sric_host_cb_t cb, void *ud )
+{
+	req_t *r = calloc( 1, sizeof(*r) );
+
+	if( r == NULL )
+		return NULL;
+
+	r->kind = kind;
+	r->timeout_ms = timeout_ms;
+	r->cb = cb;
+	r->ud = ud;
+	return r;
+}
+
+/* Find the queued request that r may take the place of */
+static req_t **coalesce_find( sric_host_t *h, const req_t *r )
+{
+	req_t **prev;
+
+	for( prev = &h->queue.head; *prev != NULL; prev = &(*prev)->next ) {
+		const req_t *q = *prev;
+
+		if( q->coalesce && q->dest == r->dest
+		    && q->frame[SRIC_LEN] > 0 && r->frame[SRIC_LEN] > 0
+		    && q->frame[SRIC_DATA] == r->frame[SRIC_DATA] )
+			return prev;
+	}
+
+	return NULL;
+}
+
+bool sric_host_cmd( sric_host_t *h, uint8_t addr,
+		    const uint8_t *data, uint8_t len, uint8_t flags,
+		    unsigned timeout_ms, sric_host_cb_t cb, void *ud )
+{
+	uint8_t src = h->addr;
+	req_t *r;
+
+	if( len > MAX_PAYLOAD )
+		return false;
+
+	r = req_new( REQ_BUS, timeout_ms, cb, ud );
+	if( r == NULL )
+		return false;
+
+	if( flags & SRIC_HOST_F_PRIO )
+		src |= SRIC_SRC_PRIO;
+
+	if( flags & SRIC_HOST_F_DEADLINE ) {
+		r->has_deadline = true;
+		r->deadline = now_ms() + timeout_ms;
+	}
+
+	r->dest = addr;
+	req_encode( r, SRIC_FRAME_DELIM, addr, src, NULL, 0, data, len );
+
+	if( flags & SRIC_HOST_F_COALESCE ) {
+		req_t **prev = coalesce_find( h, r );
+
+		r->coalesce = true;
+		if( prev != NULL ) {
+			req_complete( list_replace( &h->queue, prev, r ),
+				      SRIC_HOST_REPLACED, NULL, 0 );
+			return true;
+		}
+	}
+
+	list_append( &h->queue, r );
+	return true;
+}
+
+bool sric_host_gather( sric_host_t *h, uint8_t addr,
+		       const uint8_t *data, uint8_t len, unsigned expect,
+		       unsigned timeout_ms,
+		       sric_host_gather_cb_t cb, void *ud )
+{
+	uint8_t c = SRIC_SYSCMD_FLAG | SRIC_SYSCMD_GATHER;
+	req_t *r;
+
+	if( len + 1 > MAX_PAYLOAD || (addr != 0 && !sric_addr_is_group(addr)) )
+		return false;
+
+	r = req_new( REQ_GATHER, timeout_ms, NULL, ud );
+	if( r == NULL )
+		return false;
+
+	r->gather = calloc( 1, sizeof(*r->gather) );
+	if( r->gather == NULL ) {
+		free(r);
+		return false;
+	}
+	r->gather->expect = expect;
+	r->gather->cb = cb;
+
+	req_encode( r, SRIC_FRAME_DELIM, addr, h->addr, &c, 1, data, len );
+	list_append( &h->queue, r );
+	return true;
+}
+
+bool sric_host_gw_cmd( sric_host_t *h, gw_cmd_t cmd,
+		       const uint8_t *args, uint8_t len,
+		       unsigned timeout_ms, sric_host_cb_t cb, void *ud )
+{
+	uint8_t c = cmd;
+	req_t *r;
+
+	if( len + 1 > MAX_PAYLOAD )
+		return false;
+
+	r = req_new( REQ_GW, timeout_ms, cb, ud );
+	if( r == NULL )
+		return false;
+
+	req_encode( r, SRIC_FRAME_GW_DELIM, 0, h->addr, &c, 1, args, len );
+	list_append( &h->queue, r );
+	return true;
+}
+
+bool sric_host_send( sric_host_t *h, uint8_t dest,
+		     const uint8_t *data, uint8_t len )
+{
+	req_t *r;
+
+	if( len > MAX_PAYLOAD )
+		return false;
+
+	r = req_new( REQ_SEND, 0, NULL, NULL );
+	if( r == NULL )
+		return false;
+
+	req_encode( r, SRIC_FRAME_DELIM, dest, h->addr, NULL, 0, data, len );
+	list_append( &h->queue, r );
+	return true;
+}
+
+/* Write the whole buffer, waiting for space if necessary */
+static bool write_all( sric_host_t *h, const uint8_t *buf, unsigned len )
+{
+	while( len ) {
+		ssize_t w = write( h->fd, buf, len );
+
+		if( w < 0 ) {
+			struct pollfd p = { .fd = h->fd, .events = POLLOUT };
+
+			if( errno == EINTR )
+				continue;
+			if( errno != EAGAIN ) {
+				h->failed = true;
+				return false;
+			}
+
+			poll( &p, 1, -1 );
+			continue;
+		}
+
+		buf += w;
+		len -= w;
+	}
+
+	return true;
+}
+
+/* The queued request to send next: the one with the soonest deadline,
+   if any have one, otherwise the oldest */
+static req_t **tx_next( sric_host_t *h )
+{
+	req_t **prev, **next = &h->queue.head;
+
+	for( prev = &h->queue.head; *prev != NULL; prev = &(*prev)->next )
+		if( (*prev)->has_deadline
+		    && (!(*next)->has_deadline
+			|| (*prev)->deadline < (*next)->deadline) )
+			next = prev;
+
+	return next;
+}
+
+/* Send queued requests, while there's room at the gateway */
+static void tx_queued( sric_host_t *h )
+{
+	while( h->queue.head != NULL && !h->failed ) {
+		req_t **next = tx_next( h );
+		req_t *r = *next;
+		uint8_t buf[MAX_FRAME_LEN * 2];
+
+		if( r->kind != REQ_SEND && h->inflight.n >= h->window )
+			break;
+
+		list_remove( &h->queue, next );
+		if( !write_all( h, buf, frame_encode( h, r, buf ) ) ) {
+			req_complete( r, SRIC_HOST_CLOSED, NULL, 0 );
+			break;
+		}
+
+		if( r->kind == REQ_SEND ) {
+			free(r);
+			continue;
+		}
+
+		if( !r->has_deadline )
+			r->deadline = now_ms() + r->timeout_ms;
+		list_append( &h->inflight, r );
+	}
+}
+
+/* Find the oldest outstanding request that the given frame answers */
+static req_t **rx_match( sric_host_t *h, const uint8_t *frame )
+{
+	req_t **prev;
+
+	for( prev = &h->inflight.head; *prev != NULL; prev = &(*prev)->next ) {
+		const req_t *r = *prev;
+
+		if( frame[0] == SRIC_FRAME_GW_DELIM ) {
+			/* Capture records aren't acks */
+			if( r->kind == REQ_GW && sric_frame_is_ack(frame) )
+				return prev;
+		} else if( r->kind == REQ_BUS
+			   && sric_frame_is_ack(frame)
+			   && (frame[SRIC_DEST] & 0x7f) == h->addr
+			   /* Anyone may answer a broadcast */
+			   && (r->dest == 0 || sric_frame_src(frame) == r->dest)
+			   /* A priority command overtakes others to the same
+			      node, and its response is a priority one */
+			   && ((frame[SRIC_SRC] ^ r->frame[SRIC_SRC])
+			       & SRIC_SRC_PRIO) == 0 )
+			return prev;
+		else if( r->kind == REQ_GATHER
+			 && sric_frame_is_ack(frame)
+			 && (frame[SRIC_DEST] & 0x7f) == h->addr ) {
+			uint8_t src = sric_frame_src(frame);
+
+			/* Each board answers once */
+			if( !(r->gather->answered[src / 8] & (1 << (src % 8))) )
+				return prev;
+		}
+	}
+
+	return NULL;
+}
+
+bool sric_host_capture_parse( const uint8_t *frame, sric_host_capture_t *cap )
+{
+	const uint8_t *d = frame + SRIC_DATA;
+	uint8_t len = frame[SRIC_LEN];
+
+	if( frame[0] != SRIC_FRAME_GW_DELIM || sric_frame_is_ack(frame)
+	    || len < SRIC_CAP_HEADER )
+		return false;
+
+	cap->time = (uint32_t)d[SRIC_CAP_TIME]
+		| (uint32_t)d[SRIC_CAP_TIME + 1] << 8
+		| (uint32_t)d[SRIC_CAP_TIME + 2] << 16
+		| (uint32_t)d[SRIC_CAP_TIME + 3] << 24;
+	cap->flags = d[SRIC_CAP_FLAGS];
+	/* The flags byte sits where the captured frame's delimiter was */
+	cap->frame = d + SRIC_CAP_FRAME - SRIC_DEST;
+	cap->data_len = len - SRIC_CAP_HEADER;
+	return true;
+}
+
+/* Handle a complete, valid frame in rxbuf */
+static void rx_frame( sric_host_t *h )
+{
+	const uint8_t *frame = h->rxbuf;
+	req_t **prev = rx_match( h, frame );
+
+	if( prev == NULL ) {
+		if( h->rx_cb != NULL )
+			h->rx_cb( h->rx_ud, frame );
+		return;
+	}
+
+	if( (*prev)->kind == REQ_GATHER ) {
+		gather_t *g = (*prev)->gather;
+		sric_host_answer_t *a;
+		uint8_t src = sric_frame_src(frame);
+
+		/* Longer than any answer can be, so it won't fit in one */
+		if( frame[SRIC_LEN] > MAX_PAYLOAD )
+			return;
+
+		a = g->answers + g->n++;
+		g->answered[src / 8] |= 1 << (src % 8);
+		a->addr = src;
+		a->len = frame[SRIC_LEN];
+		memcpy( a->data, frame + SRIC_DATA, a->len );
+
+		/* Wait for the rest */
+		if( g->expect == 0 || g->n < g->expect )
+			return;
+	}
+
+	req_complete( list_remove( &h->inflight, prev ), SRIC_HOST_OK,
+		      frame + SRIC_DATA, frame[SRIC_LEN] );
+}
+
+/* Check the frame of len bytes in rxbuf, and handle it if it's good */
+static void rx_check( sric_host_t *h, uint8_t len )
+{
+	uint16_t crc, recv_crc;
+
+	if( len < SRIC_OVERHEAD || !is_delim( h->rxbuf[0] )
+	    || len != SRIC_OVERHEAD + h->rxbuf[SRIC_LEN] )
+		return;
+
+	crc = crc16( h->rxbuf, len - 2 );
+	recv_crc = h->rxbuf[ len - 2 ];
+	recv_crc |= h->rxbuf[ len - 1 ] << 8;
+
+	if( crc == recv_crc )
+		rx_frame( h );
+}
+
+static void rx_byte_cobs( sric_host_t *h, uint8_t b )
+{
+	if( b == COBS_DELIM ) {
+		uint8_t len = h->rxbuf_pos;
+
+		h->rxbuf_pos = 0;
+		if( len > SRIC_OVERHEAD && len <= sizeof(h->rxbuf) )
+			rx_check( h, cobs_decode( h->rxbuf, len ) );
+		return;
+	}
+
+	if( h->rxbuf_pos < sizeof(h->rxbuf) )
+		h->rxbuf[h->rxbuf_pos++] = b;
+	else
+		/* Too long: dropped at the next delimiter */
+		h->rxbuf_pos = sizeof(h->rxbuf) + 1;
+}
+
+static void rx_byte( sric_host_t *h, uint8_t b )
+{
+	uint8_t len;
+
+	if( h->framing == SRIC_FRAMING_COBS ) {
+		rx_byte_cobs( h, b );
+		return;
+	}
+
+	if( is_delim(b) ) {
+		h->escape_next = false;
+		h->rxbuf_pos = 0;
+	} else if( b == SRIC_FRAME_ESC ) {
+		h->escape_next = true;
+		return;
+	} else if( h->escape_next ) {
+		h->escape_next = false;
+		b ^= SRIC_FRAME_ESC_XOR;
+	}
+
+	if( h->rxbuf_pos >= sizeof(h->rxbuf) )
+		return;
+
+	h->rxbuf[h->rxbuf_pos++] = b;
+
+	if( !is_delim( h->rxbuf[0] ) || h->rxbuf_pos <= SRIC_LEN )
+		return;
+
+	len = h->rxbuf[SRIC_LEN];
+	if( h->rxbuf_pos != SRIC_OVERHEAD + len )
+		return;
+
+	h->rxbuf_pos = 0;
+	rx_check( h, SRIC_OVERHEAD + len );
+}
+
+static void rx_all( sric_host_t *h )
+{
+	uint8_t buf[256];
+	ssize_t r, i;
+
+	while( (r = read( h->fd, buf, sizeof(buf) )) > 0 )
+		for( i=0; i<r; i++ )
+			rx_byte( h, buf[i] );
+
+	if( r == 0 || (errno != EAGAIN && errno != EINTR) )
+		h->failed = true;
+}
+
+static void expire( sric_host_t *h )
+{
+	uint64_t now = now_ms();
+	req_t **prev = &h->inflight.head;
+
+	while( *prev != NULL ) {
+		if( (*prev)->deadline <= now ) {
+			req_complete( list_remove( &h->inflight, prev ),
+				      SRIC_HOST_TIMEOUT, NULL, 0 );
+			/* The callback may have added requests, but only
+			   to the queue, so prev's still good */
+		} else
+			prev = &(*prev)->next;
+	}
+
+	/* Requests that missed their deadline waiting to be sent */
+	prev = &h->queue.head;
+	while( *prev != NULL ) {
+		if( (*prev)->has_deadline && (*prev)->deadline <= now ) {
+			req_complete( list_remove( &h->queue, prev ),
+				      SRIC_HOST_TIMEOUT, NULL, 0 );
+			/* The callback may have added to the queue */
+			prev = &h->queue.head;
+		} else
+			prev = &(*prev)->next;
+	}
+}
+
+/* Limit a poll timeout so that it doesn't sleep past deadline */
+static int poll_limit( int timeout_ms, uint64_t deadline )
+{
+	int64_t left = (int64_t)(deadline - now_ms());
+
+	if( left < 0 )
+		left = 0;
+	if( timeout_ms < 0 || left < timeout_ms )
+		timeout_ms = left;
+	return timeout_ms;
+}
+
+bool sric_host_poll( sric_host_t *h, int timeout_ms )
+{
+	struct pollfd p = { .fd = h->fd, .events = POLLIN };
+	req_t *r;
+
+	tx_queued( h );
+
+	/* Don't sleep past the first deadline */
+	for( r = h->inflight.head; r != NULL; r = r->next )
+		timeout_ms = poll_limit( timeout_ms, r->deadline );
+	for( r = h->queue.head; r != NULL; r = r->next )
+		if( r->has_deadline )
+			timeout_ms = poll_limit( timeout_ms, r->deadline );
+
+	if( !h->failed && poll( &p, 1, timeout_ms ) > 0 ) {
+		if( p.revents & (POLLERR | POLLHUP) )
+			h->failed = true;
+		else
+			rx_all( h );
+	}
+
+	expire( h );
+	tx_queued( h );
+
+	return !h->failed;
+}
+
+unsigned sric_host_pending( const sric_host_t *h )
+{
+	unsigned n = h->inflight.n;
+	const req_t *r;
+
+	for( r = h->queue.head; r != NULL; r = r->next )
+		if( r->kind != REQ_SEND )
+			n++;
+
+	return n;
+}
+
+bool sric_host_flush( sric_host_t *h )
+{
+	while( sric_host_pending(h) )
+		if( !sric_host_poll( h, -1 ) )
+			return false;
+
+	/* Frames with no response may still be queued */
+	tx_queued( h );
+	return !h->failed;
+}
@@ -0,0 +1,170 @@
+#ifndef __SRIC_HOST_H
+#define __SRIC_HOST_H
+/* Host-side library for talking to a SRIC gateway over a serial port
+   (or pty).  Uses the same frame format and CRC as the firmware.
+
+   Requests are asynchronous: each one is given a callback, which is
+   called from sric_host_poll() when its response arrives or it times out.
+   Several bus commands may be outstanding at once.  Only as many as the
+   gateway can queue are sent at a time; the rest wait here.
+
+   Not thread-safe: call everything from one thread. */
+#include <stdbool.h>
+#include <stdint.h>
+#include "sric-frame.h"
+
+typedef struct sric_host sric_host_t;
+
+/* Results passed to request callbacks */
+typedef enum {
+	SRIC_HOST_OK,
+	/* No response within the request's timeout */
+	SRIC_HOST_TIMEOUT,
+	/* The connection was closed with the request outstanding */
+	SRIC_HOST_CLOSED,
+	/* A later request took its place before it was sent (see
+	   SRIC_HOST_F_COALESCE) */
+	SRIC_HOST_REPLACED,
+} sric_host_status_t;
+
+/* Request completion callback.
+   data and len are the response's data field (NULL/0 if status isn't
+   SRIC_HOST_OK). */
+typedef void (*sric_host_cb_t) ( void *ud, sric_host_status_t status,
+				 const uint8_t *data, uint8_t len );
+
+/* One board's answer to a collective read */
+typedef struct {
+	uint8_t addr;
+	uint8_t len;
+	uint8_t data[MAX_PAYLOAD];
+} sric_host_answer_t;
+
+/* Collective read completion callback.  status is SRIC_HOST_OK if all the
+   answers expected arrived, and SRIC_HOST_TIMEOUT if not; answers holds
+   those that did, in the order they arrived. */
+typedef void (*sric_host_gather_cb_t) ( void *ud, sric_host_status_t status,
+					const sric_host_answer_t *answers,
+					unsigned n );
+
+/* Callback for frames from the gateway that aren't responses to our
+   requests -- e.g. commands from the gateway's own device, or other bus
+   traffic.  frame is the whole frame, starting with its delimiter. */
+typedef void (*sric_host_rx_cb_t) ( void *ud, const uint8_t *frame );
+
+/* A frame seen by the gateway in capture mode (see GW_CMD_CAPTURE) */
+typedef struct {
+	/* When its delimiter arrived, in the gateway's capture clock */
+	uint32_t time;
+	/* SRIC_CAP_* flags */
+	uint8_t flags;
+	/* The frame, indexed as usual from SRIC_DEST on (frame[0] isn't
+	   its delimiter) */
+	const uint8_t *frame;
+	/* How much of its data was captured: less than frame[SRIC_LEN] if
+	   SRIC_CAP_TRUNC is set */
+	uint8_t data_len;
+} sric_host_capture_t;
+
+/* Request flags */
+/* Send as a priority command (see SRIC_SRC_PRIO) */
+#define SRIC_HOST_F_PRIO 1
+/* timeout_ms is a deadline, counted from now rather than from when the
+   request's sent.  Requests with deadlines are sent ahead of those
+   without, soonest deadline first, and one that's still queued when its
+   deadline passes is never sent at all (it completes with
+   SRIC_HOST_TIMEOUT).  For control loops, where a late answer is no use. */
+#define SRIC_HOST_F_DEADLINE 2
+/* Replace any request that's still waiting to be sent to the same node
+   with the same command (first data byte), and that also has this flag,
+   rather than queueing behind it.  The replaced request completes with
+   SRIC_HOST_REPLACED.  For writing setpoints, where only the latest value
+   matters. */
+#define SRIC_HOST_F_COALESCE 4
+
+/* Default number of requests to have with the gateway at once.
+   Matches the gateway's receive and transmit queues. */
+#define SRIC_HOST_DEFAULT_WINDOW 2
+
+/* Open a serial device, putting it in raw mode at the given baud rate.
+   Returns NULL on failure, with errno set. */
+sric_host_t *sric_host_open( const char *dev, unsigned baud );
+
+/* Use an already-open file descriptor, which is closed by sric_host_close */
+sric_host_t *sric_host_new( int fd );
+
+/* Close the connection.  Outstanding requests complete with
+   SRIC_HOST_CLOSED. */
+void sric_host_close( sric_host_t *h );
+
+/* The file descriptor, for use with select()/poll() */
+int sric_host_fd( const sric_host_t *h );
+
+/* Our address on the bus: responses are addressed to it.  Defaults to 1
+   (the director). */
+void sric_host_set_addr( sric_host_t *h, uint8_t addr );
+
+/* Set the number of requests that may be with the gateway at once */
+void sric_host_set_window( sric_host_t *h, uint8_t n );
+
+/* Set the callback for unsolicited frames */
+void sric_host_set_rx_cb( sric_host_t *h, sric_host_rx_cb_t cb, void *ud );
+
+/* Set the framing (SRIC_FRAMING_*) used on the link from now on, in both
+   directions.  Requests that are queued but not yet sent go in the new
+   framing.  Call it from the callback of a GW_CMD_FRAMING request, with
+   the framing in its reply, with nothing else outstanding. */
+void sric_host_set_framing( sric_host_t *h, uint8_t framing );
+
+/* Send a command to the node at addr, and call cb with its response, or
+   with SRIC_HOST_TIMEOUT if there's none within timeout_ms of its being
+   sent (but see SRIC_HOST_F_DEADLINE).
+   A command to address 0 (broadcast) takes the first response from any
+   node, e.g. during enumeration.
+   Returns false if the command won't fit in a frame. */
+bool sric_host_cmd( sric_host_t *h, uint8_t addr,
+		    const uint8_t *data, uint8_t len, uint8_t flags,
+		    unsigned timeout_ms, sric_host_cb_t cb, void *ud );
+
+/* Send a command to every board that has an address at once (see
+   SRIC_SYSCMD_GATHER), or with addr a group address (SRIC_GROUP()) to
+   every board in the group, and call cb with their answers.  addr 0 is
+   everyone.  Completes when
+   expect boards have answered, or after timeout_ms.  With expect 0, it
+   waits the whole timeout, and completes with SRIC_HOST_OK.
+   While it's outstanding, an answer is taken to be for it unless an
+   older request is waiting on the same board.
+   Returns false if the command won't fit in a frame, or addr isn't 0 or
+   a group. */
+bool sric_host_gather( sric_host_t *h, uint8_t addr,
+		       const uint8_t *data, uint8_t len, unsigned expect, unsigned timeout_ms,
+		       sric_host_gather_cb_t cb, void *ud );
+
+/* Send a command to the gateway itself */
+bool sric_host_gw_cmd( sric_host_t *h, gw_cmd_t cmd,
+		       const uint8_t *args, uint8_t len,
+		       unsigned timeout_ms, sric_host_cb_t cb, void *ud );
+
+/* Send a frame that has no response -- a broadcast, a command to a
+   group, or an ack to a command from the gateway's device.  It's queued behind any requests
+   that haven't been sent yet. */
+bool sric_host_send( sric_host_t *h, uint8_t dest,
+		     const uint8_t *data, uint8_t len );
+
+/* If frame (as passed to the rx callback) is a capture record, fill in
+   cap, which points into frame, and return true */
+bool sric_host_capture_parse( const uint8_t *frame, sric_host_capture_t *cap );
+
+/* Transmit queued requests, and process anything received or timed out.
+   Waits up to timeout_ms for something to happen (-1 waits forever).
+   Returns false if the connection has failed. */
+bool sric_host_poll( sric_host_t *h, int timeout_ms );
+
+/* Number of requests that haven't completed */
+unsigned sric_host_pending( const sric_host_t *h );
+
+/* Poll until every request has completed.
+   Returns false if the connection has failed. */
+bool sric_host_flush( sric_host_t *h );
+
+#endif	/* __SRIC_HOST_H */
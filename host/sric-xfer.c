@@ -0,0 +1,156 @@
+#include "sric-xfer.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	sric_host_t *h;
+	uint8_t addr;
+	const uint8_t *data;
+	size_t len;
+	uint8_t window;
+	unsigned timeout_ms;
+
+	/* Number of frames, and the first that hasn't been acked */
+	size_t frames, base;
+	/* Number of frames in the window that's been sent */
+	uint8_t sent;
+	/* Windows in a row that got nothing acked */
+	unsigned fails;
+
+	sric_xfer_cb_t cb;
+	void *ud;
+} xfer_t;
+
+#define XFER_CMD (SRIC_SYSCMD_FLAG | SRIC_SYSCMD_XFER)
+
+static void finish( xfer_t *x, bool ok )
+{
+	size_t acked = x->base * SRIC_XFER_PAYLOAD;
+
+	if( acked > x->len )
+		acked = x->len;
+
+	x->cb( x->ud, ok, acked );
+	free(x);
+}
+
+static void ack_done( void *ud, sric_host_status_t status,
+		      const uint8_t *data, uint8_t len );
+
+/* Build frame n of the transfer in d.  Returns its length. */
+static uint8_t frame_build( const xfer_t *x, size_t n, uint8_t op, uint8_t *d )
+{
+	size_t off = n * SRIC_XFER_PAYLOAD, part = x->len - off;
+
+	if( part > SRIC_XFER_PAYLOAD )
+		part = SRIC_XFER_PAYLOAD;
+
+	d[0] = XFER_CMD;
+	d[1] = op;
+	d[2] = n & 0xff;
+	memcpy( d + 3, x->data + off, part );
+	return 3 + part;
+}
+
+/* Send a window of frames from the first that hasn't been acked */
+static void window_send( xfer_t *x )
+{
+	uint8_t d[MAX_PAYLOAD], len, i;
+	size_t left = x->frames - x->base;
+
+	x->sent = left < x->window ? left : x->window;
+
+	for( i=0; i<x->sent - 1; i++ ) {
+		len = frame_build( x, x->base + i, SRIC_XFER_DATA, d );
+		sric_host_send( x->h, x->addr, d, len );
+	}
+
+	/* The last asks for an ack */
+	len = frame_build( x, x->base + i, SRIC_XFER_DATA_ACK, d );
+	sric_host_cmd( x->h, x->addr, d, len, 0, x->timeout_ms, ack_done, x );
+}
+
+static void ack_done( void *ud, sric_host_status_t status,
+		      const uint8_t *data, uint8_t len )
+{
+	xfer_t *x = ud;
+	uint8_t acked = 0;
+
+	if( status == SRIC_HOST_CLOSED ) {
+		finish( x, false );
+		return;
+	}
+
+	if( status == SRIC_HOST_OK && len == 1 ) {
+		/* The board's expecting the frame after the last it took */
+		acked = data[0] - (uint8_t)x->base;
+		if( acked > x->sent )
+			/* Nonsense */
+			acked = 0;
+	}
+
+	x->base += acked;
+	if( x->base == x->frames ) {
+		finish( x, true );
+		return;
+	}
+
+	if( acked )
+		x->fails = 0;
+	else if( ++x->fails == SRIC_XFER_TRIES ) {
+		finish( x, false );
+		return;
+	}
+
+	window_send( x );
+}
+
+static void start_done( void *ud, sric_host_status_t status,
+			const uint8_t *data, uint8_t len )
+{
+	xfer_t *x = ud;
+
+	if( status != SRIC_HOST_OK || len != 1 || data[0] == 0 ) {
+		finish( x, false );
+		return;
+	}
+
+	if( data[0] < x->window )
+		x->window = data[0];
+
+	if( x->frames == 0 )
+		finish( x, true );
+	else
+		window_send( x );
+}
+
+bool sric_xfer( sric_host_t *h, uint8_t addr,
+		const uint8_t *data, size_t len, uint8_t window,
+		unsigned timeout_ms, sric_xfer_cb_t cb, void *ud )
+{
+	uint8_t d[3] = { XFER_CMD, SRIC_XFER_START, window };
+	xfer_t *x;
+
+	if( window == 0 || window > SRIC_XFER_WINDOW_MAX )
+		return false;
+
+	x = calloc( 1, sizeof(*x) );
+	if( x == NULL )
+		return false;
+
+	x->h = h;
+	x->addr = addr;
+	x->data = data;
+	x->len = len;
+	x->window = window;
+	x->timeout_ms = timeout_ms;
+	x->frames = (len + SRIC_XFER_PAYLOAD - 1) / SRIC_XFER_PAYLOAD;
+	x->cb = cb;
+	x->ud = ud;
+
+	if( !sric_host_cmd( h, addr, d, 3, 0, timeout_ms, start_done, x ) ) {
+		free(x);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,26 @@
+#ifndef __SRIC_XFER_H
+#define __SRIC_XFER_H
+/* Windowed transfers to a board (see SRIC_SYSCMD_XFER), on top of
+   sric-host.  Several frames of data are in flight at once, and the board
+   acks them cumulatively, so a transfer isn't held to one frame per trip
+   round the bus.  Not thread-safe, as with sric-host. */
+#include "sric-host.h"
+#include <stddef.h>
+
+/* Number of windows in a row that may get nothing acked before a transfer
+   gives up */
+#define SRIC_XFER_TRIES 5
+
+/* Transfer completion callback.  ok is true if all the data was acked.
+   acked is how many bytes were (all of them, if ok). */
+typedef void (*sric_xfer_cb_t) ( void *ud, bool ok, size_t acked );
+
+/* Send len bytes from data to the board at addr, with up to window frames
+   in flight (less if the board takes less).  data must stay put until cb
+   is called.  timeout_ms is how long to wait for each ack.
+   Returns false if the transfer couldn't be started. */
+bool sric_xfer( sric_host_t *h, uint8_t addr,
+		const uint8_t *data, size_t len, uint8_t window,
+		unsigned timeout_ms, sric_xfer_cb_t cb, void *ud );
+
+#endif	/* __SRIC_XFER_H */
@@ -14,185 +14,111 @@
     along with this program; if not, write to the Free Software
     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 #include "hostser.h"
+#include "cobs.h"
 #include "crc16.h"
+#include "frame-pool.h"
+#include "frame-ring.h"
 #include <io.h>
 #include <signal.h>
 #include <sys/cdefs.h>
 
-typedef enum {
-	HS_RX_IDLE,		/* Idle or receiving frame in 1 buffer */
-	HS_RX_HAVE_FRAME,	/* Frame in 1 buffer, maybe receiving into 2nd*/
-	HS_RX_FULL		/* Both buffers are full */
-} hs_rx_state_t;
-
-typedef enum {
-	HS_TX_IDLE,		/* Nothing happening, capt'n */
-	HS_TX_SENDING,		/* Transmitting data from one buffer */
-	HS_TX_FULL		/* Transmitting from one buf, other buf full */
-} hs_tx_state_t;
-
-typedef enum {
-	EV_RX_RXED_FRAME,
-	EV_RX_HANDLED_FRAME
-} hs_rx_event_t;
-
-typedef enum {
-	EV_TX_TXMIT_DONE,
-	EV_TX_QUEUED
-} hs_tx_event_t;
-
-static volatile hs_rx_state_t rx_state = HS_RX_IDLE;
-static volatile hs_tx_state_t tx_state = HS_TX_IDLE;
-static volatile bool send_tx_done_cb = false;
-
 /* Linked in elsewhere */
 extern const hostser_conf_t hostser_conf;
 
 /*** Transmit buffer ***/
-static uint8_t txbuf[2][HOSTSER_BUF_SIZE];
-uint8_t *hostser_txbuf = &txbuf[0][0];
-static uint8_t txbuf_idx = 0;
-uint8_t hostser_txlen = 0;
-static uint8_t tx_len = 0;	/* Shadow of hostser_txlen */
+/* The buffer for the user to assemble frames in */
+uint8_t *hostser_txbuf;
+
+/* Frames queued for transmission.  We hold a reference to each.
+   The main loop pushes frames in, and pops them once they've been sent. */
+FRAME_RING( tx_ring, HOSTSER_TX_DEPTH );
+/* Number of frames that the transmit intr has finished sending
+   (the intr's own tail for tx_ring) */
+static volatile uint8_t tx_sent = 0;
+/* The frame being transmitted (NULL when between frames) */
+static uint8_t *tx_frame = NULL;
+static uint8_t tx_len = 0;
 
 /* Offset of next byte to be transmitted from the tx buffer */
 static uint8_t txbuf_pos = 0;
 
+uint8_t hostser_framing = SRIC_FRAMING_ESCAPE;
+/* The framing of each frame in tx_ring, as it was when it was queued */
+static uint8_t tx_framing[HOSTSER_TX_DEPTH];
+/* Encoder for the frame being transmitted, if it's SRIC_FRAMING_COBS */
+static bool tx_cobs = false;
+static cobs_tx_t tx_cobs_state;
+
+/* Number of tx_done_cb calls to make */
+static uint8_t tx_done_cbs = 0;
+
 /**** Receive buffer ****/
-static uint8_t rxbuf[2][HOSTSER_BUF_SIZE];
-static uint8_t rxbuf_idx = 0;
-uint8_t *hostser_rxbuf = &rxbuf[0][0];
+/* Received frames, passed from the receive intr to the main loop.
+   Each slot keeps a frame from the pool to be received into. */
+FRAME_RING( rx_ring, HOSTSER_RX_DEPTH );
+/* The frame being received into (NULL if the ring was full at the
+   start of the frame) */
+static uint8_t *rx_frame = NULL;
+uint8_t *hostser_rxbuf;
 /* Where the next byte needs to go */
 static uint8_t rxbuf_pos = 0;
+/* Set when we've finished with a received frame, but couldn't get a new
+   one from the pool to replace it */
+static bool rx_recycle_pending = false;
+/* With SRIC_FRAMING_COBS, frames are decoded by hostser_poll: this is the
+   encoded length of the frame in each rx_ring slot */
+static uint8_t rx_len[HOSTSER_RX_DEPTH];
 
 /* Set crc in transmit buffer */
 static void tx_set_crc( void );
 
 void hostser_init( void )
 {
-}
+	uint8_t i;
 
-/* Called in intr context */
-static void rx_fsm ( hs_rx_event_t ev )
-{
+	for( i=0; i<HOSTSER_RX_DEPTH; i++ )
+		rx_ring_slots[i] = frame_alloc();
+	hostser_rxbuf = rx_ring_slots[0];
 
-	switch ( rx_state ) {
-	case HS_RX_IDLE:
-		if ( ev == EV_RX_RXED_FRAME ) {
-			/* Point ptr for outside world to current buffer */
-			hostser_rxbuf = &rxbuf[rxbuf_idx][0];
-			/* Switch recieve destination to other buffer */
-			rxbuf_idx = (rxbuf_idx + 1) & 1;
-			rxbuf_pos = 0;
-			/* And change state */
-			rx_state = HS_RX_HAVE_FRAME;
-		}
-		break;
-
-	case HS_RX_HAVE_FRAME:
-		if ( ev == EV_RX_RXED_FRAME ) {
-			/* Yikes. Host software should still be processing the
-			 * first frame, so don't mess with hostser_rxbuf.
-			 * instead sit tight in the RX_FULL state - this blocks
-			 * any more receipt of data */
-			rx_state = HS_RX_FULL;
-		} else if ( ev == EV_RX_HANDLED_FRAME ) {
-			/* Data is being read (or will be read) into the other
-			 * rx buffer - no config change needed */
-			rx_state = HS_RX_IDLE;
-		}
-		break;
-
-	case HS_RX_FULL:
-		if ( ev == EV_RX_HANDLED_FRAME ) {
-			/* Right - point host software at most recently received
-			 * frame */
-			hostser_rxbuf = &rxbuf[rxbuf_idx][0];
-			/* And we can start reading into the other buffer */
-			rxbuf_idx = (rxbuf_idx + 1) & 1;
-			rxbuf_pos = 0;
-			rx_state = HS_RX_HAVE_FRAME;
-		}
-		break;
-	}
-
-	return;
+	hostser_txbuf = frame_alloc();
 }
 
 /* Called in intr context */
-static void tx_fsm ( hs_tx_event_t ev )
+bool hostser_tx_cb( uint8_t *b )
 {
+	static bool escape_next = false;
+	uint8_t byte;
 
-	switch ( tx_state ) {
-	case HS_TX_IDLE:
-		if ( ev == EV_TX_QUEUED ) {
-			/* Update outside view of where to write tx data */
-			hostser_txbuf = &txbuf[txbuf_idx ^ 1][0];
-
-			/* Reset transmit position */
-			txbuf_pos = 0;
-			tx_len = hostser_txlen;
-
-			/* Actually start transmission */
-			hostser_conf.usart_tx_start(
-					hostser_conf.usart_tx_start_n);
-			tx_state = HS_TX_SENDING;
-		}
-		break;
-
-	case HS_TX_SENDING:
-		if ( ev == EV_TX_TXMIT_DONE ) {
-			/* Point transmit location at next buffer */
-			txbuf_idx ^= 1;
-
-			/* And send a callback */
-			send_tx_done_cb = true;
-			tx_state = HS_TX_IDLE;
-		} else if ( ev == EV_TX_QUEUED ) {
-			/* Transmission continues; however when we have an
-			 * opportunity we point the tx buffer elsewhere */
-			tx_state = HS_TX_FULL;
-		}
-		break;
-	case HS_TX_FULL:
-		if ( ev == EV_TX_TXMIT_DONE ) {
-			/* Point outside world at the just-finished buffer */
-			hostser_txbuf = &txbuf[txbuf_idx][0];
-
-			/* Move buffers along... */
-			txbuf_idx ^= 1;
-
-			/* Reset transmit position */
-			txbuf_pos = 0;
-			tx_len = hostser_txlen;
-
-			/* And transmit */
-			hostser_conf.usart_tx_start(
-					hostser_conf.usart_tx_start_n);
-			tx_state = HS_TX_SENDING;
-		} else if ( ev == EV_TX_QUEUED ) {
-			/* Not valid */
-			while (1) ;
-		}
-		break;
+	if( tx_frame != NULL && txbuf_pos == tx_len ) {
+		/* Transmission of this frame complete.
+		   The main loop drops our reference to it. */
+		tx_frame = NULL;
+		tx_sent++;
 	}
 
-	return;
-}
+	if( tx_frame == NULL ) {
+		if( tx_sent == tx_ring.head )
+			/* Nothing more queued */
+			return false;
 
-/* Called in intr context */
-bool hostser_tx_cb( uint8_t *b )
-{
-	static bool escape_next = false;
-	uint8_t byte;
+		/* Move straight on to the next frame */
+		tx_frame = *frame_ring_slot( &tx_ring, tx_sent );
+		txbuf_pos = 0;
+		tx_len = SRIC_OVERHEAD + tx_frame[SRIC_LEN];
 
-	if( txbuf_pos == tx_len ) {
-		/* Transmission complete */
-		tx_fsm( EV_TX_TXMIT_DONE );
-		return false;
+		tx_cobs = tx_framing[ tx_sent & tx_ring.mask ] == SRIC_FRAMING_COBS;
+		if( tx_cobs )
+			cobs_tx_start( &tx_cobs_state );
 	}
 
-	byte = txbuf[txbuf_idx][txbuf_pos];
+	if( tx_cobs ) {
+		/* The frame's finished once its closing delimiter's out */
+		if( cobs_tx_byte( &tx_cobs_state, tx_frame, tx_len, b ) )
+			txbuf_pos = tx_len;
+		return true;
+	}
+
+	byte = tx_frame[txbuf_pos];
 	*b = byte;
 
 	if( escape_next ) {
@@ -212,6 +138,35 @@ bool hostser_tx_cb( uint8_t *b )
 
 #define is_delim(x) ( (x == 0x7e) || (x == 0x8e) )
 
+/* Receive a byte of a COBS-framed frame.  It's stored as it is, and
+   decoded and checked by hostser_poll.  Called in intr context. */
+static void rx_cobs( uint8_t b )
+{
+	if( b == COBS_DELIM ) {
+		/* Ends the frame being received, and starts the next */
+		if( rx_frame != NULL && rxbuf_pos > SRIC_OVERHEAD ) {
+			rx_len[ rx_ring.head & rx_ring.mask ] = rxbuf_pos;
+			frame_ring_push( &rx_ring );
+		}
+
+		rxbuf_pos = 0;
+		rx_frame = frame_ring_wr( &rx_ring );
+		return;
+	}
+
+	if( rx_frame == NULL )
+		return;
+
+	if( rxbuf_pos == FRAME_SIZE ) {
+		/* Too long to be a frame */
+		rx_frame = NULL;
+		return;
+	}
+
+	rx_frame[rxbuf_pos] = b;
+	rxbuf_pos += 1;
+}
+
 /* Called in intr context */
 void hostser_rx_cb( uint8_t b )
 {
@@ -219,13 +174,17 @@ void hostser_rx_cb( uint8_t b )
 	uint8_t len;
 	uint16_t crc, recv_crc;
 
-	if ( rx_state == HS_RX_FULL )
-		/* Both buffers are full. Discard. */
+	if( hostser_framing == SRIC_FRAMING_COBS ) {
+		rx_cobs( b );
 		return;
+	}
 
 	if( is_delim(b) ) {
 		escape_next = false;
 		rxbuf_pos = 0;
+		/* Receive into the next free slot.  If the ring's full, this
+		   frame's discarded. */
+		rx_frame = frame_ring_wr( &rx_ring );
 	} else if( b == 0x7D ) {
 		escape_next = true;
 		return;
@@ -233,31 +192,35 @@ void hostser_rx_cb( uint8_t b )
 		escape_next = false;
 		b ^= 0x20;
 	}
+
+	if( rx_frame == NULL )
+		return;
 			
 	/* End of buffer :/ */
 	if( rxbuf_pos >= HOSTSER_BUF_SIZE )
 		return;
 
-	rxbuf[rxbuf_idx][rxbuf_pos] = b;
+	rx_frame[rxbuf_pos] = b;
 	rxbuf_pos += 1;
 
-	if( !is_delim( rxbuf[rxbuf_idx][0] )
+	if( !is_delim( rx_frame[0] )
 	    /* Make sure we've reached the minimum frame size */
 	    || rxbuf_pos < (SRIC_LEN + 2) )
 		return;
 
-	len = rxbuf[rxbuf_idx][SRIC_LEN];
+	len = rx_frame[SRIC_LEN];
 	if( len != rxbuf_pos - (SRIC_LEN + 3) )
 		return;
 
 	/* Everything gets hashed */
-	crc = crc16( rxbuf[rxbuf_idx], rxbuf_pos - 2 );
+	crc = crc16( rx_frame, rxbuf_pos - 2 );
 
-	recv_crc = rxbuf[rxbuf_idx][ rxbuf_pos-2 ];
-	recv_crc |= rxbuf[rxbuf_idx][ rxbuf_pos-1 ] << 8;
+	recv_crc = rx_frame[ rxbuf_pos-2 ];
+	recv_crc |= rx_frame[ rxbuf_pos-1 ] << 8;
 
 	if( crc == recv_crc ) {
-		rx_fsm( EV_RX_RXED_FRAME );
+		frame_ring_push( &rx_ring );
+		rx_frame = NULL;
 	}
 }
 
@@ -270,39 +233,145 @@ static void tx_set_crc( void )
 	hostser_txbuf[ SRIC_DATA + len + 1 ] = (c >> 8) & 0xff;
 }
 
+/* Drop our references to frames that have finished transmitting */
+static void tx_reclaim( void )
+{
+	while( tx_ring.tail != tx_sent ) {
+		uint8_t **slot = frame_ring_rd( &tx_ring );
+
+		frame_unref( *slot );
+		*slot = NULL;
+		frame_ring_pop( &tx_ring );
+
+		tx_done_cbs++;
+	}
+
+	if( hostser_txbuf == NULL )
+		hostser_txbuf = frame_alloc();
+}
+
+/* Queue a frame that we hold a reference to */
+static bool tx_queue( uint8_t *frame )
+{
+	tx_reclaim();
+
+	if( frame_ring_full( &tx_ring ) )
+		return false;
+
+	/* The intr mustn't see the frame before its framing */
+	tx_framing[ tx_ring.head & tx_ring.mask ] = hostser_framing;
+	frame_ring_put( &tx_ring, frame );
+
+	/* Harmless if the USART's already transmitting */
+	hostser_conf.usart_tx_start( hostser_conf.usart_tx_start_n );
+	return true;
+}
+
+bool hostser_tx_full( void )
+{
+
+	tx_reclaim();
+	return frame_ring_full( &tx_ring );
+}
+
+static void rx_recycle( void )
+{
+	/* The frame the user's just finished with is the oldest in the ring.
+	   If it's been passed on elsewhere we need a fresh one to receive
+	   into before the slot can be handed back. */
+	if( !frame_recycle( frame_ring_rd( &rx_ring ) ) ) {
+		/* Pool's empty -- try again later */
+		rx_recycle_pending = true;
+		return;
+	}
+
+	rx_recycle_pending = false;
+	frame_ring_pop( &rx_ring );
+}
+
 void hostser_rx_done( void )
 {
 
-	dint();
-	rx_fsm( EV_RX_HANDLED_FRAME );
-	eint();
+	rx_recycle();
 }
 
-void hostser_tx( void )
+bool hostser_tx( void )
 {
+	uint8_t *frame = hostser_txbuf;
 
 	tx_set_crc();
-	hostser_txlen = SRIC_OVERHEAD + hostser_txbuf[ SRIC_LEN ];
 
+	if( !tx_queue( frame ) )
+		return false;
+
+	/* Our reference to the frame went with it */
+	hostser_txbuf = frame_alloc();
+	return true;
+}
+
+bool hostser_tx_frame( uint8_t *frame )
+{
+
+	frame_ref( frame );
+	if( tx_queue( frame ) )
+		return true;
+
+	frame_unref( frame );
+	return false;
+}
+
+void hostser_set_framing( uint8_t framing )
+{
 	dint();
-	tx_fsm( EV_TX_QUEUED );
+	hostser_framing = framing;
+	rx_frame = NULL;
+	rxbuf_pos = 0;
 	eint();
 }
 
-void hostser_poll( void )
+/* Decode and check the COBS-framed frame in hostser_rxbuf.
+   Returns false if it isn't a valid frame. */
+static bool rx_cobs_check( void )
 {
+	uint8_t len = cobs_decode( hostser_rxbuf,
+				   rx_len[ rx_ring.tail & rx_ring.mask ] );
+	uint16_t crc, recv_crc;
+
+	if( len < SRIC_OVERHEAD || !is_delim( hostser_rxbuf[0] )
+	    || len != SRIC_OVERHEAD + hostser_rxbuf[SRIC_LEN] )
+		return false;
 
-	if ( rx_state == HS_RX_HAVE_FRAME || rx_state == HS_RX_FULL ) {
-		if( hostser_conf.rx_cb != NULL )
+	crc = crc16( hostser_rxbuf, len - 2 );
+	recv_crc = hostser_rxbuf[ len-2 ];
+	recv_crc |= hostser_rxbuf[ len-1 ] << 8;
+
+	return crc == recv_crc;
+}
+
+void hostser_poll( void )
+{
+	uint8_t **slot;
+
+	if ( rx_recycle_pending ) {
+		/* Still waiting for a frame to receive into */
+		rx_recycle();
+	} else if ( (slot = frame_ring_rd( &rx_ring )) != NULL ) {
+		hostser_rxbuf = *slot;
+
+		/* The escaping receive intr only passes on good frames; with
+		   COBS it's up to us */
+		if( hostser_framing == SRIC_FRAMING_COBS && !rx_cobs_check() )
+			rx_recycle();
+		else if( hostser_conf.rx_cb != NULL )
 			hostser_conf.rx_cb();
 
 		/* We don't send "handled" msg, that's up to the callback */
 	}
 
-	if ( send_tx_done_cb ) {
-		dint();
-		send_tx_done_cb = false;
-		eint();
+	tx_reclaim();
+
+	while ( tx_done_cbs ) {
+		tx_done_cbs--;
 
 		if( hostser_conf.tx_done_cb != NULL )
 			hostser_conf.tx_done_cb();
@@ -7,18 +7,37 @@
 #include "sric.h"
 
 #define HOSTSER_BUF_SIZE SRIC_TXBUF_SIZE
-/* Transmit buffer
-   All bytes except the first are escaped as they leave. */
+
+/* Number of received frames that can be waiting to be handled.
+   Must be a power of 2. */
+#ifndef HOSTSER_RX_DEPTH
+#define HOSTSER_RX_DEPTH 2
+#endif
+
+/* Number of frames that can be queued for transmission.
+   Must be a power of 2. */
+#ifndef HOSTSER_TX_DEPTH
+#define HOSTSER_TX_DEPTH 4
+#endif
+
+/* Transmit buffer: assemble frames to send here.
+   All bytes except the first are escaped as they leave.
+   This is a frame from the frame pool, and is NULL if the pool was empty
+   when it needed replacing. */
 extern uint8_t *hostser_txbuf;
-/* Number of bytes in the transmit buffer */
-extern uint8_t hostser_txlen;
 /* Receive buffer */
 extern uint8_t *hostser_rxbuf;
 
+/* Framing (SRIC_FRAMING_*) of the link.  Change it with
+   hostser_set_framing. */
+extern uint8_t hostser_framing;
+
 /* An instance of this struct must be linked in, and named
    hostser_conf.  Should be const. */
 typedef struct {
-	/* Function to be called to start the USART transmitting */
+	/* Function to be called to start the USART transmitting.
+	   This is called for every queued frame, and so must be harmless to
+	   call while the USART is already transmitting. */
 	void (*usart_tx_start) (uint8_t n);
 
 	/* n to pass to the start function */
@@ -38,15 +57,27 @@ bool hostser_tx_cb( uint8_t *b );
 /* Callback for each byte received */
 void hostser_rx_cb( uint8_t b );
 
-/* Request that the given frame is transmitted
-   Sorts out CRC.
-   Must be called when the tx is not busy. */
-void hostser_tx( void );
+/* Request that the frame in hostser_txbuf is transmitted
+   Sorts out CRC.  hostser_txbuf is replaced with a fresh frame.
+   Returns false, leaving hostser_txbuf alone, if the tx queue is full. */
+bool hostser_tx( void );
+
+/* Request that the given frame-pool frame is transmitted, without copying.
+   A reference to the frame is taken until it's been sent.
+   The frame must already have its CRC.
+   Returns false if the tx queue is full. */
+bool hostser_tx_frame( uint8_t *frame );
+
+/* Returns true when the tx queue is full */
+bool hostser_tx_full( void );
 
-/* Returns true when the tx is busy */
-bool hostser_tx_busy( void );
+/* Switch the link's framing.  Frames already queued for transmission are
+   sent in the old framing.  Anything being received is dropped, so the
+   host shouldn't send anything until it's been told of the switch. */
+void hostser_set_framing( uint8_t framing );
 
-/* Indicate that the received frame has been processed */
+/* Indicate that the received frame has been processed.
+   The frame in hostser_rxbuf may be kept by taking a reference to it. */
 void hostser_rx_done( void );
 
 #endif	/* __HOSTSER_H */
@@ -16,6 +16,8 @@
 #include "sric-client.h"
 
 #include <drivers/sched.h>
+#include <signal.h>
+#include <string.h>
 #include "version-buf.h"
 
 /* Reset the device, move into enumeration mode */
@@ -30,6 +32,35 @@ static uint8_t syscmd_addr_assign( const sric_if_t *iface );
 /* Send reply containing info */
 static uint8_t syscmd_addr_info( const sric_if_t *iface );
 
+/* Send reply containing the token timing statistics */
+static uint8_t syscmd_tok_stats( const sric_if_t *iface );
+
+/* Report the supported framings, or switch framing */
+static uint8_t syscmd_framing( const sric_if_t *iface );
+
+/* Report the fastest baud rate supported, or switch rate */
+static uint8_t syscmd_baud( const sric_if_t *iface );
+
+/* Receive a windowed transfer */
+static uint8_t syscmd_xfer( const sric_if_t *iface );
+
+/* Answer a collective read */
+static uint8_t syscmd_gather( const sric_if_t *iface );
+
+/* Report the groups joined, or join others */
+static uint8_t syscmd_group( const sric_if_t *iface );
+
+/* Run a batch of board commands */
+static uint8_t syscmd_batch( const sric_if_t *iface );
+
+/* Describe, read or write a range of registers */
+static uint8_t syscmd_reg_info( const sric_if_t *iface );
+static uint8_t syscmd_reg_read( const sric_if_t *iface );
+static uint8_t syscmd_reg_write( const sric_if_t *iface );
+
+/* Report that we take sequence bytes, or start or stop sending them */
+static uint8_t syscmd_seq( const sric_if_t *iface );
+
 /* Table of 'system' commands.
    The order of these is important! */
 static const sric_cmd_t syscmds[] =
@@ -37,13 +68,81 @@ static const sric_cmd_t syscmds[] =
 	/* Commands required for enumeration */
 	{ syscmd_reset },
 	{ syscmd_enum_tok_advance },
-	{ syscmd_addr_assign },
-	{ syscmd_addr_info },
+	SRIC_CMD( syscmd_addr_assign, 2, 2, 1, 0 ),
+	SRIC_CMD( syscmd_addr_info, 1, 1, 1, SRIC_CMD_F_IDEMPOTENT ),
 
 	/* Git version information */
-	{ version_buf_read },
+	SRIC_CMD( version_buf_read, 3, 3, MAX_PAYLOAD, SRIC_CMD_F_IDEMPOTENT ),
+
+	/* Token loop and hold times */
+	SRIC_CMD( syscmd_tok_stats, 1, 2, TOKEN_STATS_PACKED_LEN, 0 ),
+
+	/* Frame encoding and speed on the bus */
+	SRIC_CMD( syscmd_framing, 1, 2, 1, 0 ),
+	SRIC_CMD( syscmd_baud, 1, 5, 4, 0 ),
+
+	/* Windowed transfers */
+	SRIC_CMD( syscmd_xfer, 3, MAX_PAYLOAD, 1, 0 ),
+
+	/* Collective reads and groups */
+	SRIC_CMD( syscmd_gather, 2, MAX_PAYLOAD, MAX_PAYLOAD, 0 ),
+	SRIC_CMD( syscmd_group, 1, 3, 2, SRIC_CMD_F_IDEMPOTENT ),
+
+	/* Several commands in a frame */
+	SRIC_CMD( syscmd_batch, 1, MAX_PAYLOAD, MAX_PAYLOAD, 0 ),
+
+	/* Registers */
+	SRIC_CMD( syscmd_reg_info, 3, 3, MAX_PAYLOAD, SRIC_CMD_F_IDEMPOTENT ),
+	SRIC_CMD( syscmd_reg_read, 3, 3, MAX_PAYLOAD, SRIC_CMD_F_IDEMPOTENT ),
+	SRIC_CMD( syscmd_reg_write, 2, MAX_PAYLOAD, 1, 0 ),
+
+	/* Sequence bytes on commands */
+	SRIC_CMD( syscmd_seq, 1, 2, 1, 0 ),
 };
 
+/* The last response sent to each of a few peers, for commands that came
+   with a sequence byte.  A retransmission of the command it was for (same
+   sequence number) gets it again, rather than being acted on a second
+   time.  Anything else, including a retransmission whose original never
+   arrived, is acted on as usual. */
+typedef struct {
+	/* The bus the peer's on (as its sric_if_t's addr) */
+	const uint8_t *bus;
+	/* Peer's address, or 0 if the entry's unused */
+	uint8_t addr;
+	/* Sequence number of the command */
+	uint8_t seq;
+	/* Length of the response's data, with SRIC_RESPOND_NOW if it
+	   was given */
+	uint8_t len;
+	uint8_t data[MAX_PAYLOAD];
+} resp_cache_t;
+
+static resp_cache_t resp_cache[SRIC_CLIENT_RESP_CACHE];
+/* Entry to replace next */
+static uint8_t resp_cache_next = 0;
+
+/* The sender of the transfer in progress (0 if there isn't one), the bus
+   it's on, and the seq of the frame expected next from it */
+static uint8_t xfer_src = 0;
+static const uint8_t *xfer_bus;
+static uint8_t xfer_next;
+
+/* A command wrapped in another (by a gather or a batch) runs on a copy of
+   its frame in here.  The received frame itself may be shared with other
+   layers, such as the gateway's queue for the bus, so it's never changed. */
+static uint8_t wrap_rxbuf[SRIC_HEADER_SIZE + MAX_PAYLOAD];
+
+#if SRIC_CLIENT_BATCH
+/* Each command of a batch responds in here, and its response is copied
+   into the batch's if it fits */
+static uint8_t batch_txbuf[SRIC_HEADER_SIZE + MAX_PAYLOAD];
+#endif
+
+/* The groups joined with SRIC_SYSCMD_GROUP (bit n for SRIC_GROUP(n)).
+   The board's in the same groups on all of its buses. */
+static uint16_t groups = 0;
+
 static volatile bool delay_flag = false;
 
 static bool delay_cb( void *dummy __attribute__((unused)))
@@ -61,8 +160,11 @@ void insert_enum_delay( void )
 {
 	sched_add(&delay_task);
 
-	while (delay_flag == false)
-		;
+	while (delay_flag == false) {
+		/* If the WDT is in use we need to reset it here */
+		if ((WDTCTL & WDTHOLD) == 0)
+			WDTCTL = WDTPW | WDTCNTCL;
+	}
 
 	delay_flag = false;
 	return;
@@ -70,37 +172,152 @@ void insert_enum_delay( void )
 
 #define NUM_SYSCMDS ( sizeof(syscmds) / sizeof(*syscmds) )
 
-#define is_syscmd(x) ( x & 0x80 )
-#define syscmd_num(x) ( x & ~0x80 )
+#define is_syscmd(x) ( x & SRIC_SYSCMD_FLAG )
+#define syscmd_num(x) ( x & ~SRIC_SYSCMD_FLAG )
+
+/* System commands that come thick and fast, and don't need the pause
+   that enumeration does */
+#define syscmd_quick(x) ( x == SRIC_SYSCMD_XFER || x == SRIC_SYSCMD_BATCH \
+			  || x == SRIC_SYSCMD_REG_READ			\
+			  || x == SRIC_SYSCMD_REG_WRITE )
 
 void sric_client_init( void )
 {
 
 }
 
-static uint8_t invoke( const sric_cmd_t *cmd, const sric_if_t *iface )
+/* Whether we're in the group with address addr */
+static bool group_member( uint8_t addr )
 {
-	uint8_t len = cmd->cmd( iface );
+	uint8_t n = addr - SRIC_GROUP_BASE;
 
-	/* Return immediately if a special error code was returned; however
-	 * don't count the SRIC_RESPOND_NOW flag */
-	if ((len & ~SRIC_RESPOND_NOW) >= SRIC_SPECIAL_RET_LIMIT)
-		return len;
+	return n == sric_client_conf.devclass || (groups & (1u << n));
+}
 
+/* Fill in the header of the response, for which len bytes of data are
+   in txbuf (len may include SRIC_RESPOND_NOW) */
+static uint8_t respond( const sric_if_t *iface, uint8_t len )
+{
 	uint8_t const *rxbuf = iface->rxbuf;
 
 	iface->txbuf[0] = 0x7e;
-	iface->txbuf[SRIC_DEST] = rxbuf[SRIC_SRC];
-	iface->txbuf[SRIC_SRC] = sric_addr;
+	iface->txbuf[SRIC_DEST] = sric_frame_src(rxbuf);
+	iface->txbuf[SRIC_SRC] = *iface->addr;
 	iface->txbuf[SRIC_LEN] = len & ~SRIC_RESPOND_NOW;
 	sric_frame_set_ack(iface->txbuf);
 
+	if( sric_frame_is_prio(rxbuf) ) {
+		/* The master is holding the token for our response */
+		sric_frame_set_prio(iface->txbuf);
+		len |= SRIC_RESPOND_NOW;
+	}
+
 	return len + SRIC_HEADER_SIZE;
 }
 
 /* TODO: Add a standard mechanism for returning error */
 #define SRIC_CLIENT_INV_CMD SRIC_IGNORE
 
+/* Whether cmd's table entry says it takes requests of LEN len */
+static bool cmd_takes( const sric_cmd_t *cmd, uint8_t len )
+{
+	return !cmd->max_len || (len >= cmd->min_len && len <= cmd->max_len);
+}
+
+/* Run a command, if the request's one that its table entry says it takes */
+static uint8_t run( const sric_cmd_t *cmd, const sric_if_t *iface )
+{
+	const uint8_t dest = iface->rxbuf[SRIC_DEST];
+	uint8_t l;
+
+	if( cmd_takes( cmd, iface->rxbuf[SRIC_LEN] ) ) {
+		l = cmd->cmd( iface );
+
+		/* Nothing at all rather than more than the table promised,
+		   which a batch counted on */
+		if( cmd->max_len && (l & ~SRIC_RESPOND_NOW) > cmd->resp_max
+		    && (l & ~SRIC_RESPOND_NOW) < SRIC_SPECIAL_RET_LIMIT )
+			l &= SRIC_RESPOND_NOW;
+	} else if( dest == 0 || sric_addr_is_group(dest) ) {
+		/* Nobody's waiting on an answer from us in particular */
+		return SRIC_IGNORE;
+	} else {
+		/* Refuse it with an empty response, rather than leave the
+		   sender to time out */
+		l = 0;
+	}
+
+	if( (cmd->flags & SRIC_CMD_F_RESPOND_NOW)
+	    && (l & ~SRIC_RESPOND_NOW) < SRIC_SPECIAL_RET_LIMIT )
+		l |= SRIC_RESPOND_NOW;
+	return l;
+}
+
+static uint8_t invoke( const sric_cmd_t *cmd, const sric_if_t *iface )
+{
+	uint8_t len = run( cmd, iface );
+
+	/* Return immediately if a special error code was returned; however
+	 * don't count the SRIC_RESPOND_NOW flag */
+	if ((len & ~SRIC_RESPOND_NOW) >= SRIC_SPECIAL_RET_LIMIT)
+		return len;
+
+	return respond( iface, len );
+}
+
+/* The cache entry for peer addr on iface's bus, or the one it's to
+   replace */
+static resp_cache_t *resp_cache_find( const sric_if_t *iface, uint8_t addr )
+{
+	uint8_t i;
+
+	for( i=0; i<SRIC_CLIENT_RESP_CACHE; i++ )
+		if( resp_cache[i].addr == addr && resp_cache[i].bus == iface->addr )
+			return resp_cache + i;
+
+	return resp_cache + resp_cache_next;
+}
+
+/* Invoke a command sent to us alone, or answer a retransmission of one
+   that's already been invoked */
+static uint8_t invoke_cached( const sric_cmd_t *cmd, const sric_if_t *iface )
+{
+	const uint8_t src = sric_frame_src( iface->rxbuf );
+	resp_cache_t *c = resp_cache_find( iface, src );
+	uint8_t len;
+
+	/* Without a sequence number, a retransmission can't be told from
+	   the same command sent again */
+	if( (cmd->flags & SRIC_CMD_F_IDEMPOTENT) || !iface->rx_has_seq )
+		return invoke( cmd, iface );
+
+	if( c->addr == src && c->bus == iface->addr
+	    && c->seq == iface->rx_seq && iface->rx_retx ) {
+		memcpy( iface->txbuf + SRIC_DATA, c->data,
+			c->len & ~SRIC_RESPOND_NOW );
+		return respond( iface, c->len );
+	}
+
+	if( c->addr != src || c->bus != iface->addr ) {
+		/* Take over the oldest entry */
+		resp_cache_next = (resp_cache_next + 1) % SRIC_CLIENT_RESP_CACHE;
+		c->addr = src;
+		c->bus = iface->addr;
+	}
+	c->seq = iface->rx_seq;
+
+	len = run( cmd, iface );
+	if ((len & ~SRIC_RESPOND_NOW) >= SRIC_SPECIAL_RET_LIMIT) {
+		/* Nothing to send again */
+		c->addr = 0;
+		return len;
+	}
+
+	c->len = len;
+	memcpy( c->data, iface->txbuf + SRIC_DATA, len & ~SRIC_RESPOND_NOW );
+	return respond( iface, len );
+}
+
 uint8_t sric_client_rx( const sric_if_t *iface )
 {
 	uint8_t const *rxbuf = iface->rxbuf;
@@ -115,6 +332,11 @@ uint8_t sric_client_rx( const sric_if_t *iface )
 	if( dest == 0 && is_syscmd(cmd) ) {
 		uint8_t sys = syscmd_num(cmd);
 
+		/* Not part of enumeration, so there's no need to pause, and
+		   it forms its own response */
+		if ( len > 0 && sys == SRIC_SYSCMD_GATHER )
+			return syscmd_gather( iface );
+
 		if ( len > 0 && sys < NUM_SYSCMDS ) {
 			insert_enum_delay();
 			return invoke( syscmds + sys, iface );
@@ -126,22 +348,37 @@ uint8_t sric_client_rx( const sric_if_t *iface )
 	if( len == 0 )
 		return SRIC_CLIENT_INV_CMD;
 
-	if( dest != sric_addr || sric_frame_is_ack( rxbuf ) )
+	/* Group: */
+	if( sric_addr_is_group(dest) ) {
+		if( *iface->addr == 0 || !group_member(dest) )
+			return SRIC_IGNORE;
+
+		if( cmd == (SRIC_SYSCMD_FLAG | SRIC_SYSCMD_GATHER) )
+			return syscmd_gather( iface );
+
+		/* The whole group acts on it at once, so nobody answers */
+		if( !is_syscmd(cmd) && cmd < sric_cmd_num )
+			run( sric_commands + cmd, iface );
+		return SRIC_IGNORE;
+	}
+
+	if( dest != *iface->addr || sric_frame_is_ack( rxbuf ) )
 		return SRIC_IGNORE;
 
 	if( is_syscmd(cmd) ) {
 		uint8_t sys = syscmd_num(cmd);
 
 		if ( sys < NUM_SYSCMDS ) {
-			insert_enum_delay();
-			return invoke( syscmds + sys, iface );
+			if( !syscmd_quick(sys) )
+				insert_enum_delay();
+			return invoke_cached( syscmds + sys, iface );
 		} else {
 			return SRIC_CLIENT_INV_CMD;
 		}
 	}
 
 	if( cmd < sric_cmd_num )
-		return invoke( sric_commands + cmd, iface );
+		return invoke_cached( sric_commands + cmd, iface );
 
 	return SRIC_CLIENT_INV_CMD;
 }
@@ -149,9 +386,18 @@ uint8_t sric_client_rx( const sric_if_t *iface )
 /* Reset the device, move into enumeration mode */
 static uint8_t syscmd_reset( const sric_if_t *iface )
 {
+	uint8_t i;
+
 	/* Reset the SRIC device -- entering enumeration mode */
 	iface->ctl( SRIC_CTL_RESET );
 
+	/* Whoever on this bus sent what's in the cache may have been reset
+	   too */
+	for( i=0; i<SRIC_CLIENT_RESP_CACHE; i++ )
+		if( resp_cache[i].bus == iface->addr )
+			resp_cache[i].addr = 0;
+
+	groups = 0;
 	return SRIC_IGNORE;
 }
 
@@ -175,8 +421,8 @@ static uint8_t syscmd_enum_tok_advance( const sric_if_t *iface )
 static uint8_t syscmd_addr_assign( const sric_if_t *iface )
 {
 	/* Check that we have the token */
-	if( sric_conf.token_drv->have_token() ) {
-		sric_addr = iface->rxbuf[SRIC_DATA + 1];
+	if( iface->token_drv->have_token() ) {
+		*iface->addr = iface->rxbuf[SRIC_DATA + 1];
 
 		/* Transmit device info */
 		return syscmd_addr_info(iface);
@@ -193,3 +439,325 @@ static uint8_t syscmd_addr_info( const sric_if_t *iface )
 
 	return 1;
 }
+
+/* Send reply containing the token timing statistics */
+static uint8_t syscmd_tok_stats( const sric_if_t *iface )
+{
+	token_stats_t *stats = iface->token_drv->stats;
+
+	token_stats_pack( stats, iface->txbuf + SRIC_DATA );
+
+	/* A non-zero argument clears the statistics once they've been read */
+	if( iface->rxbuf[SRIC_LEN] > 1 && iface->rxbuf[SRIC_DATA + 1] ) {
+		dint();
+		token_stats_reset( stats );
+		eint();
+	}
+
+	return TOKEN_STATS_PACKED_LEN;
+}
+
+/* Report the supported framings, or switch framing */
+static uint8_t syscmd_framing( const sric_if_t *iface )
+{
+	if( iface->rxbuf[SRIC_LEN] > 1 ) {
+		/* The interface switches once this frame's been dealt with */
+		iface->set_framing( iface->rxbuf[SRIC_DATA + 1] );
+
+		/* Everyone's being told, so nobody answers */
+		if( iface->rxbuf[SRIC_DEST] == 0 )
+			return SRIC_IGNORE;
+		return 0;
+	}
+
+	iface->txbuf[SRIC_DATA] = (1 << SRIC_FRAMING_NUM) - 1;
+	return 1;
+}
+
+/* Report the fastest baud rate supported, or switch rate */
+static uint8_t syscmd_baud( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	uint8_t *d = iface->txbuf + SRIC_DATA;
+	uint32_t baud;
+
+	if( iface->rxbuf[SRIC_LEN] >= 5 ) {
+		baud = data[1] | (uint32_t)data[2] << 8
+			| (uint32_t)data[3] << 16 | (uint32_t)data[4] << 24;
+		iface->set_baud( baud );
+
+		if( iface->rxbuf[SRIC_DEST] == 0 )
+			return SRIC_IGNORE;
+		return 0;
+	}
+
+	baud = iface->baud_max;
+	d[0] = baud & 0xff;
+	d[1] = (baud >> 8) & 0xff;
+	d[2] = (baud >> 16) & 0xff;
+	d[3] = (baud >> 24) & 0xff;
+	return 4;
+}
+
+/* Receive a windowed transfer */
+static uint8_t syscmd_xfer( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	const uint8_t len = iface->rxbuf[SRIC_LEN];
+	const uint8_t src = sric_frame_src( iface->rxbuf );
+	uint8_t window;
+
+	if( iface->rxbuf[SRIC_DEST] == 0 )
+		return SRIC_IGNORE;
+
+	switch( data[1] ) {
+	case SRIC_XFER_START:
+		window = data[2];
+		if( window > sric_client_conf.xfer_window )
+			window = sric_client_conf.xfer_window;
+		if( window > SRIC_XFER_WINDOW_MAX )
+			window = SRIC_XFER_WINDOW_MAX;
+
+		xfer_src = window ? src : 0;
+		xfer_bus = iface->addr;
+		xfer_next = 0;
+		if( window && sric_client_conf.xfer_start != NULL )
+			sric_client_conf.xfer_start();
+
+		iface->txbuf[SRIC_DATA] = window;
+		return 1;
+
+	case SRIC_XFER_DATA:
+	case SRIC_XFER_DATA_ACK:
+		if( src == xfer_src && iface->addr == xfer_bus
+		    && data[2] == xfer_next ) {
+			xfer_next++;
+			sric_client_conf.xfer_rx( data + 3, len - 3 );
+		}
+
+		if( data[1] == SRIC_XFER_DATA )
+			return SRIC_IGNORE;
+
+		iface->txbuf[SRIC_DATA] = xfer_next;
+		return 1;
+	}
+
+	return SRIC_IGNORE;
+}
+
+/* Answer a collective read.  Returns the whole response, as it answers
+   with the header of the command it wraps (so it's not to go through
+   invoke()). */
+static uint8_t syscmd_gather( const sric_if_t *iface )
+{
+	const uint8_t *rxbuf = iface->rxbuf;
+	const uint8_t len = rxbuf[SRIC_LEN];
+	const sric_cmd_t *c;
+	sric_if_t sub = *iface;
+	uint8_t cmd, l;
+
+	/* Broadcasts, and groups we're in (which sric_client_rx checked) */
+	if( len < 2 || *iface->addr == 0
+	    || (rxbuf[SRIC_DEST] != 0 && !sric_addr_is_group(rxbuf[SRIC_DEST])) )
+		return SRIC_IGNORE;
+
+	cmd = rxbuf[SRIC_DATA + 1];
+	if( is_syscmd(cmd) ) {
+		if( syscmd_num(cmd) >= NUM_SYSCMDS
+		    || syscmd_num(cmd) == SRIC_SYSCMD_GATHER )
+			return SRIC_IGNORE;
+		c = syscmds + syscmd_num(cmd);
+	} else if( cmd < sric_cmd_num )
+		c = sric_commands + cmd;
+	else
+		return SRIC_IGNORE;
+
+	/* Leave our command byte out of the copy, so that the command sees
+	   the frame that it would have been sent alone */
+	memcpy( wrap_rxbuf, rxbuf, SRIC_DATA );
+	memcpy( wrap_rxbuf + SRIC_DATA, rxbuf + SRIC_DATA + 1, len - 1 );
+	sub.rxbuf = wrap_rxbuf;
+	sub.rxbuf[SRIC_LEN] = len - 1;
+	/* Everyone answers in token order, so none may hold it up */
+	sub.rxbuf[SRIC_SRC] &= ~SRIC_SRC_PRIO;
+
+	l = run( c, &sub );
+	if ((l & ~SRIC_RESPOND_NOW) >= SRIC_SPECIAL_RET_LIMIT)
+		return l & ~SRIC_RESPOND_NOW;
+
+	return respond( &sub, l & ~SRIC_RESPOND_NOW );
+}
+
+/* Report the groups joined, or join others */
+static uint8_t syscmd_group( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	uint16_t g;
+
+	/* Joining a group's up to each board alone */
+	if( iface->rxbuf[SRIC_DEST] != *iface->addr )
+		return SRIC_IGNORE;
+
+	if( iface->rxbuf[SRIC_LEN] >= 3 )
+		groups = data[1] | ((uint16_t)data[2] << 8);
+
+	g = groups;
+	if( sric_client_conf.devclass < SRIC_GROUP_NUM )
+		g |= 1u << sric_client_conf.devclass;
+
+	iface->txbuf[SRIC_DATA] = g & 0xff;
+	iface->txbuf[SRIC_DATA + 1] = g >> 8;
+	return 2;
+}
+
+/* Run a batch of board commands */
+static uint8_t syscmd_batch( const sric_if_t *iface )
+{
+#if SRIC_CLIENT_BATCH
+	const uint8_t *rxbuf = iface->rxbuf;
+	const uint8_t len = rxbuf[SRIC_LEN];
+	uint8_t *out = iface->txbuf + SRIC_DATA;
+	const sric_cmd_t *c;
+	sric_if_t sub = *iface;
+	uint8_t pos = 1, o = 0, n, cmd, l;
+
+	/* Batches are only for one board: a broadcast one would have
+	   everyone answer with the lot */
+	if( rxbuf[SRIC_DEST] != *iface->addr )
+		return SRIC_IGNORE;
+
+	sub.rxbuf = wrap_rxbuf;
+	sub.txbuf = batch_txbuf;
+	memcpy( wrap_rxbuf, rxbuf, SRIC_DATA );
+
+	while( pos < len ) {
+		n = rxbuf[SRIC_DATA + pos];
+		if( n == 0 || pos + 1 + n > len )
+			break;
+
+		/* The record's command gets a frame of its own, with the
+		   batch's header and the record's n for its LEN */
+		wrap_rxbuf[SRIC_LEN] = n;
+		memcpy( wrap_rxbuf + SRIC_DATA, rxbuf + SRIC_DATA + pos + 1, n );
+
+		cmd = sub.rxbuf[SRIC_DATA];
+		l = SRIC_IGNORE;
+		if( !is_syscmd(cmd) && cmd < sric_cmd_num ) {
+			c = sric_commands + cmd;
+
+			/* Don't run it if its response mightn't fit */
+			if( c->max_len && o + 1 + c->resp_max > MAX_PAYLOAD )
+				break;
+			if( cmd_takes( c, n ) )
+				l = run( c, &sub ) & ~SRIC_RESPOND_NOW;
+		}
+
+		if( l >= SRIC_SPECIAL_RET_LIMIT ) {
+			if( o + 1 > MAX_PAYLOAD )
+				break;
+			out[o++] = SRIC_BATCH_NONE;
+		} else {
+			if( o + 1 + l > MAX_PAYLOAD )
+				break;
+			out[o++] = l;
+			memcpy( out + o, batch_txbuf + SRIC_DATA, l );
+			o += l;
+		}
+
+		pos += 1 + n;
+	}
+
+	return o;
+#else
+	return SRIC_IGNORE;
+#endif
+}
+
+/* Describe a range of registers */
+static uint8_t syscmd_reg_info( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	const sric_reg_t *reg;
+	uint8_t r, n, o = 0;
+
+	for( r = data[1], n = data[2];
+	     n && r < sric_client_conf.reg_num && o < MAX_PAYLOAD; r++, n-- ) {
+		reg = sric_client_conf.regs + r;
+		iface->txbuf[SRIC_DATA + o++] = reg->size
+			| (reg->writable ? SRIC_REG_WRITABLE : 0);
+	}
+
+	return o;
+}
+
+/* Read a range of registers */
+static uint8_t syscmd_reg_read( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	uint8_t *out = iface->txbuf + SRIC_DATA;
+	const sric_reg_t *reg;
+	uint8_t r, n, o = 0;
+
+	for( r = data[1], n = data[2];
+	     n && r < sric_client_conf.reg_num; r++, n-- ) {
+		reg = sric_client_conf.regs + r;
+		if( o + reg->size > MAX_PAYLOAD )
+			break;
+
+		/* Interrupt handlers may update it */
+		dint();
+		memcpy( out + o, reg->p, reg->size );
+		eint();
+		o += reg->size;
+	}
+
+	return o;
+}
+
+/* Write a range of registers */
+static uint8_t syscmd_reg_write( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+	const uint8_t len = iface->rxbuf[SRIC_LEN];
+	const sric_reg_t *reg;
+	uint8_t r, pos = 2, n = 0;
+	bool changed;
+
+	for( r = data[1]; pos < len && r < sric_client_conf.reg_num; r++ ) {
+		reg = sric_client_conf.regs + r;
+		if( !reg->writable || pos + reg->size > len )
+			break;
+
+		dint();
+		changed = memcmp( reg->p, data + pos, reg->size ) != 0;
+		memcpy( reg->p, data + pos, reg->size );
+		eint();
+
+		if( changed && reg->changed != NULL )
+			reg->changed( r );
+
+		pos += reg->size;
+		n++;
+	}
+
+	iface->txbuf[SRIC_DATA] = n;
+	return 1;
+}
+
+/* Report that we take sequence bytes, or start or stop sending them */
+static uint8_t syscmd_seq( const sric_if_t *iface )
+{
+	const uint8_t *data = iface->rxbuf + SRIC_DATA;
+
+	if( iface->rxbuf[SRIC_LEN] >= 2 ) {
+		iface->ctl( data[1] ? SRIC_CTL_SEQ_ON : SRIC_CTL_SEQ_OFF );
+
+		/* Broadcast; nobody answers */
+		if( iface->rxbuf[SRIC_DEST] == 0 )
+			return SRIC_IGNORE;
+		return 0;
+	}
+
+	iface->txbuf[SRIC_DATA] = 1;
+	return 1;
+}
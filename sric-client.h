@@ -4,6 +4,21 @@
 #include "sric-if.h"
 #include "sric.h"
 
+/* Number of peers whose last response is kept, to answer retransmissions
+   of the command it was for without acting on it again.  Only commands
+   with sequence bytes (SRIC_SYSCMD_SEQ) are kept.  They're shared by
+   all of the board's buses.  Each costs MAX_PAYLOAD + 3 bytes, and a
+   pointer. */
+#ifndef SRIC_CLIENT_RESP_CACHE
+#define SRIC_CLIENT_RESP_CACHE 2
+#endif
+
+/* Whether the board takes batches of commands (SRIC_SYSCMD_BATCH).  They
+   cost MAX_PAYLOAD + 4 bytes, for each command to respond into. */
+#ifndef SRIC_CLIENT_BATCH
+#define SRIC_CLIENT_BATCH 1
+#endif
+
 /* Classes of boards */
 typedef enum {
 	SRIC_CLASS_MASTER,
@@ -14,8 +29,32 @@ typedef enum {
 	SRIC_CLASS_PCSRIC,
 } sric_class_t;
 
+/* A register, for the generic register commands (SRIC_SYSCMD_REG_*).
+   Its number is its index in the board's table. */
+typedef struct {
+	/* Where its value's kept, and its size (at most MAX_PAYLOAD) */
+	void *p;
+	uint8_t size;
+	/* Whether it may be written */
+	bool writable;
+	/* Called when a write changes its value (if not NULL) */
+	void (*changed) ( uint8_t reg );
+} sric_reg_t;
+
 typedef struct {
 	sric_class_t devclass;
+
+	/* Most frames of a windowed transfer (SRIC_SYSCMD_XFER) to take in
+	   flight at once, or 0 if the board doesn't take transfers */
+	uint8_t xfer_window;
+	/* Called when a transfer starts, and then with the data of each of
+	   its frames, in order */
+	void (*xfer_start) ( void );
+	void (*xfer_rx) ( const uint8_t *data, uint8_t len );
+
+	/* The board's registers (NULL if it has none), and how many */
+	const sric_reg_t *regs;
+	uint8_t reg_num;
 } sric_client_conf_t;
 
 extern const sric_client_conf_t sric_client_conf;
@@ -27,8 +66,39 @@ typedef struct {
 	   return the number of bytes placed in that section.
 	   (This will be transmitted as a response). */
 	uint8_t (*cmd) ( const sric_if_t *iface );
+
+	/* The LENs (so counting the command byte) of the requests it takes.
+	   cmd's never called for others: one sent to the board alone gets
+	   an empty response, and the rest are dropped.  An entry with
+	   max_len 0 (as a bare { fn } has) takes anything.  Use SRIC_CMD()
+	   to fill these in. */
+	uint8_t min_len, max_len;
+	/* The most data its response has.  A longer one is sent as an empty
+	   response instead. */
+	uint8_t resp_max;
+	/* SRIC_CMD_F_* */
+	uint8_t flags;
 } sric_cmd_t;
 
+/* Send the response without waiting for the token */
+#define SRIC_CMD_F_RESPOND_NOW 1
+/* Running it again does no harm, so a retransmission of it is run again
+   rather than answered from the response cache (leaving the cache to
+   commands that need it) */
+#define SRIC_CMD_F_IDEMPOTENT 2
+
+/* 0, or a compile error if x is false */
+#define SRIC_CMD_CHECK(x) ( 0 * sizeof(char[(x) ? 1 : -1]) )
+
+/* A command table entry for fn, which takes requests with LENs from min
+   to max and responds with at most resp bytes.  Limits that can't be
+   right don't compile. */
+#define SRIC_CMD( fn, min, max, resp, flags )				\
+	{ fn, (min), (max) + SRIC_CMD_CHECK( 1 <= (min) && (min) <= (max) \
+					     && (max) <= MAX_PAYLOAD	\
+					     && (resp) <= MAX_PAYLOAD ), \
+	  (resp), (flags) }
+
 /* The command table -- obviously specific to each device */
 extern const sric_cmd_t sric_commands[];
 /* Number of commands */
@@ -0,0 +1,306 @@
+#ifndef __SRIC_FRAME_H
+#define __SRIC_FRAME_H
+/* SRIC frame format, as used on the bus and between the gateway and host.
+   Nothing in here depends on the MSP430, so that host software can be
+   built against it too.
+
+   A frame is:
+     [delimiter] [DEST] [SRC] [LEN] [DATA x LEN] [CRC16 lo] [CRC16 hi]
+   The CRC covers everything before it, delimiter included.  Every byte
+   after the delimiter that's a delimiter or SRIC_FRAME_ESC is sent as
+   SRIC_FRAME_ESC followed by the byte XORed with SRIC_FRAME_ESC_XOR.
+
+   That's SRIC_FRAMING_ESCAPE, which every node starts in.  Escaping
+   doubles the size of data full of delimiters, and costs an intr a
+   varying amount per byte.  The alternative, SRIC_FRAMING_COBS, sends
+   the frame (delimiter and CRC included, and unescaped) COBS-encoded
+   (see cobs.h), between two 0x00s:
+     [0x00] [COBS(frame)] [0x00]
+   which is two bytes more than the frame, plus one per 254 bytes, whatever
+   is in it.  A bus is switched with SRIC_SYSCMD_FRAMING, and the host
+   link with GW_CMD_FRAMING. */
+#include <stdint.h>
+
+#define MAX_PAYLOAD 64
+#define MAX_FRAME_LEN (MAX_PAYLOAD + 6)
+
+/* Start of a bus frame */
+#define SRIC_FRAME_DELIM 0x7E
+/* Start of a frame between the host and gateway itself */
+#define SRIC_FRAME_GW_DELIM 0x8E
+#define SRIC_FRAME_ESC 0x7D
+#define SRIC_FRAME_ESC_XOR 0x20
+
+/* Framings */
+enum {
+	SRIC_FRAMING_ESCAPE,
+	SRIC_FRAMING_COBS,
+	SRIC_FRAMING_NUM
+};
+
+/* Offsets of fields in the tx buffer */
+enum {
+	SRIC_DEST = 1,
+	SRIC_SRC = 2,
+	SRIC_LEN = 3,
+	SRIC_DATA = 4
+	/* CRC is last two bytes */
+};
+
+/* The number of bytes in a SRIC header */
+#define SRIC_HEADER_SIZE 4
+
+/* The number of bytes in the header and footer of a SRIC frame */
+#define SRIC_OVERHEAD (SRIC_HEADER_SIZE + 2)
+
+#define sric_addr_set_ack(x) (x | 0x80)
+#define sric_addr_is_ack(x) ( x & 0x80 )
+#define sric_frame_is_ack(buf) ( sric_addr_is_ack(buf[SRIC_DEST]) )
+#define sric_frame_set_ack(buf) do { buf[SRIC_DEST] = sric_addr_set_ack(buf[SRIC_DEST]); } while (0)
+
+/* Group (multicast) addresses.  A frame sent to one reaches every board
+   in the group, none of which answer it unless it's a SRIC_SYSCMD_GATHER.
+   Every board is in group n for its class n (the sric_class_t that
+   SRIC_SYSCMD_ADDR_INFO reports), and joins others with
+   SRIC_SYSCMD_GROUP.  Boards are never given these addresses. */
+#define SRIC_GROUP_BASE 0x70
+#define SRIC_GROUP_NUM 16
+#define SRIC_GROUP(n) ( SRIC_GROUP_BASE + (n) )
+#define sric_addr_is_group(x) ( (x) >= SRIC_GROUP_BASE && (x) < SRIC_GROUP_BASE + SRIC_GROUP_NUM )
+
+/* High priority frames have the top bit of the source address set.
+   A priority command is sent at the front of the master's queue, and the
+   master keeps hold of the token after sending it so that the response
+   can be sent back immediately. */
+#define SRIC_SRC_PRIO 0x80
+#define sric_frame_is_prio(buf) ( buf[SRIC_SRC] & SRIC_SRC_PRIO )
+#define sric_frame_set_prio(buf) do { buf[SRIC_SRC] |= SRIC_SRC_PRIO; } while (0)
+#define sric_frame_src(buf) ( buf[SRIC_SRC] & ~SRIC_SRC_PRIO )
+
+/* LEN is never more than MAX_PAYLOAD, so its top bit is spare.  It's set
+   in commands that carry a sequence byte, between the data (which LEN
+   still counts alone) and the CRC, which covers it.  The byte holds the
+   sender's sequence number for the command, which counts up with each
+   new command it sends to anyone, and SRIC_SEQ_RETX if this is a
+   retransmission.  A board that acted on the original (but whose
+   response was lost) sends the same response again rather than act
+   twice.  Firmware that predates sequence bytes drops these frames, so
+   nodes only add them once told to (see SRIC_SYSCMD_SEQ).  Only the
+   bus's frames ever have them. */
+#define SRIC_LEN_SEQ 0x80
+#define sric_frame_len(buf) ( buf[SRIC_LEN] & ~SRIC_LEN_SEQ )
+/* Number of bytes between the frame's data and its CRC */
+#define sric_frame_seq_len(buf) ( (buf[SRIC_LEN] & SRIC_LEN_SEQ) ? 1 : 0 )
+
+#define SRIC_SEQ_RETX 0x80
+#define SRIC_SEQ_MASK 0x7f
+
+/* Command bytes with the top bit set are system commands */
+#define SRIC_SYSCMD_FLAG 0x80
+
+/* System command constants */
+enum {
+	SRIC_SYSCMD_RESET,
+	SRIC_SYSCMD_TOK_ADVANCE,
+	SRIC_SYSCMD_ADDR_ASSIGN,
+	SRIC_SYSCMD_ADDR_INFO,
+	SRIC_SYSCMD_VERSION_BUF,
+	/* Read (and optionally clear) the token timing statistics */
+	SRIC_SYSCMD_TOK_STATS,
+	/* With no argument, reply with a bitmask of the framings supported
+	   (bit n for framing n).  With one (a broadcast), switch to that
+	   framing once the frame's been handled.  Only send it with the bus
+	   otherwise quiet, and give nodes a few ticks to switch before the
+	   next frame.  A reset returns nodes to SRIC_FRAMING_ESCAPE. */
+	SRIC_SYSCMD_FRAMING,
+	/* With no argument, reply with the fastest baud rate supported (32
+	   bits, little-endian), or 0 if it can't be changed.  With one (a
+	   broadcast, in the same form), switch to that rate, in the same way
+	   as SRIC_SYSCMD_FRAMING.  Nodes go back to the rate they started at
+	   on reset, or if they see too many receive errors. */
+	SRIC_SYSCMD_BAUD,
+	/* A windowed transfer to the board (see SRIC_XFER_START) */
+	SRIC_SYSCMD_XFER,
+	/* A collective read: a broadcast of [SRIC_SYSCMD_GATHER] [cmd]
+	   [args...], which every board that has an address answers as if it
+	   had been sent [cmd] [args...] alone.  Each answers as the token
+	   reaches it, so the answers arrive one after another in a single
+	   trip of the token round the bus.  cmd may be a board command or a
+	   system command (other than this one), and should only read: the
+	   sender can't tell which boards heard it.  Never a priority
+	   command.  Sent to a group address rather than 0, only the
+	   group's boards answer. */
+	SRIC_SYSCMD_GATHER,
+	/* With no argument, reply with the groups the board's in (16 bits,
+	   little-endian, bit n for SRIC_GROUP(n)).  With one (in the same
+	   form), join those groups and leave the rest, other than its
+	   class's, then reply in the same way.  A reset leaves them all. */
+	SRIC_SYSCMD_GROUP,
+	/* Several board commands in one frame (see SRIC_BATCH_NONE) */
+	SRIC_SYSCMD_BATCH,
+	/* The board's registers, numbered from 0 (see sric_reg_t).
+	   [first] [count]: reply with a byte for each of count registers
+	   from first: its size, with SRIC_REG_WRITABLE set if it can be
+	   written.  Stops at the board's last register. */
+	SRIC_SYSCMD_REG_INFO,
+	/* [first] [count]: reply with the values of count registers from
+	   first, one after another, each as the board stores it
+	   (little-endian, on the MSP430).  Stops at the last register, or
+	   before the first that won't fit. */
+	SRIC_SYSCMD_REG_READ,
+	/* [first] [values...]: write the values, in the same form, to the
+	   registers from first on.  Stops at one that can't be written, or
+	   whose value isn't all there.  Replies with the number written. */
+	SRIC_SYSCMD_REG_WRITE,
+	/* With no argument, reply with 1: the board takes commands with
+	   sequence bytes (see SRIC_LEN_SEQ).  With one (a broadcast), start
+	   (non-zero) or stop adding them to the commands it sends, in the
+	   same way as SRIC_SYSCMD_FRAMING.  Only start them once every node
+	   on the bus has replied.  A reset stops them. */
+	SRIC_SYSCMD_SEQ,
+};
+
+#define SRIC_REG_WRITABLE 0x80
+
+/* A SRIC_SYSCMD_BATCH command is followed by records of
+     [n] [cmd] [args...]
+   where n counts cmd and its args.  The board runs each board command in
+   turn, as if it had been sent alone, and replies with a record of
+     [n] [response...]
+   for each, where n counts the response's bytes.  It's SRIC_BATCH_NONE
+   for a command that had nothing to send back (an unknown one, say, or
+   one whose record was the wrong length for it), and then no bytes
+   follow.  The reply ends early if the next response won't fit in it.
+   That command isn't run if the board knows how long its response can
+   be, and has still been run otherwise.  A record that runs past the end
+   of the frame ends the batch there.  System commands can't be batched. */
+#define SRIC_BATCH_NONE 0xff
+
+/* Windowed transfers move a stream of data to one board faster than a
+   command and response per frame would.  The second data byte of a
+   SRIC_SYSCMD_XFER command is one of these:
+     [SRIC_XFER_START] [window]
+         Start a transfer from the sender, with up to window frames in
+         flight.  Replies with the window that the board will take, at most
+         the one asked for; 0 if it doesn't take transfers.
+     [SRIC_XFER_DATA] [seq] [data...]
+         The next frame of data.  seq counts up from 0, wrapping at 256.
+         The board takes the frame if it's the one it's expecting, and
+         drops it otherwise.  No reply.
+     [SRIC_XFER_DATA_ACK] [seq] [data...]
+         The same, but replies with the seq of the frame that the board
+         expects next, which acknowledges everything before it.
+   The sender sends a window of SRIC_XFER_DATA frames, ending it with a
+   SRIC_XFER_DATA_ACK, then carries on from the frame that the board
+   expects next ("go-back-N").  The data frames are sent with
+   SRIC_CTL_KEEP_TOK, so that the whole window goes out in one go, and the
+   board replies the next time the token reaches it.  The ack isn't a
+   priority command, as that would put it ahead of the rest of the window
+   in the gateway's queue. */
+enum {
+	SRIC_XFER_START,
+	SRIC_XFER_DATA,
+	SRIC_XFER_DATA_ACK,
+};
+
+/* The largest window, which keeps seq unambiguous */
+#define SRIC_XFER_WINDOW_MAX 128
+/* Bytes of data a transfer frame carries */
+#define SRIC_XFER_PAYLOAD (MAX_PAYLOAD - 3)
+
+/* Commands from the host to the gateway itself, sent in the first data
+   byte of a SRIC_FRAME_GW_DELIM frame.  The gateway replies to each with
+   a SRIC_FRAME_GW_DELIM frame. */
+typedef enum {
+	/* Set whether the SRIC interface uses the token */
+	GW_CMD_USE_TOKEN,
+	/* Request the token (only use in tokenless mode) */
+	GW_CMD_REQ_TOKEN,
+	/* Query the token driver to determine if SRIC IF currently has the token */
+	GW_CMD_HAVE_TOKEN,
+	/* Generate the token */
+	GW_CMD_GEN_TOKEN,
+	/* Turn capture mode on (non-zero argument) or off.  The reply holds
+	   the rate the capture timestamps count at, in Hz (32 bits).
+	   In capture mode every frame from the bus, including responses to
+	   the host's commands, reaches the host only as a capture record. */
+	GW_CMD_CAPTURE,
+	/* Replace the forwarding filter with the entries in the arguments
+	   (see below).  With no entries, everything's forwarded. */
+	GW_CMD_FILTER,
+	/* Read the bus utilisation statistics (see bus_stats_pack), and
+	   start a new window if the argument's non-zero */
+	GW_CMD_BUS_STATS,
+	/* Switch the host link to the framing in the argument.  The reply
+	   (the framing now in use, which is unchanged if the argument isn't
+	   one the gateway supports) is sent in the old framing, and
+	   everything after it in the new one.  Nothing else should be in
+	   flight in either direction. */
+	GW_CMD_FRAMING,
+	/* Reply with the bus's baud rate, and the fastest the gateway
+	   supports (0 if it can't be changed), 32 bits each.  The rate's
+	   switched with SRIC_SYSCMD_BAUD broadcasts, which the gateway
+	   obeys too. */
+	GW_CMD_BUS_BAUD,
+} gw_cmd_t;
+
+/* The gateway's forwarding filter decides which frames from the bus go
+   to the host, as they are or as capture records.  A frame's forwarded
+   if it matches any entry.  Each entry is:
+     [DEST] [DEST mask] [SRC] [SRC mask] [CMD] [CMD mask]
+   and matches frames whose DEST, SRC and first data byte equal the
+   entry's in the bits that are set in the masks.  The ack and priority
+   bits are in DEST and SRC, so can be matched on too.  A frame without
+   data only matches entries with a CMD mask of 0.
+   Responses to the host's own commands are filtered like anything else,
+   so there should be an entry that lets them through. */
+enum {
+	GW_FILTER_DEST = 0,
+	GW_FILTER_DEST_MASK,
+	GW_FILTER_SRC,
+	GW_FILTER_SRC_MASK,
+	GW_FILTER_CMD,
+	GW_FILTER_CMD_MASK,
+	GW_FILTER_ENTRY_LEN
+};
+
+/* Maximum number of filter entries */
+#define GW_FILTER_MAX 8
+
+/* In capture mode, the gateway sends every frame it hears on the bus --
+   including those that fail their CRC -- as a capture record, rather than
+   as it is.  A capture record is a SRIC_FRAME_GW_DELIM frame without the
+   ack bit set in its DEST (which replies to gw_cmd_ts always have), with
+   data:
+     [time x 4] [flags] [DEST] [SRC] [LEN] [DATA x up to SRIC_CAP_MAX_DATA]
+   time is when the frame's delimiter arrived (32 bits, little-endian,
+   wrapping).  DEST to DATA are as received. */
+#define SRIC_CAP_HEADER 8
+#define SRIC_CAP_MAX_DATA (MAX_PAYLOAD - SRIC_CAP_HEADER)
+
+/* Offsets in a capture record's data */
+enum {
+	SRIC_CAP_TIME = 0,
+	SRIC_CAP_FLAGS = 4,
+	SRIC_CAP_FRAME = 5,
+};
+
+/* Capture record flags */
+/* The CRC was correct */
+#define SRIC_CAP_CRC_OK 1
+/* The frame's an ack */
+#define SRIC_CAP_ACK 2
+/* The frame's a priority frame */
+#define SRIC_CAP_PRIO 4
+/* The bus was in token mode, so the sender held the token */
+#define SRIC_CAP_TOKEN 8
+/* The gateway held the token when the frame started */
+#define SRIC_CAP_GW_TOKEN 16
+/* The frame's sequence byte had SRIC_SEQ_RETX set (the byte's left out
+   of the record, and SRIC_LEN_SEQ cleared in its LEN) */
+#define SRIC_CAP_RETX 32
+/* The frame had more data than would fit: only the first
+   SRIC_CAP_MAX_DATA bytes are present */
+#define SRIC_CAP_TRUNC 128
+
+#endif	/* __SRIC_FRAME_H */
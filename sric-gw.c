@@ -14,7 +14,7 @@
     along with this program; if not, write to the Free Software
     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 #include "sric-gw.h"
-#include <string.h>
+#include "frame-pool.h"
 
 #if SRIC_DIRECTOR
 #include "token-dir.h"
@@ -26,10 +26,6 @@
 typedef enum {
 	/* Received a frame from the host */
 	EV_HOST_RX,
-	/* Finished transmitting a frame to the host */
-	EV_HOST_TX_COMPLETE,
-	/* Received a frame from SRIC */
-	EV_SRIC_RX,
 	/* Finished transmitting a frame over SRIC */
 	EV_SRIC_TX_COMPLETE,
 	/* SRIC interface experienced an error */
@@ -41,37 +37,63 @@ typedef enum {
 	IH_TRANSMITTING_SRIC
 } inhost_state_t;
 
-typedef enum {
-	IS_IDLE,
-	IS_TRANSMITTING,
-	IS_FULL
-} insric_state_t;
-
 typedef enum {
 	DEV_IDLE,
 	DEV_WAITING
 } gwdev_state_t;
 
 static inhost_state_t gw_inhost_state;
-static insric_state_t gw_insric_state;
 static gwdev_state_t gw_dev_state;
 static volatile bool gw_dev_timed_out;
 
-static uint8_t gw_retxmit_buf[12];
+/* Whether bus frames go to the host as capture records */
+static bool gw_capture = false;
+
+/* Forwarding filter, as set by GW_CMD_FILTER.  Entries are laid out as
+   in the command. */
+static uint8_t gw_filter[GW_FILTER_MAX * GW_FILTER_ENTRY_LEN];
+static uint8_t gw_filter_len = 0;
+
+/* The local device's last command to the host, kept for retransmission */
+static uint8_t *gw_retxmit_frame = NULL;
+/* Its deadline (0 for none) and when it was sent, and the deadline for
+   the next command */
+static uint16_t gw_dev_deadline, gw_dev_start;
+static uint16_t gw_dev_deadline_next = 0;
+
+/* Frames from the host waiting to go out on the bus.
+   Each is a frame-pool frame that we hold a reference to.
+   Priority frames are sent before all others; otherwise frames are sent
+   in the order they arrived. */
+static struct {
+	uint8_t *frame;
+	/* Arrival order */
+	uint8_t seq;
+} gw_txq[GW_TXQ_LEN];
+static uint8_t gw_txq_seq;
+
+static void gw_txq_run( void );
+static bool gw_host_tx_ready( void );
+static void gw_host_tx( uint8_t *frame );
 
-static void gw_insric_fsm( gw_event_t event );
 static void gw_inhost_fsm( gw_event_t event );
 static void gw_sric_if_ctl( sric_ctl_t c );
 static void gw_sric_if_use_token( bool b );
+static void gw_sric_if_set_framing( uint8_t framing );
+static void gw_sric_if_set_baud( uint32_t baud );
 static void gw_sric_if_tx_lock( void );
 static void gw_sric_tx_cmd_start( uint8_t len, bool expect_resp );
+static void gw_sric_if_set_deadline( uint16_t ticks );
 static bool gw_dev_timeout( void *dummy );
 
 sric_if_t gw_sric_if = {
 	.ctl = gw_sric_if_ctl,
 	.use_token = gw_sric_if_use_token,
 	.tx_lock = gw_sric_if_tx_lock,
-	.tx_cmd_start = gw_sric_tx_cmd_start
+	.tx_cmd_start = gw_sric_tx_cmd_start,
+	.set_deadline = gw_sric_if_set_deadline,
+	.set_framing = gw_sric_if_set_framing,
+	.set_baud = gw_sric_if_set_baud,
 };
 
 const static sched_task_t gw_dev_retransmit = {
@@ -83,14 +105,39 @@ void sric_gw_init( void )
 {
 
 	gw_sric_if.txbuf = hostser_txbuf;
+	/* The gateway's node sits on the first bus */
+	gw_sric_if.addr = &sric_addr;
+	gw_sric_if.token_drv = sric_conf.token_drv;
+	gw_sric_if.baud_max = sric_conf.usart_set_baud != NULL ? sric_conf.baud_max : 0;
 }
 
 static void gw_sric_if_ctl ( sric_ctl_t c )
 {
 
+	/* The bus's nodes go back to escaping frames at the base rate on
+	   reset.  The bus interface only hears of the reset through us. */
+	if( c == SRIC_CTL_RESET ) {
+		sric_if.set_framing( SRIC_FRAMING_ESCAPE );
+		sric_if.set_baud( sric_conf.baud_base );
+	}
 	return;
 }
 
+static void gw_sric_if_set_framing( uint8_t framing )
+{
+
+	/* Framing broadcasts from the host are for the bus, which has
+	   already been handed the frame.  It switches once it's sent. */
+	sric_if.set_framing( framing );
+}
+
+static void gw_sric_if_set_baud( uint32_t baud )
+{
+
+	/* As for framing */
+	sric_if.set_baud( baud );
+}
+
 static void gw_sric_if_use_token ( bool b )
 {
 
@@ -108,7 +155,7 @@ static void gw_sric_if_tx_lock( void )
 {
 
 	/* While we have no free buffers or we're busy retransmitting, spin */
-	while ( gw_dev_state == DEV_WAITING || gw_insric_state == IS_FULL ) {
+	while ( gw_dev_state == DEV_WAITING || !gw_host_tx_ready() ) {
 		/* If the WDT is in use we need to reset it here */
 		if ((WDTCTL & WDTHOLD) == 0)
 			WDTCTL = WDTPW | WDTCNTCL; /* If the WDT is in use we need to reset it here */
@@ -123,35 +170,59 @@ static void gw_sric_if_tx_lock( void )
 static void gw_sric_tx_cmd_start( uint8_t len, bool expect_resp )
 {
 
-	if( gw_insric_state == IS_FULL && !expect_resp ) {
+	if( !gw_host_tx_ready() ) {
 		/* No space -> no joy */
 		return;
 	}
 
-	memcpy(gw_retxmit_buf, gw_sric_if.txbuf, 12);
-	gw_insric_fsm( EV_SRIC_RX );
-
 	if ( expect_resp ) {
+		/* Hang on to the frame for retransmission */
+		frame_unref( gw_retxmit_frame );
+		gw_retxmit_frame = gw_sric_if.txbuf;
+		frame_ref( gw_retxmit_frame );
+
 		gw_dev_state = DEV_WAITING;
 		gw_dev_timed_out = false;
+		gw_dev_deadline = gw_dev_deadline_next;
+		gw_dev_start = sched_time;
 		sched_add( &gw_dev_retransmit );
 	}
+	gw_dev_deadline_next = 0;
 
+	gw_host_tx( NULL );
 	return;
 }
 
+static void gw_sric_if_set_deadline( uint16_t ticks )
+{
+
+	gw_dev_deadline_next = ticks;
+}
+
 void sric_gw_poll()
 {
 
+	gw_txq_run();
+
 	if ( gw_dev_state == DEV_WAITING && gw_dev_timed_out ) {
-		if ( gw_insric_state == IS_FULL ) {
+		if ( gw_dev_deadline
+		     && sched_time_since( gw_dev_start ) >= gw_dev_deadline ) {
+			/* The host's too late: give up on the command */
+			gw_dev_state = DEV_IDLE;
+			gw_dev_timed_out = false;
+
+			frame_unref( gw_retxmit_frame );
+			gw_retxmit_frame = NULL;
+			return;
+		}
+
+		if ( hostser_tx_full() ) {
 			/* Can't retransmitt */
 			return;
 		}
 
-		/* Given gw_insric_state has a buffer free, we can queue */
-		memcpy(gw_sric_if.txbuf, gw_retxmit_buf, 12);
-		gw_insric_fsm( EV_SRIC_RX );
+		/* Given hostser has a slot free, we can queue */
+		gw_host_tx( gw_retxmit_frame );
 
 		gw_dev_timed_out = false;
 
@@ -160,28 +231,90 @@ void sric_gw_poll()
 	}
 }
 
+/* Queue a frame from the host for transmission on the bus */
+static bool gw_txq_add( uint8_t *frame )
+{
+	uint8_t i;
+
+	for( i=0; i<GW_TXQ_LEN; i++ )
+		if( gw_txq[i].frame == NULL ) {
+			frame_ref( frame );
+			gw_txq[i].frame = frame;
+			gw_txq[i].seq = gw_txq_seq++;
+			return true;
+		}
+
+	/* Queue's full */
+	return false;
+}
+
+/* Put the next queued frame on the bus, if the bus is free */
+static void gw_txq_run( void )
+{
+	uint8_t i, next = GW_TXQ_LEN;
+	uint8_t *frame;
+
+	if( gw_inhost_state == IH_TRANSMITTING_SRIC )
+		return;
+
+	for( i=0; i<GW_TXQ_LEN; i++ ) {
+		if( gw_txq[i].frame == NULL )
+			continue;
+
+		if( next == GW_TXQ_LEN ) {
+			next = i;
+			continue;
+		}
+
+		if( sric_frame_is_prio(gw_txq[i].frame)
+		    != sric_frame_is_prio(gw_txq[next].frame) ) {
+			/* Priority wins */
+			if( sric_frame_is_prio(gw_txq[i].frame) )
+				next = i;
+		} else if( (uint8_t)(gw_txq_seq - gw_txq[i].seq)
+			   > (uint8_t)(gw_txq_seq - gw_txq[next].seq) )
+			/* Older of the two */
+			next = i;
+	}
+
+	if( next == GW_TXQ_LEN )
+		return;
+
+	sric_if.tx_lock();
+
+	/* Hand the frame (and our reference to it) over to sric */
+	frame = gw_txq[next].frame;
+	gw_txq[next].frame = NULL;
+	sric_txbuf_set( frame );
+
+	/* Transfer data gets no response, so the rest of the window can
+	   follow it while we've got the token */
+	if( frame[SRIC_LEN] >= 2
+	    && frame[SRIC_DATA] == (SRIC_SYSCMD_FLAG | SRIC_SYSCMD_XFER)
+	    && frame[SRIC_DATA + 1] == SRIC_XFER_DATA )
+		sric_if.ctl( SRIC_CTL_KEEP_TOK );
+
+	/* Avoid SRIC IF rotating by not expecting a response */
+	sric_if.tx_cmd_start( frame[SRIC_LEN] + SRIC_HEADER_SIZE, false );
+
+	/* Update state to reflect the fact we just put something on
+	 * the bus */
+	gw_inhost_state = IH_TRANSMITTING_SRIC;
+}
+
 static bool gw_proc_bus_cmd()
 {
 	int ret;
 
 	/* Is this destined for the gateway device, the bus, or both? */
-	if ((( gw_sric_if.rxbuf[SRIC_DEST] & 0x7F ) != sric_addr ||
-				gw_sric_if.rxbuf[SRIC_DEST] == 0) &&
-				gw_inhost_state != IH_TRANSMITTING_SRIC) {
+	if (( gw_sric_if.rxbuf[SRIC_DEST] & 0x7F ) != sric_addr ||
+				gw_sric_if.rxbuf[SRIC_DEST] == 0) {
 
 		/* not for local dev, or broadcast; put on bus. */
-		memcpy( sric_txbuf, gw_sric_if.rxbuf,
-			gw_sric_if.rxbuf[SRIC_LEN] + SRIC_HEADER_SIZE );
-
-		sric_if.tx_lock();
+		if( !gw_txq_add( gw_sric_if.rxbuf ) )
+			return false;
 
-		/* Avoid SRIC IF rotating by not expecting a response */
-		sric_if.tx_cmd_start(
-			gw_sric_if.rxbuf[SRIC_LEN] + SRIC_HEADER_SIZE, false );
-
-		/* Update state to reflect the fact we just put something on
-		 * the bus */
-		gw_inhost_state = IH_TRANSMITTING_SRIC;
+		gw_txq_run();
 	}
 
 	/* If it's for this device: */
@@ -193,13 +326,16 @@ static bool gw_proc_bus_cmd()
 				sched_rem( &gw_dev_retransmit );
 				gw_dev_timed_out = false;
 				gw_dev_state = DEV_IDLE;
+
+				frame_unref( gw_retxmit_frame );
+				gw_retxmit_frame = NULL;
 			}
 
 			/* XXX: passing ack data to local device? */
 		} else {
 
 			/* Normal req. Discard if we can't store a response */
-			if( gw_insric_state == IS_FULL ) {
+			if( !gw_host_tx_ready() ) {
 				return false;
 			}
 
@@ -207,7 +343,7 @@ static bool gw_proc_bus_cmd()
 
 			if ((ret & SRIC_LENGTH_MASK) <= (MAX_FRAME_LEN-2)) {
 				/* Hello - gateway device has a response */
-				gw_insric_fsm( EV_SRIC_RX );
+				gw_host_tx( NULL );
 			}
 		}
 	}
@@ -221,12 +357,13 @@ static bool gw_proc_host_cmd()
 {
 	uint8_t len = gw_sric_if.rxbuf[SRIC_LEN];
 	uint8_t *data = gw_sric_if.rxbuf + SRIC_DATA;
+	int8_t framing = -1;
 
 	if( len == 0 ) {
 		return false;
 	}
 
-	if( gw_insric_state == IS_FULL ) {
+	if( !gw_host_tx_ready() ) {
 		return false;
 	}
 
@@ -255,6 +392,67 @@ static bool gw_proc_host_cmd()
 		gw_sric_if.txbuf[SRIC_DATA] = sric_conf.token_drv->have_token();
 		break;
 
+	case GW_CMD_CAPTURE:
+		require_len(2);
+		gw_capture = data[1] ? true : false;
+
+		gw_sric_if.txbuf[SRIC_LEN] = 4;
+		gw_sric_if.txbuf[SRIC_DATA] = sric_conf.rx_time_hz & 0xff;
+		gw_sric_if.txbuf[SRIC_DATA + 1] = (sric_conf.rx_time_hz >> 8) & 0xff;
+		gw_sric_if.txbuf[SRIC_DATA + 2] = (sric_conf.rx_time_hz >> 16) & 0xff;
+		gw_sric_if.txbuf[SRIC_DATA + 3] = (sric_conf.rx_time_hz >> 24) & 0xff;
+		break;
+
+#ifdef SRIC_PROMISC
+	case GW_CMD_BUS_STATS:
+		require_len(2);
+		gw_sric_if.txbuf[SRIC_LEN] =
+			bus_stats_pack( &sric_bus_stats, gw_sric_if.txbuf + SRIC_DATA );
+		if( data[1] )
+			bus_stats_reset( &sric_bus_stats );
+		break;
+#endif
+
+	case GW_CMD_FRAMING:
+		require_len(2);
+		framing = hostser_framing;
+		if( data[1] < SRIC_FRAMING_NUM )
+			framing = data[1];
+
+		gw_sric_if.txbuf[SRIC_LEN] = 1;
+		gw_sric_if.txbuf[SRIC_DATA] = framing;
+		break;
+
+	case GW_CMD_BUS_BAUD: {
+		uint32_t max = sric_conf.usart_set_baud != NULL ? sric_conf.baud_max : 0;
+		uint8_t *d = gw_sric_if.txbuf + SRIC_DATA;
+
+		require_len(1);
+		gw_sric_if.txbuf[SRIC_LEN] = 8;
+		d[0] = sric_baud & 0xff;
+		d[1] = (sric_baud >> 8) & 0xff;
+		d[2] = (sric_baud >> 16) & 0xff;
+		d[3] = (sric_baud >> 24) & 0xff;
+		d[4] = max & 0xff;
+		d[5] = (max >> 8) & 0xff;
+		d[6] = (max >> 16) & 0xff;
+		d[7] = (max >> 24) & 0xff;
+		break;
+	}
+
+	case GW_CMD_FILTER: {
+		uint8_t i;
+
+		if( (len - 1) % GW_FILTER_ENTRY_LEN != 0
+		    || (len - 1) / GW_FILTER_ENTRY_LEN > GW_FILTER_MAX )
+			return false;
+
+		gw_filter_len = (len - 1) / GW_FILTER_ENTRY_LEN;
+		for( i=0; i<len - 1; i++ )
+			gw_filter[i] = data[1 + i];
+		break;
+	}
+
 #if SRIC_DIRECTOR
 	case GW_CMD_GEN_TOKEN:
 		require_len(1);
@@ -269,10 +467,11 @@ static bool gw_proc_host_cmd()
 #endif
 	}
 
-	/* Calling insric FSM from within inhost FSM: should be fine, there are
-	 * no paths from insric FSM to inhost. And being full duplex, the host
-	 * interface state doesn't (shouldn't) share any state */
-	gw_insric_fsm( EV_SRIC_RX );
+	gw_host_tx( NULL );
+
+	/* The reply's queued in the old framing, so switch after it */
+	if( framing >= 0 )
+		hostser_set_framing( framing );
 	return true;
 }
 
@@ -303,41 +502,27 @@ static void gw_inhost_fsm( gw_event_t event )
 	}
 }
 
-/* Manages data coming in from the sric bus */
-static void gw_insric_fsm( gw_event_t event )
+/* Returns true if there's space to send a frame to the host.
+   Points gw_sric_if.txbuf at the buffer to assemble it in. */
+static bool gw_host_tx_ready( void )
 {
+	gw_sric_if.txbuf = hostser_txbuf;
 
-	switch( gw_insric_state ) {
-	case IS_IDLE:
-		if( event == EV_SRIC_RX ) {
-			/* Transmit the frame to the host */
-
-			hostser_tx();
-			gw_insric_state = IS_TRANSMITTING;
-
-			/* Swap over buffers */
-			gw_sric_if.txbuf = hostser_txbuf;
-		}
-		break;
+	return !hostser_tx_full() && hostser_txbuf != NULL;
+}
 
-	case IS_TRANSMITTING:
-		if( event == EV_HOST_TX_COMPLETE ) {
-			/* Buffer freed */
-			gw_insric_state = IS_IDLE;
-		} else if ( event == EV_SRIC_RX ) {
-			/* Another frame */
-			hostser_tx();
-			gw_insric_state = IS_FULL;
-			gw_sric_if.txbuf = hostser_txbuf;
-		}
-		break;
+/* Send a frame to the host.
+   Forwards the given frame-pool frame without copying it, or sends
+   the frame assembled in gw_sric_if.txbuf if frame is NULL. */
+static void gw_host_tx( uint8_t *frame )
+{
+	if( frame == NULL )
+		hostser_tx();
+	else
+		hostser_tx_frame( frame );
 
-	case IS_FULL:
-		if ( event == EV_HOST_TX_COMPLETE ) {
-			gw_insric_state = IS_TRANSMITTING;
-		}
-		break;
-	}
+	/* Swap over buffers */
+	gw_sric_if.txbuf = hostser_txbuf;
 }
 
 void sric_gw_hostser_rx( void )
@@ -347,19 +532,92 @@ void sric_gw_hostser_rx( void )
 
 void sric_gw_hostser_tx_done( void )
 {
-	gw_insric_fsm( EV_HOST_TX_COMPLETE );
+	/* hostser keeps track of its own queue space */
+}
+
+/* Whether a frame from the bus should go to the host */
+static bool gw_filter_pass( const uint8_t *frame )
+{
+	uint8_t i;
+
+	if( gw_filter_len == 0 )
+		return true;
+
+	for( i=0; i<gw_filter_len; i++ ) {
+		const uint8_t *f = gw_filter + i * GW_FILTER_ENTRY_LEN;
+
+		if( ((frame[SRIC_DEST] ^ f[GW_FILTER_DEST]) & f[GW_FILTER_DEST_MASK])
+		    || ((frame[SRIC_SRC] ^ f[GW_FILTER_SRC]) & f[GW_FILTER_SRC_MASK]) )
+			continue;
+
+		if( f[GW_FILTER_CMD_MASK] == 0 )
+			return true;
+
+		if( frame[SRIC_LEN] > 0
+		    && !((frame[SRIC_DATA] ^ f[GW_FILTER_CMD]) & f[GW_FILTER_CMD_MASK]) )
+			return true;
+	}
+
+	return false;
+}
+
+/* Send a received frame to the host as a capture record */
+static void gw_capture_tx( const uint8_t *frame, const sric_rx_info_t *info )
+{
+	uint8_t *cap, len = frame[SRIC_LEN], flags = info->flags, i;
+
+	if( !gw_host_tx_ready() ) {
+		/* No space -> don't transmit */
+		return;
+	}
+
+	if( len > SRIC_CAP_MAX_DATA ) {
+		len = SRIC_CAP_MAX_DATA;
+		flags |= SRIC_CAP_TRUNC;
+	}
+
+	/* Not an ack, so that it isn't mistaken for a reply */
+	gw_sric_if.txbuf[0] = 0x8e;
+	gw_sric_if.txbuf[SRIC_DEST] = 1;
+	gw_sric_if.txbuf[SRIC_SRC] = 0;
+	gw_sric_if.txbuf[SRIC_LEN] = SRIC_CAP_HEADER + len;
+
+	cap = gw_sric_if.txbuf + SRIC_DATA;
+	cap[SRIC_CAP_TIME] = info->time & 0xff;
+	cap[SRIC_CAP_TIME + 1] = (info->time >> 8) & 0xff;
+	cap[SRIC_CAP_TIME + 2] = (info->time >> 16) & 0xff;
+	cap[SRIC_CAP_TIME + 3] = (info->time >> 24) & 0xff;
+	cap[SRIC_CAP_FLAGS] = flags;
+
+	/* DEST, SRC, LEN and data */
+	for( i=0; i<SRIC_HEADER_SIZE - 1 + len; i++ )
+		cap[SRIC_CAP_FRAME + i] = frame[SRIC_DEST + i];
+
+	gw_host_tx( NULL );
 }
 
-void sric_gw_sric_promisc_rx( const sric_if_t *iface )
+void sric_gw_sric_promisc_rx( const sric_if_t *iface, const sric_rx_info_t *info )
 {
 
-	if( gw_insric_state == IS_FULL ) {
+	if( !gw_filter_pass( iface->rxbuf ) )
+		return;
+
+	if( gw_capture ) {
+		gw_capture_tx( iface->rxbuf, info );
+		return;
+	}
+
+	if( !(info->flags & SRIC_CAP_CRC_OK) )
+		return;
+
+	if( hostser_tx_full() ) {
 		/* No space -> don't transmit */
 		return;
 	}
 
-	memcpy( gw_sric_if.txbuf, iface->rxbuf, iface->rxbuf[SRIC_LEN] + SRIC_HEADER_SIZE );
-	gw_insric_fsm( EV_SRIC_RX );
+	/* The received frame is already a complete frame, CRC and all, so
+	   it can go to the host as it is */
+	gw_host_tx( iface->rxbuf );
 }
 
 void sric_gw_sric_rx_resp( const sric_if_t *iface )
@@ -1,20 +1,16 @@
 #ifndef __GW_H
 #define __GW_H
-/* Host <-> SRIC 'gateway' */
+/* Host <-> SRIC 'gateway'
+   Bus frames from the host are queued until the bus is free.  Frames
+   with SRIC_SRC_PRIO set in their source address jump the queue.
+   The commands the host can send to the gateway itself (gw_cmd_t) are in
+   sric-frame.h. */
 #include "sric-if.h"
 #include "sric.h"
 #include "hostser.h"
 
-typedef enum {
-	/* Set whether the SRIC interface uses the token */
-	GW_CMD_USE_TOKEN,
-	/* Request the token (only use in tokenless mode) */
-	GW_CMD_REQ_TOKEN,
-	/* Query the token driver to determine if SRIC IF currently has the token */
-	GW_CMD_HAVE_TOKEN,
-	/* Generate the token */
-	GW_CMD_GEN_TOKEN,
-} gw_cmd_t;
+/* Number of frames from the host that can wait for the bus */
+#define GW_TXQ_LEN 3
 
 /* Sric interface for the gateway device */
 extern sric_if_t gw_sric_if;
@@ -28,8 +24,10 @@ void sric_gw_hostser_rx( void );
 /* Called when host-side transmission has completed */
 void sric_gw_hostser_tx_done( void );
 
-/* SRIC promiscuous handler */
-void sric_gw_sric_promisc_rx( const sric_if_t *iface );
+/* SRIC promiscuous handler.
+   Forwards frames from the bus that pass the host's filter to the host,
+   as capture records if the host's asked for them. */
+void sric_gw_sric_promisc_rx( const sric_if_t *iface, const sric_rx_info_t *info );
 
 /* Notifier for transmission completion */
 void sric_gw_sric_rx_resp( const sric_if_t *iface );
@@ -2,6 +2,7 @@
 #define __SRIC_IF_H
 #include <stdint.h>
 #include <stdbool.h>
+#include "token-drv.h"
 
 /* Commands that can be fed to the ctl function */
 typedef enum {
@@ -13,6 +14,18 @@ typedef enum {
 
 	/* Request the token */
 	SRIC_CTL_REQUEST_TOK = (1<<2),
+
+	/* Keep hold of the token after the next command's sent, so that
+	   another can follow it without waiting for the token to go round
+	   the bus.  Only for commands that get no response (such as
+	   SRIC_XFER_DATA).  The token's released if nothing's sent soon
+	   after. */
+	SRIC_CTL_KEEP_TOK = (1<<3),
+
+	/* Start or stop adding sequence bytes to the commands sent (see
+	   SRIC_LEN_SEQ) */
+	SRIC_CTL_SEQ_ON = (1<<4),
+	SRIC_CTL_SEQ_OFF = (1<<5),
 } sric_ctl_t;
 
 /* Struct describing a SRIC interface */
@@ -20,6 +33,24 @@ typedef struct {
 	/* Transmit and receive buffers */
 	uint8_t *txbuf, *rxbuf;
 
+	/* Our address on this bus (0 until we've been given one) */
+	uint8_t *addr;
+
+	/* The bus's token driver */
+	const token_drv_t *token_drv;
+
+	/* The fastest baud rate set_baud can switch to (0 if it can't
+	   switch) */
+	uint32_t baud_max;
+
+	/* Whether the command in rxbuf had a sequence byte, its sequence
+	   number, and whether it's a retransmission.  The byte's been taken
+	   out, and the CRC fixed to match, so that the frame's just as it
+	   would have been without it. */
+	bool rx_has_seq;
+	uint8_t rx_seq;
+	bool rx_retx;
+
 	/* Function to acquire lock on transmit buffer
 	   Blocks until lock acquired.
 	   Must only be called prior to transmitting a command
@@ -35,6 +66,15 @@ typedef struct {
 	   (most useful for labelling broadcasts as expecting no response) */
 	void (*tx_cmd_start) ( uint8_t len, bool expect_resp );
 
+	/* Give the next command that's sent a deadline: if it hasn't been
+	   sent and answered within ticks of tx_cmd_start, it's abandoned (as
+	   with any other timeout).  So quick control commands can fail fast,
+	   rather than answering late, and slow operations can be given
+	   longer than SRIC_TOKEN_TIMEOUT.  Without the token, the command's
+	   retransmitted as usual until then.  0 (the default) leaves the
+	   command to the usual timeouts. */
+	void (*set_deadline) ( uint16_t ticks );
+
 	/* Start transmitting a response frame
 	   Must only be called when the rx_cmd callback has returned
 	   SRIC_RESPONSE_DEFER. */
@@ -47,6 +87,14 @@ typedef struct {
 
 	/* Perform some operation on the interface */
 	void (*ctl) ( sric_ctl_t c );
+
+	/* Switch to the given framing (SRIC_FRAMING_*), once the frame
+	   being handled or sent is finished with */
+	void (*set_framing) ( uint8_t framing );
+
+	/* Switch to the given baud rate, in the same way.  Rates the
+	   interface can't manage are ignored. */
+	void (*set_baud) ( uint32_t baud );
 } sric_if_t;
 
 #endif	/* __SRIC_IF_H */
@@ -18,45 +18,20 @@
 #include <signal.h>
 #include <sys/cdefs.h>
 #include "crc16.h"
-#include <drivers/sched.h>
+#include "frame-pool.h"
 
-/* One additional byte for the 0x7e for correct stop bit receivage */
-uint8_t sric_txbuf[SRIC_TXBUF_SIZE+1];
-uint8_t sric_txlen;
-static bool expect_resp;
-
-/* Number of token loops to retransmit after */
+/* Number of token loops to retransmit after.  With sequence bytes on,
+   boards answer a retransmission of a command they've already acted on
+   from their response cache (see sric-client.c), so it needn't leave
+   much room for a slow response. */
 #define TOKEN_THRESHOLD 3
-/* Number of times the token's been seen this loop */
-static uint8_t token_count;
-
-static struct {
-	/* Next byte to be transmitted */
-	uint8_t out_pos;
-} tx;
-
-typedef enum {
-	RX_IDLE,
-	RX_HAVE_FRAME,
-	RX_FULL
-} rx_state_t;
-
-typedef enum {
-	EV_RX_RXED_FRAME,
-	EV_RX_HANDLED_FRAME
-} rx_event_t;
-
-static uint8_t rxbuf[2][SRIC_RXBUF_SIZE + 1];
-uint8_t *sric_w_rxbuf = &rxbuf[0][0];
-uint8_t *sric_rxbuf = &rxbuf[0][0];
-static uint8_t rxbuf_read_idx = 0;	/* Which rxbuf we're reading out of */
-static uint8_t rxbuf_pos;
-static volatile rx_state_t rx_state = RX_IDLE;
-
-extern const sric_conf_t sric_conf;
-uint8_t sric_addr;
+#define TOKEN_THRESHOLD_SEQ 2
+/* Number of ticks to hold the token for after transmitting a priority
+   command, waiting for the immediate response */
+#define PRIO_HOLD_TICKS 10
 
-static sched_task_t timeout_task;
+/* What's presented as the received frame when no response is expected */
+static const uint8_t no_resp[SRIC_RXBUF_SIZE];
 
 /* Events that trigger state changes */
 typedef enum {
@@ -75,7 +50,7 @@ typedef enum {
 } event_t;
 
 /* States */
-static volatile enum {
+enum {
 	/* Not much going on */
 	S_IDLE,
 	/* Waiting for our response to be assembled */
@@ -95,178 +70,291 @@ static volatile enum {
 	S_TX_RESP_WAIT_TOKEN,
 	/* Transmitting response */
 	S_TX_RESP,
-} state;
+	/* Holding the token after a priority command that we're not waiting
+	   on the response to, so that its recipient can respond immediately,
+	   or for the next command (SRIC_CTL_KEEP_TOK) */
+	S_PRIO_HOLD,
+};
 
 #define INTR_TIMEOUT		1
 #define INTR_TX_COMPLETE	2
 #define INTR_HAZ_TOKEN		4
 #define INTR_RESET_DONE		8
-static volatile uint8_t intr_flags = 0;
-
-static void sric_tx_lock( void );
-static void sric_tx_start( uint8_t len, bool expect_resp );
-static void use_token( bool use );
-static void sric_ctl( sric_ctl_t c );
-
-sric_if_t sric_if = {
-	.txbuf = sric_txbuf,
-	.rxbuf = &rxbuf[0][0],
-	.tx_lock = sric_tx_lock,
-	.tx_cmd_start = sric_tx_start,
-	.use_token = use_token,
-	.ctl = sric_ctl,
-};
 
-static void fsm( event_t ev );
-static void rx_fsm ( rx_event_t ev );
+static void fsm( sric_t *s, event_t ev );
 
-#define lvds_tx_en() do { (*sric_conf.txen_port) |= sric_conf.txen_mask; } while(0)
-#define lvds_tx_dis() do { (*sric_conf.txen_port) &= ~sric_conf.txen_mask; } while(0)
+#define lvds_tx_en(s) do { (*(s)->conf->txen_port) |= (s)->conf->txen_mask; } while(0)
+#define lvds_tx_dis(s) do { (*(s)->conf->txen_port) &= ~(s)->conf->txen_mask; } while(0)
+
+void sric_inst_init( sric_t *s )
+{
+	uint8_t i;
+
+	s->txbuf = frame_alloc();
+	for( i=0; i<SRIC_RX_DEPTH; i++ )
+		s->rx_slots[i] = frame_alloc();
+
+	s->rxbuf = s->rx_slots[0];
+	s->w_rxbuf = NULL;
+	s->iface.txbuf = s->txbuf;
+	s->iface.rxbuf = s->rxbuf;
+	s->iface.addr = &s->addr;
+	s->iface.token_drv = s->conf->token_drv;
+	s->iface.baud_max = s->conf->usart_set_baud != NULL ? s->conf->baud_max : 0;
+#ifndef SRIC_PROMISC
+	s->rx_filter = true;
+#endif
+
+	s->addr = 0;
+	s->framing = s->framing_buffered = SRIC_FRAMING_ESCAPE;
+	s->baud = s->baud_buffered = s->conf->baud_base;
+	s->use_seq = false;
+	s->tx_seq = 0;
+#ifdef SRIC_PROMISC
+	bus_stats_reset( &s->bus_stats );
+#endif
+	lvds_tx_dis(s);
+	(*s->conf->txen_dir) |= s->conf->txen_mask;
+}
+
+void sric_inst_txbuf_set( sric_t *s, uint8_t *frame )
+{
+	frame_unref( s->txbuf );
+	s->txbuf = frame;
+	s->iface.txbuf = frame;
+}
 
-void sric_init( void )
+/* Set the CRC of the frame in buf */
+static void crc_set( uint8_t *buf )
 {
-	sric_addr = 0;
-	lvds_tx_dis();
-	(*sric_conf.txen_dir) |= sric_conf.txen_mask;
+	uint8_t len = sric_frame_len( buf ) + sric_frame_seq_len( buf );
+	uint16_t c = crc16( buf, SRIC_HEADER_SIZE + len );
+
+	buf[ SRIC_DATA + len ] = c & 0xff;
+	buf[ SRIC_DATA + len + 1 ] = (c >> 8) & 0xff;
 }
 
 /* Set the CRC in the transmit buffer */
-static void crc_txbuf( void )
+static void crc_txbuf( sric_t *s )
 {
-	uint8_t len = sric_txbuf[ SRIC_LEN ];
-	uint16_t c = crc16( sric_txbuf, SRIC_HEADER_SIZE + len );
+	crc_set( s->txbuf );
+}
 
-	sric_txbuf[ SRIC_DATA + len ] = c & 0xff;
-	sric_txbuf[ SRIC_DATA + len + 1 ] = (c >> 8) & 0xff;
+/* Mark the command in the transmit buffer as a retransmission, if it
+   has a sequence byte to do so in */
+static void retx_txbuf( sric_t *s )
+{
+	uint8_t *seq = s->txbuf + SRIC_DATA + sric_frame_len( s->txbuf );
+
+	if( sric_frame_seq_len( s->txbuf ) && !(*seq & SRIC_SEQ_RETX) ) {
+		*seq |= SRIC_SEQ_RETX;
+		crc_txbuf(s);
+	}
 }
 
-static void start_tx( void )
+static void start_tx( sric_t *s )
 {
-	sric_conf.usart_rx_gate(sric_conf.usart_n, false);
-	lvds_tx_en();
-	tx.out_pos = 0;
-	sric_conf.usart_tx_start(sric_conf.usart_n);
+#ifdef SRIC_PROMISC
+	/* We don't hear our own frames, so count them here */
+	bus_stats_frame( &s->bus_stats, sric_frame_src(s->txbuf), true );
+#endif
+	s->conf->usart_rx_gate(s->conf->usart_n, false);
+	lvds_tx_en(s);
+	s->tx_out_pos = 0;
+	cobs_tx_start( &s->tx_cobs );
+	s->conf->usart_tx_start(s->conf->usart_n);
 }
 
 /* Called in intr context */
 static bool timeout( void *ud )
 {
-	intr_flags |= INTR_TIMEOUT;
+	sric_t *s = ud;
+
+	s->intr_flags |= INTR_TIMEOUT;
 	return false;
 }
 
-static bool sric_use_token = false;
-static bool sric_use_token_buffered = false;
-static bool sric_reset_queued = false;
+static void register_timeout_ticks( sric_t *s, uint16_t t )
+{
+	s->timeout_task.t = t;
+	s->timeout_task.cb = timeout;
+	s->timeout_task.udata = s;
+	sched_add(&s->timeout_task);
+}
+
+/* Ticks left until the command's deadline (0 once it's passed) */
+static uint16_t deadline_left( const sric_t *s )
+{
+	uint16_t t = sched_time_since(s->cmd_start);
 
-static void register_timeout( void )
+	return t < s->deadline ? s->deadline - t : 0;
+}
+
+static void register_timeout( sric_t *s )
 {
 	/* Setup a long timeout for the response */
-	if( sric_use_token )
-		timeout_task.t = 15000;
-	else
-		timeout_task.t = 50;
+	uint16_t t = s->use_token ? SRIC_TOKEN_TIMEOUT : SRIC_TOKENLESS_TIMEOUT;
+
+	if( s->deadline ) {
+		/* Without the token, retransmit in the meantime */
+		uint16_t left = deadline_left(s);
 
-	timeout_task.cb = timeout;
-	sched_add(&timeout_task);
+		if( s->use_token || left < t )
+			t = left ? left : 1;
+	}
+
+	register_timeout_ticks(s, t);
 }
 
 #ifndef DIRECTOR
 static bool reset_timeout( void *ud )
 {
-	intr_flags |= INTR_RESET_DONE;
+	sric_t *s = ud;
+
+	s->intr_flags |= INTR_RESET_DONE;
 	return false;
 }
 #endif
 
-static void proc_queued_reset( void )
+static void proc_queued_reset( sric_t *s )
 {
-	if( sric_reset_queued ) {
+	if( s->reset_queued ) {
 		/* Move to tokenless mode */
-		sric_use_token_buffered = false;
+		s->use_token_buffered = false;
+
+		/* Everyone starts off escaping frames, at the base rate,
+		   without sequence bytes */
+		s->framing_buffered = SRIC_FRAMING_ESCAPE;
+		s->baud_buffered = s->conf->baud_base;
+		s->use_seq = false;
 
 		/* Throw away our address */
-		sric_addr = 0;
+		s->addr = 0;
 
 		/* If there's a timeout, remove it */
-		sched_rem(&timeout_task);
+		sched_rem(&s->timeout_task);
 
 #ifdef DIRECTOR
 		/* If we're the director, request the token immediately.
 		 * Clients will request the token shortly after receiving the
 		 * reset command, and we want to be left holding it. */
-		sric_conf.token_drv->req();
+		s->conf->token_drv->req();
 #else
 		/* Release token if we have it, then in a bit, request it again.
 		 * This is in aid of flushing the token out of the bus. */
-		sric_conf.token_drv->release();
+		s->conf->token_drv->release();
 
-		timeout_task.t = 5;
-		timeout_task.cb = reset_timeout;
-		sched_add(&timeout_task);
+		s->timeout_task.t = 5;
+		s->timeout_task.cb = reset_timeout;
+		s->timeout_task.udata = s;
+		sched_add(&s->timeout_task);
 #endif
 	}
 }
 
-static void fsm( event_t ev )
+/* Move over to the buffered framing and baud rate.  The bus should be
+   quiet: anything that's part-way through being received is dropped. */
+static void switch_link( sric_t *s )
+{
+	dint();
+	s->framing = s->framing_buffered;
+	if( s->baud != s->baud_buffered ) {
+		s->baud = s->baud_buffered;
+		s->conf->usart_set_baud( s->conf->usart_n, s->baud );
+	}
+	s->w_rxbuf = NULL;
+	s->rxbuf_pos = 0;
+	s->rx_escape_next = false;
+	s->rx_errors = 0;
+	eint();
+}
+
+/* Apply any buffered link changes, if we're between frames */
+static void link_update( sric_t *s )
+{
+	/* Only when idle, so that no frame is sent or received half one
+	   way and half the other */
+	if( s->state == S_IDLE && ( s->framing != s->framing_buffered
+				    || s->baud != s->baud_buffered ) )
+		switch_link(s);
+}
+
+static void fsm( sric_t *s, event_t ev )
 {
-	switch(state) {
+	const token_drv_t *tok = s->conf->token_drv;
+
+	switch(s->state) {
 	case S_IDLE:
 		if( ev == EV_TX_LOCK || ev == EV_RX ) {
-			if( sric_use_token_buffered != sric_use_token )
-				sric_use_token = sric_use_token_buffered;
+			if( s->use_token_buffered != s->use_token )
+				s->use_token = s->use_token_buffered;
 		}
 
 		if(ev == EV_TX_LOCK) {
-			/* Disable the receiver */
-			sric_conf.usart_rx_gate(sric_conf.usart_n, false);
-
-			state = S_TX_LOCKED;
+			/* The receiver stays on until start_tx(): frames that
+			   arrive while we wait for the token (responses to
+			   the gateway's last command, say) still get through */
+			s->state = S_TX_LOCKED;
 		} else if(ev == EV_RX) {
 			/* Received a frame */
-			uint8_t l = sric_conf.rx_cmd(&sric_if);
+			uint8_t l = s->conf->rx_cmd(&s->iface);
 
 			if( l == SRIC_RESPONSE_DEFER ) {
 				/* Response isn't ready yet.  Wait. */
-				state = S_WAIT_ASM_RESP;
+				s->state = S_WAIT_ASM_RESP;
 			} else if( (l & SRIC_LENGTH_MASK) <= (MAX_FRAME_LEN-2) ) {
-				crc_txbuf();
-				sric_txlen = l + 2;
+				crc_txbuf(s);
+				s->txlen = (l & SRIC_LENGTH_MASK) + 2;
 
-				if( sric_use_token && !(l & SRIC_RESPOND_NOW)) {
-					sric_conf.token_drv->req();
-					state = S_TX_RESP_WAIT_TOKEN;
+				if( s->use_token && !(l & SRIC_RESPOND_NOW)) {
+					tok->req();
+					s->state = S_TX_RESP_WAIT_TOKEN;
 				} else {
-					start_tx();
-					state = S_TX_RESP;
+					start_tx(s);
+					s->state = S_TX_RESP;
 				}
 			} else
-				proc_queued_reset();
+				proc_queued_reset(s);
 		}
 		break;
 
 	case S_WAIT_ASM_RESP:
 		/* TODO! */
 		while(1);
-		/* sric_conf.token_drv->req(); */
+		/* tok->req(); */
 		break;
 
 	case S_TX_LOCKED:
 		/* Transmit buffer's locked */
 		if(ev == EV_TX_START) {
-			/* Generate the checksum */
-			crc_txbuf();
-			sric_txlen += 2;
+			/* A new command, even if the buffer still has the
+			   last one's sequence byte */
+			s->txbuf[SRIC_LEN] &= ~SRIC_LEN_SEQ;
+			if( s->use_seq && !sric_frame_is_ack(s->txbuf) ) {
+				s->txbuf[s->txlen++] = s->tx_seq;
+				s->tx_seq = (s->tx_seq + 1) & SRIC_SEQ_MASK;
+				s->txbuf[SRIC_LEN] |= SRIC_LEN_SEQ;
+			}
 
-			if( sric_use_token &&
-					!sric_conf.token_drv->have_token()) {
-				sric_conf.token_drv->req();
-				state = S_TX_WAIT_TOKEN;
+			/* Generate the checksum */
+			crc_txbuf(s);
+			s->txlen += 2;
+
+			s->deadline = s->deadline_next;
+			s->deadline_next = 0;
+			s->cmd_start = sched_time;
+
+			if( s->use_token && !tok->have_token()) {
+				tok->req();
+				/* Don't wait for the token past the deadline */
+				if( s->deadline )
+					register_timeout(s);
+				s->state = S_TX_WAIT_TOKEN;
 			} else {
 				/* Start transmission immediately */
-				token_count = 0;
-				start_tx();
-				state = S_TX;
+				s->token_count = 0;
+				start_tx(s);
+				s->state = S_TX;
 			}
 		}
 		break;
@@ -274,47 +362,76 @@ static void fsm( event_t ev )
 	case S_TX_WAIT_TOKEN:
 		if( ev == EV_GOT_TOKEN ) {
 			/* Register timeout to reset in the event of waiting too long for the token */
-			register_timeout();
-			token_count = 0;
-			start_tx();
-			state = S_TX;
+			register_timeout(s);
+			s->token_count = 0;
+			start_tx(s);
+			s->state = S_TX;
+		} else if( ev == EV_TIMEOUT ) {
+			/* The deadline passed before the token came */
+			tok->cancel_req();
+
+			if( s->conf->error != NULL )
+				s->conf->error();
+
+			s->state = S_IDLE;
 		}
 		break;
 
 	case S_TX:
 		/* Transmitting a frame */
 		if(ev == EV_TX_DONE) {
-			if( sric_use_token )
-				sric_conf.token_drv->release();
+			/* Hang on to the token after a priority command, so
+			   that the response can come straight back, or if
+			   another command's to follow */
+			bool hold = s->use_token && ( sric_frame_is_prio(s->txbuf)
+						      || s->keep_token );
 
-			if ( !expect_resp ) {
-				/* No response expected */
-				uint8_t i;
+			s->token_kept = s->keep_token && !s->expect_resp;
+			s->keep_token = false;
 
+			if( s->use_token && !hold )
+				tok->release();
+
+			if ( !s->expect_resp ) {
+				/* No response expected */
 				/* Remove response timeout */
-				sched_rem(&timeout_task);
+				sched_rem(&s->timeout_task);
 
-				if( sric_conf.rx_resp != NULL ) {
-					/* Clear the rxbuf to ensure our "user" doesn't get confused... */
-					for( i=0; i<SRIC_RXBUF_SIZE; i++ )
-						sric_rxbuf[i] = 0;
+				if( s->conf->rx_resp != NULL ) {
+					/* Give our "user" an empty rxbuf to ensure they don't get
+					   confused.  The last received frame's slot may already
+					   be in use by the receive intr. */
+					s->rxbuf = (uint8_t*)no_resp;
+					s->iface.rxbuf = s->rxbuf;
 
-					sric_conf.rx_resp( &sric_if );
+					s->conf->rx_resp( &s->iface );
 				}
 
-				state = S_IDLE;
+				if( hold ) {
+					register_timeout_ticks(s, PRIO_HOLD_TICKS);
+					s->state = S_PRIO_HOLD;
+				} else
+					s->state = S_IDLE;
+
+			} else if( hold ) {
+				/* Wait a short while for the immediate response */
+				sched_rem(&s->timeout_task);
+				register_timeout_ticks(s, PRIO_HOLD_TICKS);
+				s->prio_holding = true;
 
-			} else if( sric_use_token ) {
+				s->state = S_WAIT_RESP;
+
+			} else if( s->use_token ) {
 				/* Re-request the token for retransmission */
-				sric_conf.token_drv->req();
+				tok->req();
 
-				state = S_WAIT_RESP;
+				s->state = S_WAIT_RESP;
 
 			} else {
 				/* Register timeout for retransmission */
-				register_timeout();
+				register_timeout(s);
 
-				state = S_WAIT_RESP;
+				s->state = S_WAIT_RESP;
 			}
 
 		} else if( ev == EV_TIMEOUT ) {
@@ -323,22 +440,22 @@ static void fsm( event_t ev )
 			   so go via the S_TX_TIMED_OUT state to wait for the tx to finish. */
 
 			/* Don't let anyone hear the rest of our transmission */
-			lvds_tx_dis();
-			state = S_TX_TIMED_OUT;
+			lvds_tx_dis(s);
+			s->state = S_TX_TIMED_OUT;
 		}
 		break;
 
 	case S_TX_TIMED_OUT:
 		/* Finished transmitting */
 		if(ev == EV_TX_DONE) {
-			if( sric_use_token )
-				sric_conf.token_drv->release();
+			if( s->use_token )
+				tok->release();
 
 			/* Emit the error callback */
-			if( sric_conf.error != NULL )
-				sric_conf.error();
+			if( s->conf->error != NULL )
+				s->conf->error();
 
-			state = S_IDLE;
+			s->state = S_IDLE;
 		}
 		break;
 
@@ -346,79 +463,135 @@ static void fsm( event_t ev )
 		/* Waiting for a response */
 		if(ev == EV_RX) {
 			/* Cancel the timeout */
-			sched_rem(&timeout_task);
-			/* No longer need the token for retransmission */
-			if( sric_use_token )
-				sric_conf.token_drv->cancel_req();
+			sched_rem(&s->timeout_task);
+			/* No longer need the token for retransmission
+			   (or, if we were holding it, release it) */
+			if( s->use_token )
+				tok->cancel_req();
+			s->prio_holding = false;
 
-			if( sric_conf.rx_resp != NULL )
-				sric_conf.rx_resp( &sric_if );
+			if( s->conf->rx_resp != NULL )
+				s->conf->rx_resp( &s->iface );
 
-			state = S_IDLE;
+			s->state = S_IDLE;
 		} else if( ev == EV_TIMEOUT ) {
-			if( sric_use_token ) {
+			if( s->prio_holding ) {
+				/* No immediate response to our priority command.
+				   Pass the token on, and wait for the response
+				   in the normal manner. */
+				s->prio_holding = false;
+				tok->release();
+				tok->req();
+				register_timeout(s);
+
+			} else if( s->use_token ) {
 				/* We've spent too long waiting for a response */
 				/* Abort the whole situation */
 
 				/* Drop our token request */
-				sric_conf.token_drv->cancel_req();
+				tok->cancel_req();
 
 				/* Emit the error callback */
-				if( sric_conf.error != NULL )
-					sric_conf.error();
+				if( s->conf->error != NULL )
+					s->conf->error();
+
+				s->state = S_IDLE;
+			} else if( s->deadline && deadline_left(s) == 0 ) {
+				/* Out of time for retransmissions */
+				if( s->conf->error != NULL )
+					s->conf->error();
 
-				state = S_IDLE;
+				s->state = S_IDLE;
 			} else {
 				/* Retransmit time */
-				start_tx();
+				retx_txbuf(s);
+				start_tx(s);
 
 				/* TODO: Abort after N retransmissions */
-				state = S_TX;
+				s->state = S_TX;
 			}
 
-		} else if( ev == EV_GOT_TOKEN && sric_use_token ) {
-			token_count++;
+		} else if( ev == EV_GOT_TOKEN && s->use_token ) {
+			s->token_count++;
 
-			if(token_count >= TOKEN_THRESHOLD) {
-				token_count = 0;
-				start_tx();
-				state = S_TX;
+			if(s->token_count >= (s->use_seq ? TOKEN_THRESHOLD_SEQ
+					      : TOKEN_THRESHOLD)) {
+				s->token_count = 0;
+				retx_txbuf(s);
+				start_tx(s);
+				s->state = S_TX;
 			} else {
-				sric_conf.token_drv->release();
-				sric_conf.token_drv->req();
+				tok->release();
+				tok->req();
 			}
 		}
 		break;
 
 	case S_TX_RESP_WAIT_TOKEN:
 		if( ev == EV_GOT_TOKEN ) {
-			start_tx();
-			state = S_TX_RESP;
+			start_tx(s);
+			s->state = S_TX_RESP;
 		}
 		break;
 
 	case S_TX_RESP:
 		/* Transmitting response frame */
 		if(ev == EV_TX_DONE ) {
-			if( sric_use_token )
-				sric_conf.token_drv->release();
+			if( s->use_token )
+				tok->release();
 
-			proc_queued_reset();
-			state = S_IDLE;
+			proc_queued_reset(s);
+			s->state = S_IDLE;
+		}
+		break;
+
+	case S_PRIO_HOLD:
+		/* Holding the token after a priority command */
+		if( ev == EV_TX_LOCK && s->token_kept ) {
+			/* Send the next command with it */
+			sched_rem(&s->timeout_task);
+			s->token_kept = false;
+			s->state = S_TX_LOCKED;
+		} else if( ev == EV_RX || ev == EV_TIMEOUT ) {
+			sched_rem(&s->timeout_task);
+			tok->release();
+			s->state = S_IDLE;
+
+			/* Handle anything other than the response as normal */
+			if( ev == EV_RX && !sric_frame_is_ack(s->rxbuf) )
+				fsm( s, EV_RX );
 		}
 		break;
 
 	default:
-		state = S_IDLE;
+		s->state = S_IDLE;
 	}
+
+#ifndef SRIC_PROMISC
+	s->rx_filter = ( s->state == S_IDLE
+			 || s->state == S_WAIT_ASM_RESP
+			 || s->state == S_TX_RESP_WAIT_TOKEN
+			 || s->state == S_TX_RESP );
+#else
+	bus_stats_waiting( &s->bus_stats,
+			   s->state == S_TX_WAIT_TOKEN
+			   || s->state == S_TX_RESP_WAIT_TOKEN );
+#endif
+
+	link_update(s);
 }
 
 /* Called in intr context */
-bool sric_tx_cb( uint8_t *b )
+bool sric_inst_tx_cb( sric_t *s, uint8_t *b )
 {
-	static bool escape_next = false;
+#ifdef SRIC_PROMISC
+	/* The receiver's off, so count what we send (the first padding
+	   byte included) */
+	if( s->tx_out_pos <= s->txlen )
+		bus_stats_byte( &s->bus_stats );
+#endif
 
-	if( tx.out_pos == sric_txlen ) {
+	if( s->tx_out_pos == s->txlen ) {
 		/* As per the srobo-devel@ list on 09/12/2010, some death
 		 * occurs at the end of transmission if we release the token
 		 * on the "transmit buffer empty" intr - we need to wait for
@@ -431,224 +604,401 @@ bool sric_tx_cb( uint8_t *b )
 		 *    out and the bus is idle from everyone elses perspective
 		 */
 		*b = 0xFF;
-		tx.out_pos++;
+		s->tx_out_pos++;
 		return true;
-	} else if ( tx.out_pos == sric_txlen + 1 ) {
+	} else if ( s->tx_out_pos == s->txlen + 1 ) {
 
 		/* Disable transmission; enable receiving. This is safe because
 		 * the tail of the padding byte(s) never make it onto the bus
 		 * from now on */
-		lvds_tx_dis();
-		sric_conf.usart_rx_gate(sric_conf.usart_n, true);
+		lvds_tx_dis(s);
+		s->conf->usart_rx_gate(s->conf->usart_n, true);
 
 		*b = 0xFF;
-		tx.out_pos++;
+		s->tx_out_pos++;
 		return true;
-	} else if( tx.out_pos == sric_txlen + 2) {
+	} else if( s->tx_out_pos == s->txlen + 2) {
 		/* Transmission complete */
-		intr_flags |= INTR_TX_COMPLETE;
+		s->intr_flags |= INTR_TX_COMPLETE;
 		return false;
 	}
 
-	*b = sric_txbuf[tx.out_pos];
+	if( s->framing == SRIC_FRAMING_COBS ) {
+		/* On to the padding once the closing delimiter's out */
+		if( cobs_tx_byte( &s->tx_cobs, s->txbuf, s->txlen, b ) )
+			s->tx_out_pos = s->txlen;
+		return true;
+	}
+
+	*b = s->txbuf[s->tx_out_pos];
 
-	if( escape_next ) {
+	if( s->tx_escape_next ) {
 		*b ^= 0x20;
-		escape_next = false;
+		s->tx_escape_next = false;
 
 	/* Don't escape byte 0 (0x7E) */
-	} else if( tx.out_pos != 0 && (*b == 0x7E || *b == 0x8E || *b == 0x7D ) ) {
+	} else if( s->tx_out_pos != 0 && (*b == 0x7E || *b == 0x8E || *b == 0x7D ) ) {
 		*b = 0x7D;
-		escape_next = true;
+		s->tx_escape_next = true;
 		return true;
 	}
 
-	tx.out_pos++;
+	s->tx_out_pos++;
 	return true;
 }
 
+/* Start receiving a frame.  Called in intr context. */
+static void rx_frame_start( sric_t *s )
+{
+	s->rxbuf_pos = 0;
+	/* Receive into the next free slot.  If the ring's full, this
+	   frame's discarded. */
+	s->w_rxbuf = frame_ring_wr( &s->rx_ring );
+#ifdef SRIC_PROMISC
+	if( s->w_rxbuf != NULL ) {
+		sric_rx_info_t *info =
+			&s->rx_info[ s->rx_ring.head & s->rx_ring.mask ];
+
+		info->time = s->conf->rx_time != NULL
+			? s->conf->rx_time() : sched_time;
+		info->flags = 0;
+		if( s->use_token )
+			info->flags |= SRIC_CAP_TOKEN;
+		if( s->conf->token_drv->have_token() )
+			info->flags |= SRIC_CAP_GW_TOKEN;
+	}
+#endif
+}
+
+/* Receive a byte of a COBS-framed frame.  It's stored as it is, and
+   decoded by the poll function.  There's no early address filtering.
+   Called in intr context. */
+static void rx_cobs( sric_t *s, uint8_t b )
+{
+	if( b == COBS_DELIM ) {
+		/* Ends the frame being received, and starts the next.  Anything
+		   too short to be a frame (such as the padding that follows
+		   each one) is dropped. */
+		if( s->w_rxbuf != NULL && s->rxbuf_pos > SRIC_OVERHEAD ) {
+			s->rx_len[ s->rx_ring.head & s->rx_ring.mask ] = s->rxbuf_pos;
+			frame_ring_push( &s->rx_ring );
+		}
+
+		rx_frame_start(s);
+		return;
+	}
+
+	if( s->w_rxbuf == NULL )
+		return;
+
+	if( s->rxbuf_pos == FRAME_SIZE ) {
+		/* Too long to be a frame */
+		s->w_rxbuf = NULL;
+		return;
+	}
+
+	s->w_rxbuf[s->rxbuf_pos] = b;
+	s->rxbuf_pos += 1;
+}
+
+/* Count a receive error.  Called in intr context, or with intrs off. */
+static void rx_error( sric_t *s )
+{
+	if( s->rx_errors < SRIC_RX_ERR_LIMIT )
+		s->rx_errors += SRIC_RX_ERR_WEIGHT;
+}
+
+/* Called in intr context */
+void sric_inst_rx_err( sric_t *s )
+{
+#ifdef SRIC_PROMISC
+	bus_stats_byte( &s->bus_stats );
+#endif
+	/* Drop the frame it was part of */
+	s->w_rxbuf = NULL;
+	rx_error(s);
+}
+
 /* Called in intr context */
-void sric_rx_cb( uint8_t b )
+void sric_inst_rx_cb( sric_t *s, uint8_t b )
 {
-	static bool escape_next = false;
 	uint8_t len;
 
-	if ( rx_state == RX_FULL )
-		/* Both buffers are full, discard new data */
+#ifdef SRIC_PROMISC
+	bus_stats_byte( &s->bus_stats );
+#endif
+
+	if( s->framing == SRIC_FRAMING_COBS ) {
+		rx_cobs( s, b );
 		return;
+	}
 
 	if( b == 0x7E ) {
-		escape_next = false;
-		rxbuf_pos = 0;
+		/* A frame cut short, most likely by a corrupted length */
+		if( s->w_rxbuf != NULL && s->rxbuf_pos > 0 )
+			rx_error(s);
+
+		s->rx_escape_next = false;
+		rx_frame_start(s);
 	} else if( b == 0x7D ) {
-		escape_next = true;
+		s->rx_escape_next = true;
 		return;
-	} else if( escape_next ) {
-		escape_next = false;
+	} else if( s->rx_escape_next ) {
+		s->rx_escape_next = false;
 		b ^= 0x20;
 	}
 
+	if( s->w_rxbuf == NULL )
+		return;
+
 	/* End of buffer */
-	if( rxbuf_pos >= SRIC_RXBUF_SIZE )
+	if( s->rxbuf_pos >= SRIC_RXBUF_SIZE )
 		return;
 
-	sric_w_rxbuf[rxbuf_pos] = b;
-	rxbuf_pos += 1;
+	s->w_rxbuf[s->rxbuf_pos] = b;
+	s->rxbuf_pos += 1;
+
+#ifndef SRIC_PROMISC
+	if( s->rxbuf_pos == SRIC_DEST + 1 && s->rx_filter
+	    /* Frames for us, broadcasts, and groups (which sric-client
+	       sorts out, as it knows which we're in) */
+	    && b != s->addr && b != 0 && !sric_addr_is_group(b) ) {
+		/* Not for us: ignore the rest, up to the next 0x7E.  That
+		   can't appear inside a frame, so there's no need to count
+		   our way through it. */
+		s->w_rxbuf = NULL;
+		return;
+	}
+#endif
 
-	if( sric_w_rxbuf[0] != 0x7e
+	if( s->w_rxbuf[0] != 0x7e
 	    /* Make sure we've reached the minimum frame size */
-	    || rxbuf_pos < (SRIC_LEN + 2) )
+	    || s->rxbuf_pos < (SRIC_LEN + 2) )
 		return;
 
-	len = sric_w_rxbuf[SRIC_LEN];
-	if( len != rxbuf_pos - (SRIC_LEN + 3) )
+	len = sric_frame_len( s->w_rxbuf ) + sric_frame_seq_len( s->w_rxbuf );
+	if( len != s->rxbuf_pos - (SRIC_LEN + 3) )
 		return;
 
 	/* We have a frame :-O */
-	rx_fsm( EV_RX_RXED_FRAME );
+	frame_ring_push( &s->rx_ring );
 
-	rxbuf_pos = 0;
+	s->w_rxbuf = NULL;
+	s->rxbuf_pos = 0;
 }
 
-static void sric_tx_lock( void )
+void sric_inst_tx_lock( sric_t *s )
 {
-	while( state != S_TX_LOCKED ) {
+	while( s->state != S_TX_LOCKED ) {
 		/* If the WDT is in use we need to reset it here */
 		if ((WDTCTL & WDTHOLD) == 0)
 			WDTCTL = WDTPW | WDTCNTCL;
 
-		fsm(EV_TX_LOCK);
-		sric_poll();
+		fsm(s, EV_TX_LOCK);
+		sric_inst_poll(s);
 	}
 }
 
-static void sric_tx_start( uint8_t len, bool _expect_resp )
+void sric_inst_tx_start( sric_t *s, uint8_t len, bool expect_resp )
 {
-	sric_txlen = len;
-	expect_resp = _expect_resp;
+	s->txlen = len;
+	s->expect_resp = expect_resp;
 
-	fsm(EV_TX_START);
+	fsm(s, EV_TX_START);
+}
+
+void sric_inst_set_deadline( sric_t *s, uint16_t ticks )
+{
+	s->deadline_next = ticks;
 }
 
 /* Called in intr context */
-void sric_haz_token( void )
+void sric_inst_haz_token( sric_t *s )
 {
-	intr_flags |= INTR_HAZ_TOKEN;
+	s->intr_flags |= INTR_HAZ_TOKEN;
 }
 
-static void use_token( bool use )
+void sric_inst_use_token( sric_t *s, bool use )
 {
-	sric_use_token_buffered = use;
+	s->use_token_buffered = use;
 }
 
-static void sric_ctl ( sric_ctl_t c )
+void sric_inst_ctl( sric_t *s, sric_ctl_t c )
 {
 	switch(c)
 	{
 	case SRIC_CTL_RESET:
-		sric_reset_queued = true;
+		s->reset_queued = true;
 		break;
 
 	case SRIC_CTL_RELEASE_TOK:
-		sric_conf.token_drv->release();
+		s->conf->token_drv->release();
 		break;
 
 	case SRIC_CTL_REQUEST_TOK:
-		sric_conf.token_drv->req();
+		s->conf->token_drv->req();
+		break;
+
+	case SRIC_CTL_KEEP_TOK:
+		s->keep_token = true;
+		break;
+
+	case SRIC_CTL_SEQ_ON:
+		s->use_seq = true;
+		break;
+
+	case SRIC_CTL_SEQ_OFF:
+		s->use_seq = false;
 		break;
 	}
 }
 
-void sric_poll( void )
+void sric_inst_set_framing( sric_t *s, uint8_t framing )
 {
-#define DISABLE_FLAG(n) do { dint(); intr_flags &= ~(n); eint(); } while (0)
+	if( framing < SRIC_FRAMING_NUM )
+		s->framing_buffered = framing;
+}
+
+void sric_inst_set_baud( sric_t *s, uint32_t baud )
+{
+	if( baud == s->conf->baud_base
+	    || ( s->conf->usart_set_baud != NULL
+		 && baud != 0 && baud <= s->conf->baud_max ) )
+		s->baud_buffered = baud;
+}
+
+/* Update the receive error score after a frame */
+static void rx_count( sric_t *s, bool good )
+{
+	dint();
+	if( !good )
+		rx_error(s);
+	else if( s->rx_errors > 0 )
+		s->rx_errors--;
+	eint();
+}
+
+/* Decode the COBS-framed frame in rxbuf.
+   Returns false if it isn't a well-formed frame. */
+static bool rx_cobs_decode( sric_t *s )
+{
+	uint8_t len = cobs_decode( s->rxbuf,
+				   s->rx_len[ s->rx_ring.tail & s->rx_ring.mask ] );
+
+	return len >= SRIC_OVERHEAD
+		&& s->rxbuf[0] == 0x7e
+		&& len == SRIC_OVERHEAD + sric_frame_len( s->rxbuf )
+			  + sric_frame_seq_len( s->rxbuf );
+}
+
+void sric_inst_poll( sric_t *s )
+{
+#define DISABLE_FLAG(n) do { dint(); s->intr_flags &= ~(n); eint(); } while (0)
 #ifndef DIRECTOR
-	if (intr_flags & INTR_RESET_DONE) {
+	if (s->intr_flags & INTR_RESET_DONE) {
 		DISABLE_FLAG(INTR_RESET_DONE);
 		/* Request the token for enumeration */
-		sric_conf.token_drv->req();
-		sric_reset_queued = false;
+		s->conf->token_drv->req();
+		s->reset_queued = false;
 	}
 #endif
 
-	if (intr_flags & INTR_TIMEOUT) {
+	if (s->intr_flags & INTR_TIMEOUT) {
 		DISABLE_FLAG(INTR_TIMEOUT);
-		fsm( EV_TIMEOUT );
+		fsm( s, EV_TIMEOUT );
 	}
 
-	if (intr_flags & INTR_TX_COMPLETE) {
+	if (s->intr_flags & INTR_TX_COMPLETE) {
 		DISABLE_FLAG(INTR_TX_COMPLETE);
-		fsm( EV_TX_DONE );
+		fsm( s, EV_TX_DONE );
 	}
 
-	if (rx_state == RX_FULL || rx_state == RX_HAVE_FRAME) {
+	if (!s->rx_recycle_pending && frame_ring_rd( &s->rx_ring ) != NULL) {
 		/* First, check crc */
 		uint16_t crc, recv_crc;
 		uint8_t len;
-		len = sric_rxbuf[ SRIC_LEN ];
-		crc = crc16( sric_rxbuf, SRIC_DATA + len );
 
-		recv_crc = sric_rxbuf[ SRIC_DATA + len ];
-		recv_crc |= sric_rxbuf[ SRIC_DATA + len + 1 ] << 8;
+		/* Update srics view of where the input buffer is */
+		s->rxbuf = *frame_ring_rd( &s->rx_ring );
+		s->iface.rxbuf = s->rxbuf;
+
+		if( s->framing == SRIC_FRAMING_COBS && !rx_cobs_decode(s) ) {
+			/* Garbage: treat it as a bad CRC */
+			crc = 0;
+			recv_crc = 1;
+		} else {
+			len = sric_frame_len( s->rxbuf )
+				+ sric_frame_seq_len( s->rxbuf );
+			crc = crc16( s->rxbuf, SRIC_DATA + len );
+
+			recv_crc = s->rxbuf[ SRIC_DATA + len ];
+			recv_crc |= s->rxbuf[ SRIC_DATA + len + 1 ] << 8;
+		}
+
+		/* Take out the sequence byte, so the frame's as it would have
+		   been without, and put what it said in the iface instead */
+		s->iface.rx_has_seq = s->iface.rx_retx = false;
+		if( s->rxbuf[ SRIC_LEN ] & SRIC_LEN_SEQ ) {
+			uint8_t seq;
+
+			s->rxbuf[ SRIC_LEN ] &= ~SRIC_LEN_SEQ;
+			seq = s->rxbuf[ SRIC_DATA + sric_frame_len( s->rxbuf ) ];
+			if( crc == recv_crc ) {
+				crc_set( s->rxbuf );
+				s->iface.rx_has_seq = true;
+				s->iface.rx_seq = seq & SRIC_SEQ_MASK;
+				s->iface.rx_retx = (seq & SRIC_SEQ_RETX) != 0;
+			}
+		}
 
-		if (crc == recv_crc) {
 #ifdef SRIC_PROMISC
-			sric_conf.promisc_rx(&sric_if);
-#endif
-			fsm( EV_RX );
+		{
+			sric_rx_info_t *info =
+				&s->rx_info[ s->rx_ring.tail & s->rx_ring.mask ];
+
+			if (crc == recv_crc)
+				info->flags |= SRIC_CAP_CRC_OK;
+			if (sric_frame_is_ack(s->rxbuf))
+				info->flags |= SRIC_CAP_ACK;
+			if (sric_frame_is_prio(s->rxbuf))
+				info->flags |= SRIC_CAP_PRIO;
+			if (s->iface.rx_retx)
+				info->flags |= SRIC_CAP_RETX;
+
+			bus_stats_frame( &s->bus_stats, sric_frame_src(s->rxbuf),
+					 crc == recv_crc );
+			s->conf->promisc_rx(&s->iface, info);
 		}
+#endif
+		rx_count( s, crc == recv_crc );
+		if (crc == recv_crc)
+			fsm( s, EV_RX );
 
-		/* Update srics view of where the input buffer is */
-		rxbuf_read_idx ^= 1;
-		sric_rxbuf = &rxbuf[rxbuf_read_idx][0];
-		sric_if.rxbuf = sric_rxbuf;
+		s->rx_recycle_pending = true;
+	}
 
-		dint();
-		rx_fsm( EV_RX_HANDLED_FRAME );
-		eint();
+	if (s->rx_recycle_pending) {
+		/* If the frame's been passed on elsewhere, it's theirs now.
+		   We need a fresh one to receive into. */
+		if( frame_recycle( frame_ring_rd( &s->rx_ring ) ) ) {
+			s->rx_recycle_pending = false;
+			frame_ring_pop( &s->rx_ring );
+		}
 	}
 
-	if (intr_flags & INTR_HAZ_TOKEN) {
+	if (s->intr_flags & INTR_HAZ_TOKEN) {
 		DISABLE_FLAG(INTR_HAZ_TOKEN);
-		fsm( EV_GOT_TOKEN );
+		fsm( s, EV_GOT_TOKEN );
 	}
-#undef DISABLE_FLAG
-}
-
-/* Called in intr context */
-static void rx_fsm ( rx_event_t ev )
-{
-
-	switch ( (int) rx_state ) {
-	case RX_IDLE:
-		if ( ev == EV_RX_RXED_FRAME ) {
-			if (sric_w_rxbuf < &rxbuf[1][0])
-				sric_w_rxbuf = &rxbuf[1][0];
-			else
-				sric_w_rxbuf = &rxbuf[0][0];
 
-			rx_state = RX_HAVE_FRAME;
-		}
-		break;
-
-	case RX_HAVE_FRAME:
-		if ( ev == EV_RX_RXED_FRAME ) {
-			rx_state = RX_FULL;
-		} else if ( ev == EV_RX_HANDLED_FRAME ) {
-			rx_state = RX_IDLE;
-		}
-		break;
-
-	case RX_FULL:
-		if ( ev == EV_RX_HANDLED_FRAME ) {
-			/* Incoming data goes into the other buffer */
-			if (sric_w_rxbuf < &rxbuf[1][0])
-				sric_w_rxbuf = &rxbuf[1][0];
-			else
-				sric_w_rxbuf = &rxbuf[0][0];
-
-			rx_state = RX_HAVE_FRAME;
-		}
-		break;
+	/* Too many receive errors at a raised rate: the line can't take it,
+	   or we've been left behind by a switch.  Fall back. */
+	if( s->rx_errors >= SRIC_RX_ERR_LIMIT && s->baud != s->conf->baud_base ) {
+		s->baud_buffered = s->conf->baud_base;
+		link_update(s);
 	}
+#undef DISABLE_FLAG
 }
+
+/* The board's first (usually only) bus */
+SRIC_INSTANCE( sric, sric_conf );
@@ -5,38 +5,43 @@
 #include <io.h>
 #include "sric-if.h"
 #include "token-drv.h"
+#include "sric-frame.h"
+#include "bus-stats.h"
+#include "frame-ring.h"
+#include "cobs.h"
+#include <drivers/sched.h>
 
-#define MAX_PAYLOAD 64
-#define MAX_FRAME_LEN MAX_PAYLOAD + 6
-
-#define SRIC_TXBUF_SIZE MAX_FRAME_LEN
+/* With room for a sequence byte (see SRIC_LEN_SEQ) */
+#define SRIC_TXBUF_SIZE (MAX_FRAME_LEN + 1)
 #define SRIC_RXBUF_SIZE SRIC_TXBUF_SIZE
-/* The transmit buffer */
-extern uint8_t sric_txbuf[];
-/* Number of bytes in the transmit buffer */
-extern uint8_t sric_txlen;
-
-extern uint8_t *sric_rxbuf;
 
-/* Offsets of fields in the tx buffer */
-enum {
-	SRIC_DEST = 1,
-	SRIC_SRC = 2,
-	SRIC_LEN = 3,
-	SRIC_DATA = 4
-	/* CRC is last two bytes */
-};
-
-/* The number of bytes in a SRIC header */
-#define SRIC_HEADER_SIZE 4
+/* Number of received frames that can be waiting for sric_poll.
+   Must be a power of 2. */
+#ifndef SRIC_RX_DEPTH
+#define SRIC_RX_DEPTH 2
+#endif
 
-/* The number of bytes in the header and footer of a SRIC frame */
-#define SRIC_OVERHEAD (SRIC_HEADER_SIZE + 2)
+/* A node falls back to its base baud rate when receive errors outweigh
+   good frames: each bad frame, or byte flagged by the USART, adds
+   SRIC_RX_ERR_WEIGHT to a score that each good frame takes one off, and
+   it falls back once the score reaches SRIC_RX_ERR_LIMIT.  So it takes an
+   error rate of more than about one in SRIC_RX_ERR_WEIGHT+1 frames. */
+#ifndef SRIC_RX_ERR_WEIGHT
+#define SRIC_RX_ERR_WEIGHT 4
+#endif
+#ifndef SRIC_RX_ERR_LIMIT
+#define SRIC_RX_ERR_LIMIT 16
+#endif
 
-#define sric_addr_set_ack(x) (x | 0x80)
-#define sric_addr_is_ack(x) ( x & 0x80 )
-#define sric_frame_is_ack(buf) ( sric_addr_is_ack(buf[SRIC_DEST]) )
-#define sric_frame_set_ack(buf) do { buf[SRIC_DEST] = sric_addr_set_ack(buf[SRIC_DEST]); } while (0)
+/* Ticks to wait for a response before giving up (with the token) or
+   retransmitting (without it), unless the command has a deadline (see
+   sric_if_t.set_deadline) */
+#ifndef SRIC_TOKEN_TIMEOUT
+#define SRIC_TOKEN_TIMEOUT 15000
+#endif
+#ifndef SRIC_TOKENLESS_TIMEOUT
+#define SRIC_TOKENLESS_TIMEOUT 50
+#endif
 
 /**** Special return values for the command rx callback to return: *****/
 /* Respond now, regardless of token posession. Is a flag bit */
@@ -52,8 +57,17 @@ enum {
 /* Mask to extract length from rx callback */
 #define SRIC_LENGTH_MASK	0x7F
 
+/* What's known about a received frame, besides its contents */
+typedef struct {
+	/* When its delimiter arrived, from sric_conf.rx_time */
+	uint32_t time;
+	/* SRIC_CAP_* flags (see sric-frame.h) */
+	uint8_t flags;
+} sric_rx_info_t;
+
 /* SRIC configuration
-   There must be a const instance of this called sric_conf somewhere. */
+   There must be a const instance of this called sric_conf somewhere, for
+   the sric interface.  Other interfaces have their own. */
 typedef struct {
 	/* Function to be called to start the USART transmitting */
 	void (*usart_tx_start) (uint8_t n);
@@ -64,6 +78,13 @@ typedef struct {
 	/* n to pass to the usart functions */
 	uint8_t usart_n;
 
+	/* Change the USART's baud rate.  NULL if it can't be changed. */
+	void (*usart_set_baud) (uint8_t n, uint32_t baud);
+	/* The rate the USART's set up with, which every node on the bus
+	   starts at, and the fastest that usart_set_baud (and the board's
+	   line drivers) can manage.  In bits per second. */
+	uint32_t baud_base, baud_max;
+
 	const token_drv_t *token_drv;
 
 	/* Registers and bitmask for controlling the TXEN line */
@@ -93,41 +114,213 @@ typedef struct {
 	   The interface resets itself when this happens. */
 	void (*error) (void);
 
-#if SRIC_PROMISC
-	/* Called when a frame is received -- regardless of cmd or response */
-	void (*promisc_rx) ( const sric_if_t *iface );
+#ifdef SRIC_PROMISC
+	/* Called when a frame is received -- regardless of cmd or response,
+	   and even if its CRC is wrong (see info->flags) */
+	void (*promisc_rx) ( const sric_if_t *iface, const sric_rx_info_t *info );
 #endif
+
+	/* Free-running clock to timestamp received frames with (for
+	   promisc_rx), e.g. a timer extended to 32 bits.  Called from the
+	   receive intr, so should be quick.  NULL to use sched_time. */
+	uint32_t (*rx_time) ( void );
+	/* Rate rx_time (or sched_time) counts at, in Hz */
+	uint32_t rx_time_hz;
 } sric_conf_t;
 
 extern const sric_conf_t sric_conf;
 
-/* Our SRIC address */
-/* 0 means we haven't had one assigned yet */
-extern uint8_t sric_addr;
-
-/* Description of this interface */
-extern sric_if_t sric_if;
-
-/* System command constants */
-enum {
-	SRIC_SYSCMD_RESET,
-	SRIC_SYSCMD_TOK_ADVANCE,
-	SRIC_SYSCMD_ADDR_ASSIGN,
-	SRIC_SYSCMD_ADDR_INFO,
-};
-
-/* Initialise the internal goo */
-void sric_init( void );
-
-/* Transmit byte generator */
-bool sric_tx_cb( uint8_t *b );
-/* Callback for each byte received */
-void sric_rx_cb( uint8_t b );
-/* Callback for got the token */
-void sric_haz_token( void );
-
-/* Sric routines to poll for activity caused by interrupts: */
-void sric_poll( void );
+/* State of one SRIC interface, driving one bus through one USART.
+   A board with several buses has one of these, and one sric_conf_t, for
+   each.  Define them with SRIC_INSTANCE.  Nothing outside sric.c should
+   touch the fields, other than addr (and reading baud). */
+typedef struct {
+	const sric_conf_t *conf;
+	/* What's handed to users of the interface */
+	sric_if_t iface;
+
+	/* Our address on this bus.  0 means we haven't had one assigned. */
+	uint8_t addr;
+
+	/* The transmit buffer (a frame from the frame pool), and the number
+	   of bytes in it.  Frames from the pool have one additional byte for
+	   the 0x7e for correct stop bit receivage. */
+	uint8_t *txbuf;
+	uint8_t txlen;
+	bool expect_resp;
+	/* Deadline of the command being sent (0 for none), in ticks from
+	   when it was started, and the same for the next command */
+	uint16_t deadline;
+	uint16_t deadline_next;
+	uint16_t cmd_start;
+	/* Next byte to be transmitted */
+	uint8_t tx_out_pos;
+	bool tx_escape_next;
+	/* Encoder, when the framing's SRIC_FRAMING_COBS */
+	cobs_tx_t tx_cobs;
+	/* Whether commands get sequence bytes (SRIC_CTL_SEQ_ON), and the
+	   sequence number of the next */
+	bool use_seq;
+	uint8_t tx_seq;
+
+	/* Whether we're currently holding the token waiting for a priority
+	   response */
+	bool prio_holding;
+	/* Whether to keep the token after the command being sent, and
+	   whether it's being kept for another (see SRIC_CTL_KEEP_TOK) */
+	bool keep_token;
+	bool token_kept;
+	/* Number of times the token's been seen this loop */
+	uint8_t token_count;
+
+	/* Received frames, passed from the receive intr to the poll
+	   function.  Each slot keeps a frame from the pool to be received
+	   into. */
+	frame_ring_t rx_ring;
+	uint8_t *rx_slots[SRIC_RX_DEPTH];
+	/* The frame being received into (NULL if the ring was full at the
+	   start of the frame) */
+	uint8_t *w_rxbuf;
+	/* The received frame being handled */
+	uint8_t *rxbuf;
+	uint8_t rxbuf_pos;
+	bool rx_escape_next;
+	/* With SRIC_FRAMING_COBS, frames are decoded by the poll function:
+	   this is the encoded length of the frame in each rx_ring slot */
+	uint8_t rx_len[SRIC_RX_DEPTH];
+#ifndef SRIC_PROMISC
+	/* When set, the receive intr drops frames that aren't for us as soon
+	   as their destination byte arrives.  Cleared whilst a response
+	   might be on its way, as those are handled whatever their
+	   address. */
+	volatile bool rx_filter;
+#else
+	/* Timestamp and flags of the frame in each rx_ring slot */
+	sric_rx_info_t rx_info[SRIC_RX_DEPTH];
+	/* Utilisation of the bus, as heard and sent by us */
+	bus_stats_t bus_stats;
+#endif
+	/* Set when we've finished with a received frame, but couldn't get a
+	   new one from the pool to replace it */
+	bool rx_recycle_pending;
+
+	sched_task_t timeout_task;
+	volatile uint8_t state;
+	volatile uint8_t intr_flags;
+
+	bool use_token;
+	bool use_token_buffered;
+	bool reset_queued;
+
+	/* SRIC_FRAMING_* in use, and to switch to when next idle */
+	uint8_t framing;
+	uint8_t framing_buffered;
+	/* Baud rate in use, and to switch to when next idle */
+	uint32_t baud;
+	uint32_t baud_buffered;
+	/* Receive error score (see SRIC_RX_ERR_WEIGHT) */
+	volatile uint8_t rx_errors;
+} sric_t;
+
+/* Interface functions, for the given instance.  Those generated by
+   SRIC_INSTANCE are usually more convenient. */
+void sric_inst_init( sric_t *s );
+void sric_inst_txbuf_set( sric_t *s, uint8_t *frame );
+bool sric_inst_tx_cb( sric_t *s, uint8_t *b );
+void sric_inst_rx_cb( sric_t *s, uint8_t b );
+void sric_inst_rx_err( sric_t *s );
+void sric_inst_haz_token( sric_t *s );
+void sric_inst_poll( sric_t *s );
+void sric_inst_tx_lock( sric_t *s );
+void sric_inst_tx_start( sric_t *s, uint8_t len, bool expect_resp );
+void sric_inst_set_deadline( sric_t *s, uint16_t ticks );
+void sric_inst_use_token( sric_t *s, bool use );
+void sric_inst_ctl( sric_t *s, sric_ctl_t c );
+void sric_inst_set_framing( sric_t *s, uint8_t framing );
+void sric_inst_set_baud( sric_t *s, uint32_t baud );
+
+/* Declare the interface called name, and its functions:
+     name_init()           Initialise the internal goo
+     name_txbuf_set(frame) Replace the transmit buffer with the given
+                           frame-pool frame, taking over the caller's
+                           reference to it.  Allows a frame to be
+                           transmitted without copying it into the
+                           transmit buffer.  Must only be called with the
+                           transmit buffer locked.
+     name_tx_cb(b)         Transmit byte generator, for the USART
+     name_rx_cb(b)         Callback for each byte received
+     name_rx_err()         Callback for a byte received with a framing
+                           or parity error, in place of name_rx_cb
+     name_haz_token()      Callback for got the token, for the token driver
+     name_poll()           Poll for activity caused by interrupts */
+#define SRIC_INSTANCE_DECLARE(name)				\
+	extern sric_t name;					\
+	void name ## _init( void );				\
+	void name ## _txbuf_set( uint8_t *frame );		\
+	bool name ## _tx_cb( uint8_t *b );			\
+	void name ## _rx_cb( uint8_t b );			\
+	void name ## _rx_err( void );				\
+	void name ## _haz_token( void );			\
+	void name ## _poll( void )
+
+/* Define the interface called name, configured by conf_ (a sric_conf_t).
+   Its sric_if_t is name.iface. */
+#define SRIC_INSTANCE(name, conf_)					\
+	SRIC_INSTANCE_DECLARE(name);					\
+	static void name ## _tx_lock( void )				\
+	{ sric_inst_tx_lock( &name ); }					\
+	static void name ## _tx_cmd_start( uint8_t len, bool expect_resp ) \
+	{ sric_inst_tx_start( &name, len, expect_resp ); }		\
+	static void name ## _set_deadline( uint16_t ticks )		\
+	{ sric_inst_set_deadline( &name, ticks ); }			\
+	static void name ## _use_token( bool use )			\
+	{ sric_inst_use_token( &name, use ); }				\
+	static void name ## _ctl( sric_ctl_t c )			\
+	{ sric_inst_ctl( &name, c ); }					\
+	static void name ## _set_framing( uint8_t framing )		\
+	{ sric_inst_set_framing( &name, framing ); }			\
+	static void name ## _set_baud( uint32_t baud )			\
+	{ sric_inst_set_baud( &name, baud ); }				\
+	void name ## _init( void ) { sric_inst_init( &name ); }		\
+	void name ## _txbuf_set( uint8_t *frame )			\
+	{ sric_inst_txbuf_set( &name, frame ); }			\
+	bool name ## _tx_cb( uint8_t *b ) { return sric_inst_tx_cb( &name, b ); } \
+	void name ## _rx_cb( uint8_t b ) { sric_inst_rx_cb( &name, b ); } \
+	void name ## _rx_err( void ) { sric_inst_rx_err( &name ); }	\
+	void name ## _haz_token( void ) { sric_inst_haz_token( &name ); } \
+	void name ## _poll( void ) { sric_inst_poll( &name ); }		\
+	sric_t name = {							\
+		.conf = &(conf_),					\
+		.iface = {						\
+			.tx_lock = name ## _tx_lock,			\
+			.tx_cmd_start = name ## _tx_cmd_start,		\
+			.set_deadline = name ## _set_deadline,		\
+			.use_token = name ## _use_token,		\
+			.ctl = name ## _ctl,				\
+			.set_framing = name ## _set_framing,		\
+			.set_baud = name ## _set_baud,			\
+		},							\
+		.rx_ring = {						\
+			.slots = name.rx_slots,				\
+			.mask = SRIC_RX_DEPTH - 1,			\
+		},							\
+	}
+
+/* The board's first (usually only) bus, driven through sric_conf */
+SRIC_INSTANCE_DECLARE(sric);
+
+/* Its address, interface and buffers, by their old names */
+#define sric_addr (sric.addr)
+#define sric_if (sric.iface)
+#define sric_txbuf (sric.txbuf)
+#define sric_txlen (sric.txlen)
+#define sric_rxbuf (sric.rxbuf)
+/* Its current baud rate */
+#define sric_baud (sric.baud)
+#ifdef SRIC_PROMISC
+#define sric_bus_stats (sric.bus_stats)
+#endif
+
 /* Host serial events */
 void hostser_poll( void );
 
@@ -18,69 +18,65 @@
 #include <io.h>
 #include <drivers/pinint.h>
 
-#define gt_low() do { (*token_10f_conf.gt_port) &= ~token_10f_conf.gt_mask; } while (0)
-#define gt_high() do { (*token_10f_conf.gt_port) |= token_10f_conf.gt_mask; } while (0)
-static bool have_token = false;
+#define gt_low(t) do { (*(t)->conf->gt_port) &= ~(t)->conf->gt_mask; } while (0)
+#define gt_high(t) do { (*(t)->conf->gt_port) |= (t)->conf->gt_mask; } while (0)
 
-static void req( void )
+void token_10f_inst_req( token_10f_t *t )
 {
-	gt_high();
+	gt_high(t);
 }
 
-static void release( void )
+void token_10f_inst_release( token_10f_t *t )
 {
-	have_token = false;
-	gt_low();
+	token_stats_release(&t->stats);
+	t->have_token = false;
+	gt_low(t);
 }
 
-static void cancel_req( void )
+void token_10f_inst_cancel_req( token_10f_t *t )
 {
-	have_token = false;
-	release();
+	t->have_token = false;
+	token_10f_inst_release(t);
 }
 
-static bool get_have_token( void )
+bool token_10f_inst_have_token( token_10f_t *t )
 {
-	return have_token;
+	return t->have_token;
 }
 
-static void token_isr(uint16_t flags)
+void token_10f_inst_isr( token_10f_t *t )
 {
-	have_token = true;
-	token_10f_conf.haz_token();
+	token_stats_arrive(&t->stats, true);
+	t->have_token = true;
+	t->conf->haz_token();
 }
 
-static pinint_conf_t token_int;
-
-void token_10f_init( void )
+void token_10f_inst_init( token_10f_t *t )
 {
-	*token_10f_conf.gt_dir |= token_10f_conf.gt_mask;
-	*token_10f_conf.ht_dir &= ~token_10f_conf.ht_mask;
+	const token_10f_conf_t *c = t->conf;
+
+	*c->gt_dir |= c->gt_mask;
+	*c->ht_dir &= ~c->ht_mask;
 
-	gt_low();
+	gt_low(t);
 
-	token_int.mask = token_10f_conf.ht_mask;
-	token_int.int_cb = token_isr;
+	t->token_int.mask = c->ht_mask;
 	/* mmm... hacky */
-	if( token_10f_conf.ht_port == &P2IN )
-		token_int.mask <<= 8;
-	pinint_add( &token_int );
+	if( c->ht_port == &P2IN )
+		t->token_int.mask <<= 8;
+	pinint_add( &t->token_int );
 
 	/* Low-to-high interrupts please (more hackyness) */
-	if( token_10f_conf.ht_port == &P1IN ) {
-		P1IES &= ~token_10f_conf.ht_mask;
-		P1IE |= token_10f_conf.ht_mask;
+	if( c->ht_port == &P1IN ) {
+		P1IES &= ~c->ht_mask;
+		P1IE |= c->ht_mask;
 	} else {
-		P2IES &= ~token_10f_conf.ht_mask;
-		P2IE |= token_10f_conf.ht_mask;
+		P2IES &= ~c->ht_mask;
+		P2IE |= c->ht_mask;
 	}
 
-	have_token = false;
+	t->have_token = false;
+	token_stats_reset(&t->stats);
 }
 
-const token_drv_t token_10f_drv = {
-	.req = req,
-	.cancel_req = cancel_req,
-	.release = release,
-	.have_token = get_have_token,
-};
+TOKEN_10F_INSTANCE( token_10f, token_10f_conf );
@@ -1,9 +1,12 @@
 #ifndef __TOKEN_10F_H
 #define __TOKEN_10F_H
-/* Token client driver for normal boards that have a PIC 10F200 */
+/* Token client driver for normal boards that have a PIC 10F200
+   One instance drives the token for one bus.  Define them with
+   TOKEN_10F_INSTANCE. */
 #include "token-drv.h"
 #include <io.h>
 #include <stdint.h>
+#include <drivers/pinint.h>
 
 typedef struct {
 	void (*haz_token) (void);
@@ -19,9 +22,57 @@ typedef struct {
 	uint8_t ht_mask;
 } token_10f_conf_t;
 
-extern const token_10f_conf_t token_10f_conf;
-extern const token_drv_t token_10f_drv;
+/* State of one instance.  Nothing outside token-10f.c should touch it. */
+typedef struct {
+	const token_10f_conf_t *conf;
+	bool have_token;
+	token_stats_t stats;
+	pinint_conf_t token_int;
+} token_10f_t;
+
+void token_10f_inst_init( token_10f_t *t );
+void token_10f_inst_req( token_10f_t *t );
+void token_10f_inst_release( token_10f_t *t );
+void token_10f_inst_cancel_req( token_10f_t *t );
+bool token_10f_inst_have_token( token_10f_t *t );
+void token_10f_inst_isr( token_10f_t *t );
 
-void token_10f_init( void );
+/* Declare the instance called name, its driver name_drv, and
+   name_init() */
+#define TOKEN_10F_INSTANCE_DECLARE(name)			\
+	extern token_10f_t name;				\
+	extern const token_drv_t name ## _drv;			\
+	void name ## _init( void )
+
+/* Define the instance called name, configured by conf_ (a
+   token_10f_conf_t) */
+#define TOKEN_10F_INSTANCE(name, conf_)					\
+	TOKEN_10F_INSTANCE_DECLARE(name);				\
+	static void name ## _req( void ) { token_10f_inst_req( &name ); } \
+	static void name ## _release( void )				\
+	{ token_10f_inst_release( &name ); }				\
+	static void name ## _cancel_req( void )				\
+	{ token_10f_inst_cancel_req( &name ); }				\
+	static bool name ## _have_token( void )				\
+	{ return token_10f_inst_have_token( &name ); }			\
+	static void name ## _isr( uint16_t flags )			\
+	{ token_10f_inst_isr( &name ); }				\
+	void name ## _init( void ) { token_10f_inst_init( &name ); }	\
+	token_10f_t name = {						\
+		.conf = &(conf_),					\
+		.token_int = { .int_cb = name ## _isr },		\
+	};								\
+	const token_drv_t name ## _drv = {				\
+		.req = name ## _req,					\
+		.cancel_req = name ## _cancel_req,			\
+		.release = name ## _release,				\
+		.have_token = name ## _have_token,			\
+		.stats = &name.stats,					\
+	}
+
+/* The board's first (usually only) bus's token, configured by
+   token_10f_conf: token_10f_drv and token_10f_init() */
+extern const token_10f_conf_t token_10f_conf;
+TOKEN_10F_INSTANCE_DECLARE(token_10f);
 
 #endif	/* __TOKEN_10F_H */
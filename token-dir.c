@@ -5,153 +5,126 @@
 #include <drivers/pinint.h>
 #include <drivers/sched.h>
 
-static bool token_regen_cb( void *ud );
+#define to_low(t) do { (*(t)->conf->to_port) &= ~(t)->conf->to_mask; } while (0)
+#define to_high(t) do { (*(t)->conf->to_port) |= (t)->conf->to_mask; } while (0)
 
-static bool have_token;
-static bool requested;
-static uint16_t last_tok_time;
-
-const sched_task_t token_regen =
-{
-	.t = 250,	/* Suggestions welcome */
-	.cb = token_regen_cb,
-	.udata = NULL
-};
-
-#define to_low() do { (*token_dir_conf.to_port) &= ~token_dir_conf.to_mask; } while (0)
-#define to_high() do { (*token_dir_conf.to_port) |= token_dir_conf.to_mask; } while (0)
-
-static void emit_token( void )
+static void emit_token( token_dir_t *t )
 {
 	uint8_t i;
-	to_low();
+	to_low(t);
 
 	/* Yea, it's a long time -- will require some adjustment */
 	for(i=0; i<64;i++)
 		nop();
 
-	to_high();
+	to_high(t);
 }
 
-static void req( void )
+void token_dir_inst_req( token_dir_t *t )
 {
-	requested = true;
+	t->requested = true;
 }
 
-static void release( void )
+void token_dir_inst_release( token_dir_t *t )
 {
-	requested = false;
+	t->requested = false;
 
-	last_tok_time = sched_time;
-	sched_rem(&token_regen);
-	sched_add(&token_regen);
+	t->last_tok_time = sched_time;
+	sched_rem(&t->regen_task);
+	sched_add(&t->regen_task);
 
-	if(have_token) {
-		have_token = false;
-		emit_token();
+	if(t->have_token) {
+		token_stats_release(&t->stats);
+		t->have_token = false;
+		emit_token(t);
 	}
 }
 
-static void cancel_req( void )
-{
-	release();
-}
-
-static bool get_have_token( void )
+bool token_dir_inst_have_token( token_dir_t *t )
 {
-	return have_token;
+	return t->have_token;
 }
 
-static bool token_regen_cb( void *ud )
+bool token_dir_regen_cb( void *ud )
 {
+	token_dir_t *t = ud;
 
-	if (sched_time_since(last_tok_time) > 250)
-		emit_token();
+	if (sched_time_since(t->last_tok_time) > TOKEN_DIR_REGEN_TICKS)
+		emit_token(t);
 
 	return true;
 }
 
-static bool emit_delayed(void *ud)
+bool token_dir_emit_cb( void *ud )
 {
-	void **ud2;
+	token_dir_t *t = ud;
 
-	emit_token();
-
-	/* Mark timeout as unregistered */
-	ud2 = ud;
-	*ud2 = NULL;
+	emit_token(t);
+	t->emit_pending = false;
 	return false;
 }
 
-static sched_task_t emit_timeout = {
-	.cb = emit_delayed,
-	/* We set this to non-NULL when this timeout is registered */
-	.udata = NULL,
-};
-
-static void token_isr(uint16_t flags)
+void token_dir_inst_isr( token_dir_t *t )
 {
 
-	last_tok_time = sched_time;
+	t->last_tok_time = sched_time;
 
-	if( have_token )
+	if( t->have_token ) {
 		/* So, this occuring shows there are duplicate tokens on the
 		 * bus. This sucks, and could have caused data corruption.
 		 * However, there's nothing that can be done at this point
 		 * which will make it any better, and in fact it's good that
 		 * we can congeal two tokens into one by dropping one here. */
+		token_stats_dup(&t->stats);
 		return;
+	}
+
+	token_stats_arrive(&t->stats, t->requested);
 
-	if( requested ) {
-		have_token = true;
-		requested = false;
-		token_dir_conf.haz_token();
-	} else if (emit_timeout.udata == NULL) {
+	if( t->requested ) {
+		t->have_token = true;
+		t->requested = false;
+		t->conf->haz_token();
+	} else if (!t->emit_pending) {
 		/* Pass it on after a small delay */
-		emit_timeout.t = 2;
-		/* Use udata to determine if we've already registered this callback */
-		emit_timeout.udata = &emit_timeout.udata;
-		sched_add(&emit_timeout);
+		t->emit_task.t = 2;
+		t->emit_pending = true;
+		sched_add(&t->emit_task);
 	}
 }
 
-const token_drv_t token_dir_drv = {
-	.req = req,
-	.cancel_req = cancel_req,
-	.release = release,
-	.have_token = get_have_token,
-};
-
-static pinint_conf_t token_int;
-
-void token_dir_init( void )
+void token_dir_inst_init( token_dir_t *t )
 {
-	have_token = false;
-	requested = false;
+	const token_dir_conf_t *c = t->conf;
+
+	t->have_token = false;
+	t->requested = false;
+	t->emit_pending = false;
+	token_stats_reset(&t->stats);
 
-	to_high();
-	*token_dir_conf.to_dir |= token_dir_conf.to_mask;
-	*token_dir_conf.ti_dir &= ~token_dir_conf.ti_mask;
+	to_high(t);
+	*c->to_dir |= c->to_mask;
+	*c->ti_dir &= ~c->ti_mask;
 
-	token_int.mask = token_dir_conf.ti_mask;
-	token_int.int_cb = token_isr;
+	t->token_int.mask = c->ti_mask;
 	/* mmm... hacky */
-	if( token_dir_conf.ti_port == &P2IN )
-		token_int.mask <<= 8;
-	pinint_add( &token_int );
+	if( c->ti_port == &P2IN )
+		t->token_int.mask <<= 8;
+	pinint_add( &t->token_int );
 
 	/* Low-to-high interrupts please (more hackyness) */
-	if( token_dir_conf.ti_port == &P1IN ) {
-		P1IES &= ~token_dir_conf.ti_mask;
-		P1IE |= token_dir_conf.ti_mask;
+	if( c->ti_port == &P1IN ) {
+		P1IES &= ~c->ti_mask;
+		P1IE |= c->ti_mask;
 	} else {
-		P2IES &= ~token_dir_conf.ti_mask;
-		P2IE |= token_dir_conf.ti_mask;
+		P2IES &= ~c->ti_mask;
+		P2IE |= c->ti_mask;
 	}
 }
 
-void token_dir_emit_first( void )
+void token_dir_inst_emit_first( token_dir_t *t )
 {
-	emit_token();
+	emit_token(t);
 }
 
+TOKEN_DIR_INSTANCE( token_dir, token_dir_conf );
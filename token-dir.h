@@ -3,11 +3,20 @@
 /* Token driver for master.
    In addition to token passing/requesting:
    * Initial token generation
-   * Token loss detection and regeneration */
+   * Token loss detection and regeneration
+   One instance drives the token for one bus.  Define them with
+   TOKEN_DIR_INSTANCE. */
 #include "token-drv.h"
 #include <io.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <drivers/pinint.h>
+#include <drivers/sched.h>
+
+/* Ticks without seeing the token before another is generated */
+#ifndef TOKEN_DIR_REGEN_TICKS
+#define TOKEN_DIR_REGEN_TICKS 250
+#endif
 
 typedef struct {
 	void (*haz_token) (void);
@@ -23,12 +32,80 @@ typedef struct {
 	uint8_t ti_mask;
 } token_dir_conf_t;
 
-extern const token_dir_conf_t token_dir_conf;
-extern const token_drv_t token_dir_drv;
+/* State of one instance.  Nothing outside token-dir.c should touch it. */
+typedef struct {
+	const token_dir_conf_t *conf;
+	bool have_token;
+	bool requested;
+	uint16_t last_tok_time;
+	token_stats_t stats;
+	pinint_conf_t token_int;
+	/* Checks for a lost token */
+	sched_task_t regen_task;
+	/* Passes the token on, and whether it's waiting to */
+	sched_task_t emit_task;
+	bool emit_pending;
+} token_dir_t;
 
-void token_dir_init( void );
+void token_dir_inst_init( token_dir_t *t );
+void token_dir_inst_req( token_dir_t *t );
+void token_dir_inst_release( token_dir_t *t );
+bool token_dir_inst_have_token( token_dir_t *t );
+void token_dir_inst_isr( token_dir_t *t );
+void token_dir_inst_emit_first( token_dir_t *t );
+/* Scheduler callbacks, for TOKEN_DIR_INSTANCE */
+bool token_dir_regen_cb( void *ud );
+bool token_dir_emit_cb( void *ud );
 
-/* Emit the first token */
-void token_dir_emit_first( void );
+/* Declare the instance called name, its driver name_drv, and:
+     name_init()        Initialise it
+     name_emit_first()  Emit the first token */
+#define TOKEN_DIR_INSTANCE_DECLARE(name)			\
+	extern token_dir_t name;				\
+	extern const token_drv_t name ## _drv;			\
+	void name ## _init( void );				\
+	void name ## _emit_first( void )
+
+/* Define the instance called name, configured by conf_ (a
+   token_dir_conf_t) */
+#define TOKEN_DIR_INSTANCE(name, conf_)					\
+	TOKEN_DIR_INSTANCE_DECLARE(name);				\
+	static void name ## _req( void ) { token_dir_inst_req( &name ); } \
+	static void name ## _release( void )				\
+	{ token_dir_inst_release( &name ); }				\
+	static bool name ## _have_token( void )				\
+	{ return token_dir_inst_have_token( &name ); }			\
+	static void name ## _isr( uint16_t flags )			\
+	{ token_dir_inst_isr( &name ); }				\
+	void name ## _init( void ) { token_dir_inst_init( &name ); }	\
+	void name ## _emit_first( void )				\
+	{ token_dir_inst_emit_first( &name ); }				\
+	token_dir_t name = {						\
+		.conf = &(conf_),					\
+		.token_int = { .int_cb = name ## _isr },		\
+		.regen_task = {						\
+			.t = TOKEN_DIR_REGEN_TICKS,			\
+			.cb = token_dir_regen_cb,			\
+			.udata = &name,					\
+		},							\
+		.emit_task = {						\
+			.cb = token_dir_emit_cb,			\
+			.udata = &name,					\
+		},							\
+	};								\
+	const token_drv_t name ## _drv = {				\
+		.req = name ## _req,					\
+		/* Releases the token if we have it */			\
+		.cancel_req = name ## _release,				\
+		.release = name ## _release,				\
+		.have_token = name ## _have_token,			\
+		.stats = &name.stats,					\
+	}
+
+/* The board's first (usually only) bus's token, configured by
+   token_dir_conf: token_dir_drv, token_dir_init() and
+   token_dir_emit_first() */
+extern const token_dir_conf_t token_dir_conf;
+TOKEN_DIR_INSTANCE_DECLARE(token_dir);
 
 #endif	/* __TOKEN_DIR_H */
@@ -1,6 +1,7 @@
 #ifndef __TOKEN_DRV_H
 #define __TOKEN_DRV_H
 #include <stdbool.h>
+#include "token-stats.h"
 
 typedef struct {
 	/* Request the token */
@@ -16,6 +17,9 @@ typedef struct {
 
 	/* Returns true if we currently have the token */
 	bool (*have_token) (void);
+
+	/* Token timing statistics */
+	token_stats_t *stats;
 } token_drv_t;
 
 #endif	/* __TOKEN_DRV_H */
@@ -2,54 +2,35 @@
 #include <drivers/sched.h>
 #include <stdint.h>
 
-extern const token_dummy_conf_t token_dummy_conf;
-static uint16_t delay;
-
-static bool timeout( void *ud )
+bool token_dummy_timeout_cb( void *ud )
 {
-	token_dummy_conf.haz_token();
-	return false;
-}
+	token_dummy_t *t = ud;
 
-static sched_task_t timeout_task = 
-{
-	.t = 0,
-	.cb = timeout,
-	.udata = NULL,
-};
-
-void token_dummy_init( uint16_t _delay )
-{
-	delay = _delay;
+	token_stats_arrive(&t->stats, true);
+	t->conf->haz_token();
+	return false;
 }
 
-static void req( void )
+void token_dummy_inst_init( token_dummy_t *t, uint16_t delay )
 {
-	timeout_task.t = delay;
-	sched_add(&timeout_task);
+	t->delay = delay;
+	token_stats_reset(&t->stats);
 }
 
-static void cancel_req( void )
+void token_dummy_inst_req( token_dummy_t *t )
 {
-	sched_rem(&timeout_task);
+	t->timeout_task.t = t->delay;
+	sched_add(&t->timeout_task);
 }
 
-static void release( void )
+void token_dummy_inst_cancel_req( token_dummy_t *t )
 {
-	/* Nothing to do! */
+	sched_rem(&t->timeout_task);
 }
 
-static bool have_token( void )
+void token_dummy_inst_release( token_dummy_t *t )
 {
-	/* Pretend to always have the token... */
-	/* This won't do what you want when enumerating... but this driver doesn't
-	 really do what you want anyway! */
-	return true;
+	token_stats_release(&t->stats);
 }
 
-const token_drv_t token_dummy_drv = {
-	.req = req,
-	.cancel_req = cancel_req,
-	.release = release,
-	.have_token = have_token,
-};
+TOKEN_DUMMY_INSTANCE( token_dummy, token_dummy_conf );
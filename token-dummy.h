@@ -1,16 +1,73 @@
 #ifndef __TOKEN_DUMMY_H
 #define __TOKEN_DUMMY_H
 /* Token client driver that uses timeouts to emulate the token
-   Mainly useful for debugging purposes. */
+   Mainly useful for debugging purposes.  One instance per bus;
+   define them with TOKEN_DUMMY_INSTANCE. */
 #include "token-drv.h"
+#include <drivers/sched.h>
 #include <stdint.h>
 
 typedef struct {
 	void (*haz_token) (void);
 } token_dummy_conf_t;
 
-extern const token_drv_t token_dummy_drv;
+/* State of one instance.  Nothing outside token-dummy.c should touch it. */
+typedef struct {
+	const token_dummy_conf_t *conf;
+	uint16_t delay;
+	token_stats_t stats;
+	sched_task_t timeout_task;
+} token_dummy_t;
+
+void token_dummy_inst_init( token_dummy_t *t, uint16_t delay );
+void token_dummy_inst_req( token_dummy_t *t );
+void token_dummy_inst_cancel_req( token_dummy_t *t );
+void token_dummy_inst_release( token_dummy_t *t );
+
+/* Scheduler callback, for TOKEN_DUMMY_INSTANCE */
+bool token_dummy_timeout_cb( void *ud );
+
+/* Declare the instance called name, its driver name_drv, and
+   name_init(delay) */
+#define TOKEN_DUMMY_INSTANCE_DECLARE(name)			\
+	extern token_dummy_t name;				\
+	extern const token_drv_t name ## _drv;			\
+	void name ## _init( uint16_t delay )
+
+/* Define the instance called name, configured by conf_ (a
+   token_dummy_conf_t) */
+#define TOKEN_DUMMY_INSTANCE(name, conf_)				\
+	TOKEN_DUMMY_INSTANCE_DECLARE(name);				\
+	static void name ## _req( void ) { token_dummy_inst_req( &name ); } \
+	static void name ## _cancel_req( void )				\
+	{ token_dummy_inst_cancel_req( &name ); }			\
+	static void name ## _release( void )				\
+	{ token_dummy_inst_release( &name ); }				\
+	/* Pretend to always have the token.  This won't do what you	\
+	   want when enumerating... but this driver doesn't really do	\
+	   what you want anyway! */					\
+	static bool name ## _have_token( void ) { return true; }	\
+	void name ## _init( uint16_t delay )				\
+	{ token_dummy_inst_init( &name, delay ); }			\
+	token_dummy_t name = {						\
+		.conf = &(conf_),					\
+		.timeout_task = {					\
+			.t = 0,						\
+			.cb = token_dummy_timeout_cb,			\
+			.udata = &name,					\
+		},							\
+	};								\
+	const token_drv_t name ## _drv = {				\
+		.req = name ## _req,					\
+		.cancel_req = name ## _cancel_req,			\
+		.release = name ## _release,				\
+		.have_token = name ## _have_token,			\
+		.stats = &name.stats,					\
+	}
 
-void token_dummy_init( uint16_t delay );
+/* The board's first (usually only) bus's token, configured by
+   token_dummy_conf: token_dummy_drv and token_dummy_init(delay) */
+extern const token_dummy_conf_t token_dummy_conf;
+TOKEN_DUMMY_INSTANCE_DECLARE(token_dummy);
 
 #endif	/* __TOKEN_DUMMY_H */
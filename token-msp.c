@@ -4,96 +4,88 @@
 #include <io.h>
 #include <drivers/pinint.h>
 
-static bool have_token;
-static bool requested;
+#define to_low(t) do { (*(t)->conf->to_port) &= ~(t)->conf->to_mask; } while (0)
+#define to_high(t) do { (*(t)->conf->to_port) |= (t)->conf->to_mask; } while (0)
 
-#define to_low() do { (*token_msp_conf.to_port) &= ~token_msp_conf.to_mask; } while (0)
-#define to_high() do { (*token_msp_conf.to_port) |= token_msp_conf.to_mask; } while (0)
-
-static void emit_token( void )
+static void emit_token( token_msp_t *t )
 {
 	uint8_t i;
-	to_low();
+	to_low(t);
 
 	/* Yea, it's a long time -- will require some adjustment */
 	for(i=0; i<64;i++)
 		nop();
 
-	to_high();
+	to_high(t);
 }
 
-static void req( void )
+void token_msp_inst_req( token_msp_t *t )
 {
-	requested = true;
+	t->requested = true;
 }
 
-static void release( void )
+void token_msp_inst_release( token_msp_t *t )
 {
-	requested = false;
+	t->requested = false;
 
-	if(have_token) {
-		have_token = false;
-		emit_token();
+	if(t->have_token) {
+		token_stats_release(&t->stats);
+		t->have_token = false;
+		emit_token(t);
 	}
 }
 
-static void cancel_req( void )
-{
-	release();
-}
-
-static bool get_have_token( void )
+bool token_msp_inst_have_token( token_msp_t *t )
 {
-	return have_token;
+	return t->have_token;
 }
 
-static void token_isr(uint16_t flags)
+void token_msp_inst_isr( token_msp_t *t )
 {
-	if( have_token )
+	if( t->have_token ) {
 		/* Ignore duplicate tokens */
+		token_stats_dup(&t->stats);
 		return;
+	}
+
+	token_stats_arrive(&t->stats, t->requested);
 
-	if( requested ) {
-		have_token = true;
-		requested = false;
-		token_msp_conf.haz_token();
+	if( t->requested ) {
+		t->have_token = true;
+		t->requested = false;
+		t->conf->haz_token();
 	} else
-		emit_token();
+		emit_token(t);
 }
 
-static pinint_conf_t token_int;
-
-void token_msp_init( void )
+void token_msp_inst_init( token_msp_t *t )
 {
-	have_token = false;
-	requested = false;
+	const token_msp_conf_t *c = t->conf;
+
+	t->have_token = false;
+	t->requested = false;
+	token_stats_reset(&t->stats);
 
-	to_high();
-	*token_msp_conf.to_dir |= token_msp_conf.to_mask;
-	*token_msp_conf.ti_dir &= ~token_msp_conf.ti_mask;
+	to_high(t);
+	*c->to_dir |= c->to_mask;
+	*c->ti_dir &= ~c->ti_mask;
 
-	token_int.mask = token_msp_conf.ti_mask;
-	token_int.int_cb = token_isr;
+	t->token_int.mask = c->ti_mask;
 	/* mmm... hacky */
-	if( token_msp_conf.ti_port == &P2IN )
-		token_int.mask <<= 8;
-	pinint_add( &token_int );
+	if( c->ti_port == &P2IN )
+		t->token_int.mask <<= 8;
+	pinint_add( &t->token_int );
 
 	/* Low-to-high interrupts please (more hackyness) */
-	if( token_msp_conf.ti_port == &P1IN ) {
-		P1IES &= ~token_msp_conf.ti_mask;
-		P1IE |= token_msp_conf.ti_mask;
+	if( c->ti_port == &P1IN ) {
+		P1IES &= ~c->ti_mask;
+		P1IE |= c->ti_mask;
 	} else {
-		P2IES &= ~token_msp_conf.ti_mask;
-		P2IE |= token_msp_conf.ti_mask;
+		P2IES &= ~c->ti_mask;
+		P2IE |= c->ti_mask;
 	}
 
-	emit_token();
+	emit_token(t);
 }
 
-const token_drv_t token_msp_drv = {
-	.req = req,
-	.cancel_req = cancel_req,
-	.release = release,
-	.have_token = get_have_token,
-};
+TOKEN_MSP_INSTANCE( token_msp, token_msp_conf );
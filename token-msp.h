@@ -1,10 +1,13 @@
 #ifndef __TOKEN_MSP_H
 #define __TOKEN_MSP_H
 /* Token client driver for an MSP that lacks a 10F to do it for it.
-   (e.g. a pc-sric board in pass-through mode) */
+   (e.g. a pc-sric board in pass-through mode)
+   One instance drives the token for one bus.  Define them with
+   TOKEN_MSP_INSTANCE. */
 #include "token-drv.h"
 #include <io.h>
 #include <stdint.h>
+#include <drivers/pinint.h>
 
 typedef struct {
 	void (*haz_token) (void);
@@ -20,9 +23,56 @@ typedef struct {
 	uint8_t ti_mask;
 } token_msp_conf_t;
 
-extern const token_msp_conf_t token_msp_conf;
-extern const token_drv_t token_msp_drv;
+/* State of one instance.  Nothing outside token-msp.c should touch it. */
+typedef struct {
+	const token_msp_conf_t *conf;
+	bool have_token;
+	bool requested;
+	token_stats_t stats;
+	pinint_conf_t token_int;
+} token_msp_t;
+
+void token_msp_inst_init( token_msp_t *t );
+void token_msp_inst_req( token_msp_t *t );
+void token_msp_inst_release( token_msp_t *t );
+bool token_msp_inst_have_token( token_msp_t *t );
+void token_msp_inst_isr( token_msp_t *t );
 
-void token_msp_init( void );
+/* Declare the instance called name, its driver name_drv, and
+   name_init() */
+#define TOKEN_MSP_INSTANCE_DECLARE(name)			\
+	extern token_msp_t name;				\
+	extern const token_drv_t name ## _drv;			\
+	void name ## _init( void )
+
+/* Define the instance called name, configured by conf_ (a
+   token_msp_conf_t) */
+#define TOKEN_MSP_INSTANCE(name, conf_)					\
+	TOKEN_MSP_INSTANCE_DECLARE(name);				\
+	static void name ## _req( void ) { token_msp_inst_req( &name ); } \
+	static void name ## _release( void )				\
+	{ token_msp_inst_release( &name ); }				\
+	static bool name ## _have_token( void )				\
+	{ return token_msp_inst_have_token( &name ); }			\
+	static void name ## _isr( uint16_t flags )			\
+	{ token_msp_inst_isr( &name ); }				\
+	void name ## _init( void ) { token_msp_inst_init( &name ); }	\
+	token_msp_t name = {						\
+		.conf = &(conf_),					\
+		.token_int = { .int_cb = name ## _isr },		\
+	};								\
+	const token_drv_t name ## _drv = {				\
+		.req = name ## _req,					\
+		/* Releases the token if we have it */			\
+		.cancel_req = name ## _release,				\
+		.release = name ## _release,				\
+		.have_token = name ## _have_token,			\
+		.stats = &name.stats,					\
+	}
+
+/* The board's first (usually only) bus's token, configured by
+   token_msp_conf: token_msp_drv and token_msp_init() */
+extern const token_msp_conf_t token_msp_conf;
+TOKEN_MSP_INSTANCE_DECLARE(token_msp);
 
 #endif	/* __TOKEN_H */
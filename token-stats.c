@@ -0,0 +1,100 @@
+#include "token-stats.h"
+#include <drivers/sched.h>
+#include <signal.h>
+
+/* Averages are exponentially weighted, with new samples given a weight of
+   1/(2^AVG_SHIFT).  The accumulators hold the average scaled up by this. */
+#define AVG_SHIFT 3
+
+static void sample( uint16_t t, uint16_t *min, uint16_t *avg, uint16_t *max,
+		    uint32_t *acc, bool first )
+{
+	if( first ) {
+		*min = *max = t;
+		*acc = ((uint32_t)t) << AVG_SHIFT;
+	} else {
+		if( t < *min )
+			*min = t;
+		if( t > *max )
+			*max = t;
+
+		*acc += t - (*acc >> AVG_SHIFT);
+	}
+
+	*avg = *acc >> AVG_SHIFT;
+}
+
+void token_stats_reset( token_stats_t *s )
+{
+	s->count = 0;
+	s->dups = 0;
+	s->loop_min = s->loop_avg = s->loop_max = 0;
+	s->hold_min = s->hold_avg = s->hold_max = 0;
+	s->loop_acc = s->hold_acc = 0;
+	s->holds = 0;
+	s->held = false;
+}
+
+void token_stats_arrive( token_stats_t *s, bool held )
+{
+	uint16_t now = sched_time;
+
+	/* The first arrival only gives us a reference point */
+	if( s->count != 0 )
+		sample( now - s->last_arrival,
+			&s->loop_min, &s->loop_avg, &s->loop_max,
+			&s->loop_acc, s->count == 1 );
+
+	if( s->count != 0xffff )
+		s->count++;
+
+	s->last_arrival = now;
+	s->held = held;
+}
+
+void token_stats_dup( token_stats_t *s )
+{
+	if( s->dups != 0xffff )
+		s->dups++;
+}
+
+void token_stats_release( token_stats_t *s )
+{
+	if( !s->held )
+		return;
+
+	s->held = false;
+	sample( sched_time_since( s->last_arrival ),
+		&s->hold_min, &s->hold_avg, &s->hold_max,
+		&s->hold_acc, s->holds == 0 );
+
+	if( s->holds != 0xffff )
+		s->holds++;
+}
+
+static uint8_t *pack16( uint8_t *buf, uint16_t v )
+{
+	*(buf++) = v & 0xff;
+	*(buf++) = (v >> 8) & 0xff;
+	return buf;
+}
+
+void token_stats_pack( const token_stats_t *s, uint8_t *buf )
+{
+	token_stats_t snap;
+
+	/* The token's arrivals are recorded in intr context, so take a
+	   copy that they can't change part way through */
+	dint();
+	snap = *s;
+	eint();
+
+	buf = pack16( buf, snap.count );
+	buf = pack16( buf, snap.dups );
+	buf = pack16( buf, snap.loop_min );
+	buf = pack16( buf, snap.loop_avg );
+	buf = pack16( buf, snap.loop_max );
+	buf = pack16( buf, snap.hold_min );
+	buf = pack16( buf, snap.hold_avg );
+	pack16( buf, snap.hold_max );
+}
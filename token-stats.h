@@ -0,0 +1,56 @@
+#ifndef __TOKEN_STATS_H
+#define __TOKEN_STATS_H
+/* Token timing statistics.
+   Each token driver keeps one of these, updated as the token arrives and
+   is passed on.  All times are in scheduler ticks.
+
+   Drivers that see every pass of the token (token-dir, token-msp) measure
+   the true loop time.  Drivers that only see the token when they've asked
+   for it (token-10f, token-dummy) measure the time between acquisitions. */
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	/* Number of token arrivals seen */
+	uint16_t count;
+	/* Number of duplicate tokens seen (arrivals whilst holding it) */
+	uint16_t dups;
+
+	/* Time between successive arrivals */
+	uint16_t loop_min, loop_avg, loop_max;
+	/* Time between taking the token and passing it on */
+	uint16_t hold_min, hold_avg, hold_max;
+
+	/* sched_time of the most recent arrival */
+	uint16_t last_arrival;
+
+	/* Private: */
+	uint32_t loop_acc, hold_acc;
+	uint16_t holds;
+	bool held;
+} token_stats_t;
+
+/* Number of bytes token_stats_pack() writes */
+#define TOKEN_STATS_PACKED_LEN 16
+
+/* Clear all statistics */
+void token_stats_reset( token_stats_t *s );
+
+/* Record the arrival of the token.
+   held is true if we're keeping it rather than passing it straight on.
+   Called in intr context. */
+void token_stats_arrive( token_stats_t *s, bool held );
+
+/* Record a duplicate token arriving.
+   Called in intr context. */
+void token_stats_dup( token_stats_t *s );
+
+/* Record that we've passed the token on */
+void token_stats_release( token_stats_t *s );
+
+/* Pack the statistics into buf as little-endian 16-bit words:
+   count, dups, loop min/avg/max, hold min/avg/max.
+   Not to be called in intr context, as it disables interrupts briefly. */
+void token_stats_pack( const token_stats_t *s, uint8_t *buf );
+
+#endif	/* __TOKEN_STATS_H */
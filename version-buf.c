@@ -9,10 +9,6 @@ uint8_t version_buf_read( const sric_if_t *iface )
 	uint8_t send;
 	const uint8_t *data = iface->rxbuf + SRIC_DATA;
 
-	if( iface->rxbuf[SRIC_LEN] != 3 )
-		/* Wrong amount of data */
-		return 0;
-
 	off = data[1] | (((uint16_t)data[2]) >> 8);
 	remaining = VERSIONBUF_LEN - off;
 